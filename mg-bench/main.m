@@ -0,0 +1,1156 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+/* mg-bench: times the core Mg operations on generated documents.
+
+   Usage: mg-bench [-g GRAPH] [-t TEST] [-m SECONDS] [-o OUTPUT]
+
+     -g GRAPH	only run graphs whose names contain GRAPH
+     -t TEST	only run tests whose names contain TEST
+     -m SECONDS	minimum time to spend on each test (default .25)
+     -o OUTPUT	write results to OUTPUT instead of stdout
+
+   Each graph has two module states, "a" and "b", differing in some
+   property of most of its layers. Results are written as JSON: one
+   entry per graph and test, with the number of iterations and the
+   minimum, median and mean time of one iteration in nanoseconds.
+
+   The "path-codec" graph is a set of paths rather than a document. Its
+   tests time MgPathCreateData() and MgPathCreateWithBytes(), except
+   "path-check", which isn't timed: it checks that paths round-trip and
+   that truncated or corrupted data is either rejected or decodes to a
+   valid path, exiting with status 1 if not. Built with
+   AddressSanitizer it doubles as a fuzzer for the decoder. */
+
+#import "Mg.h"
+
+#import "MgCoreGraphics.h"
+
+#import <Foundation/Foundation.h>
+#import <mach/mach_time.h>
+
+#include <unistd.h>
+
+#define CANVAS_WIDTH 1024
+#define CANVAS_HEIGHT 768
+
+/* Transitions begin at this time, as zero means "now". */
+
+#define TRANSITION_BEGIN 1
+
+#define HIT_TEST_POINTS 1000
+
+#define MIN_ITERATIONS 3
+#define MAX_ITERATIONS 100000
+
+#define CODEC_PATHS 1000
+#define CODEC_FLIPS_PER_PATH 64
+
+/* Lossy path data stores coordinates rounded to 1/256. */
+
+#define CODEC_LOSSY_ERROR (.5 / 256)
+
+static const char *program_name = "mg-bench";
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: %s [-g GRAPH] [-t TEST] [-m SECONDS]"
+	  " [-o OUTPUT]\n", program_name);
+  exit(2);
+}
+
+/** Utilities. **/
+
+static uint64_t
+time_ns(void)
+{
+  static mach_timebase_info_data_t info;
+
+  if (info.denom == 0)
+    mach_timebase_info(&info);
+
+  return mach_absolute_time() * info.numer / info.denom;
+}
+
+/* Deterministic pseudo-random numbers, so every run measures the same
+   graphs. Returns values in [0, 1). */
+
+static double
+random_value(uint32_t *seed)
+{
+  *seed = *seed * 1664525 + 1013904223;
+  return (*seed >> 8) * (1. / (1 << 24));
+}
+
+static CGColorRef
+create_color(uint32_t *seed, CGFloat alpha)
+{
+  return MgCreateSRGBColor(random_value(seed), random_value(seed),
+			   random_value(seed), alpha);
+}
+
+static MgModuleLayer *
+make_root(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = [MgModuleLayer node];
+
+  root.name = @"root";
+  root.size = CGSizeMake(CANVAS_WIDTH, CANVAS_HEIGHT);
+  root.position = CGPointMake(CANVAS_WIDTH / 2, CANVAS_HEIGHT / 2);
+
+  *a = [MgModuleState moduleState];
+  (*a).name = @"a";
+  *b = [MgModuleState moduleState];
+  (*b).name = @"b";
+
+  [root addModuleState:*a];
+  [root addModuleState:*b];
+
+  return root;
+}
+
+/* Returns the state of `layer' for `ms', marking the properties named
+   by `keys' as defined by it. */
+
+static MgLayerState *
+define_state(MgLayer *layer, MgModuleState *ms, NSArray *keys)
+{
+  MgLayerState *state = (MgLayerState *)[layer addModuleState:ms];
+
+  for (NSString *key in keys)
+    [state setDefinesValue:YES forKey:key];
+
+  return state;
+}
+
+static MgRectLayer *
+make_rect(CGRect r, uint32_t *seed, CGFloat alpha)
+{
+  MgRectLayer *layer = [MgRectLayer node];
+
+  layer.position = CGPointMake(CGRectGetMidX(r), CGRectGetMidY(r));
+  layer.size = r.size;
+  layer.cornerRadius = r.size.width * .1;
+
+  CGColorRef color = create_color(seed, alpha);
+  layer.fillColor = color;
+  CGColorRelease(color);
+
+  return layer;
+}
+
+static CGPathRef
+create_star_path(CGPoint c, CGFloat r, size_t points, uint32_t *seed)
+{
+  CGMutablePathRef path = CGPathCreateMutable();
+
+  for (size_t i = 0; i < points * 2; i++)
+    {
+      double a = M_PI * i / points;
+      CGFloat ri = r * (i & 1 ? .4 + random_value(seed) * .2 : 1);
+      CGPoint p = CGPointMake(c.x + ri * cos(a), c.y + ri * sin(a));
+
+      if (i == 0)
+	CGPathMoveToPoint(path, NULL, p.x, p.y);
+      else
+	{
+	  double ca = a - M_PI / (points * 2);
+	  CGPathAddQuadCurveToPoint(path, NULL, c.x + r * .8 * cos(ca),
+				    c.y + r * .8 * sin(ca), p.x, p.y);
+	}
+    }
+
+  CGPathCloseSubpath(path);
+  return path;
+}
+
+/** Graph generators. **/
+
+/* A chain of nested groups, each containing a rect and the next group. */
+
+static MgModuleLayer *
+make_deep_groups(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 1;
+
+  MgGroupLayer *parent = root;
+
+  for (int i = 0; i < 256; i++)
+    {
+      MgGroupLayer *group = [MgGroupLayer node];
+      group.size = CGSizeMake(CANVAS_WIDTH, CANVAS_HEIGHT);
+      group.position = CGPointMake(CANVAS_WIDTH / 2 + 1, CANVAS_HEIGHT / 2);
+
+      [group addSublayer:make_rect(CGRectMake(random_value(&seed) * 900,
+			random_value(&seed) * 650, 64, 64), &seed, 1)];
+
+      define_state(group, *b, @[@"rotation"]).rotation = .002;
+
+      [parent addSublayer:group];
+      parent = group;
+    }
+
+  return root;
+}
+
+/* Many rects in a single group. */
+
+static MgModuleLayer *
+make_flat_rects(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 2;
+
+  NSMutableArray *sublayers = [NSMutableArray array];
+
+  for (int y = 0; y < 100; y++)
+    {
+      for (int x = 0; x < 100; x++)
+	{
+	  CGRect r = CGRectMake(x * 10.24, y * 7.68, 8, 6);
+	  MgRectLayer *layer = make_rect(r, &seed, 1);
+
+	  MgLayerState *state = define_state(layer, *b,
+					     @[@"position", @"alpha"]);
+	  state.position = CGPointMake(CGRectGetMidX(r) + 4,
+				       CGRectGetMidY(r) + 3);
+	  state.alpha = .5;
+
+	  [sublayers addObject:layer];
+	}
+    }
+
+  root.sublayers = sublayers;
+  return root;
+}
+
+/* Large overlapping translucent layers with non-normal blend modes. */
+
+static MgModuleLayer *
+make_blend_layers(MgModuleState **a, MgModuleState **b)
+{
+  static const CGBlendMode modes[] =
+    {
+      kCGBlendModeMultiply, kCGBlendModeScreen, kCGBlendModeOverlay,
+      kCGBlendModeSoftLight, kCGBlendModeDifference, kCGBlendModeColor,
+    };
+
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 3;
+
+  NSMutableArray *sublayers = [NSMutableArray array];
+
+  for (int i = 0; i < 400; i++)
+    {
+      CGRect r = CGRectMake(random_value(&seed) * 700,
+			    random_value(&seed) * 500, 320, 240);
+      MgRectLayer *layer = make_rect(r, &seed, 1);
+      layer.alpha = .5;
+      layer.blendMode = modes[i % (sizeof(modes) / sizeof(modes[0]))];
+
+      define_state(layer, *b, @[@"alpha"]).alpha = .25;
+
+      [sublayers addObject:layer];
+    }
+
+  root.sublayers = sublayers;
+  return root;
+}
+
+/* A grid of image layers drawing a few large images. */
+
+static MgModuleLayer *
+make_image_mosaic(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  __block uint32_t seed = 4;
+
+  NSMutableArray *providers = [NSMutableArray array];
+
+  for (int i = 0; i < 4; i++)
+    {
+      CGImageRef im = MgImageCreateByDrawing(512, 512, false,
+	^(CGContextRef ctx)
+	{
+	  for (int j = 0; j < 64; j++)
+	    {
+	      CGColorRef color = create_color(&seed, 1);
+	      CGContextSetFillColorWithColor(ctx, color);
+	      CGColorRelease(color);
+	      CGContextFillEllipseInRect(ctx,
+		CGRectMake(random_value(&seed) * 448,
+			   random_value(&seed) * 448, 64, 64));
+	    }
+	});
+
+      [providers addObject:[MgImageProvider imageProviderWithImage:im]];
+      CGImageRelease(im);
+    }
+
+  NSMutableArray *sublayers = [NSMutableArray array];
+
+  for (int y = 0; y < 24; y++)
+    {
+      for (int x = 0; x < 32; x++)
+	{
+	  MgImageLayer *layer = [MgImageLayer node];
+	  layer.position = CGPointMake(x * 32 + 16, y * 32 + 16);
+	  layer.size = CGSizeMake(32, 32);
+	  layer.imageProvider = providers[(x + y) % [providers count]];
+
+	  define_state(layer, *b, @[@"scale"]).scale = 1.5;
+
+	  [sublayers addObject:layer];
+	}
+    }
+
+  root.sublayers = sublayers;
+  return root;
+}
+
+/* Filled and stroked curved paths, some of which change shape. */
+
+static MgModuleLayer *
+make_path_art(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 5;
+
+  NSMutableArray *sublayers = [NSMutableArray array];
+
+  for (int i = 0; i < 2000; i++)
+    {
+      MgPathLayer *layer = [MgPathLayer node];
+      layer.position = CGPointMake(random_value(&seed) * CANVAS_WIDTH,
+				   random_value(&seed) * CANVAS_HEIGHT);
+      layer.size = CGSizeMake(64, 64);
+      layer.drawingMode = kCGPathFillStroke;
+      layer.lineWidth = 2;
+
+      CGPathRef path = create_star_path(CGPointMake(32, 32), 30,
+					5 + i % 4, &seed);
+      layer.path = path;
+      CGPathRelease(path);
+
+      CGColorRef fill = create_color(&seed, .8);
+      CGColorRef stroke = create_color(&seed, 1);
+      layer.fillColor = fill;
+      layer.strokeColor = stroke;
+      CGColorRelease(stroke);
+
+      MgPathLayerState *state
+	= (MgPathLayerState *)define_state(layer, *b,
+	    (i % 10 == 0 ? @[@"fillColor", @"path"] : @[@"fillColor"]));
+
+      CGColorRef fill_b = create_color(&seed, .8);
+      state.fillColor = fill_b;
+      CGColorRelease(fill_b);
+      CGColorRelease(fill);
+
+      if (i % 10 == 0)
+	{
+	  CGPathRef path_b = create_star_path(CGPointMake(32, 32), 30,
+					      3 + i % 7, &seed);
+	  state.path = path_b;
+	  CGPathRelease(path_b);
+	}
+
+      [sublayers addObject:layer];
+    }
+
+  root.sublayers = sublayers;
+  return root;
+}
+
+/* Linear and radial gradients whose colors and locations change, so
+   every transition frame bakes a new color ramp for each of them. */
+
+static MgModuleLayer *
+make_gradient_ramps(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 7;
+
+  NSMutableArray *sublayers = [NSMutableArray array];
+
+  for (int i = 0; i < 500; i++)
+    {
+      MgGradientLayer *layer = [MgGradientLayer node];
+      layer.position = CGPointMake(random_value(&seed) * CANVAS_WIDTH,
+				   random_value(&seed) * CANVAS_HEIGHT);
+      layer.size = CGSizeMake(96, 96);
+      layer.radial = (i & 1) != 0;
+      if (layer.radial)
+	{
+	  layer.startPoint = layer.endPoint = CGPointMake(48, 48);
+	  layer.endRadius = 48;
+	}
+      else
+	layer.endPoint = CGPointMake(96, 96);
+
+      NSMutableArray *colors = [NSMutableArray array];
+      NSMutableArray *colors_b = [NSMutableArray array];
+      NSMutableArray *locations = [NSMutableArray array];
+      NSMutableArray *locations_b = [NSMutableArray array];
+
+      size_t stops = 2 + i % 4;
+
+      for (size_t j = 0; j < stops; j++)
+	{
+	  CGColorRef color = create_color(&seed, 1);
+	  CGColorRef color_b = create_color(&seed, .5);
+	  [colors addObject:(__bridge id)color];
+	  [colors_b addObject:(__bridge id)color_b];
+	  CGColorRelease(color);
+	  CGColorRelease(color_b);
+
+	  double loc = (double)j / (stops - 1);
+	  [locations addObject:@(loc)];
+	  [locations_b addObject:@(loc * loc)];
+	}
+
+      layer.colors = colors;
+      layer.locations = locations;
+
+      MgGradientLayerState *state
+	= (MgGradientLayerState *)define_state(layer, *b,
+					       @[@"colors", @"locations"]);
+      state.colors = colors_b;
+      state.locations = locations_b;
+
+      [sublayers addObject:layer];
+    }
+
+  root.sublayers = sublayers;
+  return root;
+}
+
+/* Each level holds two differently positioned references to the level
+   below, so the number of nodes is linear in the depth but the number
+   of layers drawn is exponential. */
+
+static MgModuleLayer *
+make_aliased_dag(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 6;
+
+  MgGroupLayer *level = [MgGroupLayer node];
+  level.size = CGSizeMake(16, 16);
+  [level addSublayer:make_rect(CGRectMake(0, 0, 16, 16), &seed, .75)];
+
+  CGFloat extent = 16;
+
+  for (int i = 0; i < 12; i++)
+    {
+      MgGroupLayer *next = [MgGroupLayer node];
+      bool horizontal = (i & 1) == 0;
+      next.size = (horizontal ? CGSizeMake(extent * 2, level.size.height)
+		   : CGSizeMake(level.size.width, extent * 2));
+
+      for (int j = 0; j < 2; j++)
+	{
+	  MgGroupLayer *wrapper = [MgGroupLayer node];
+	  wrapper.size = level.size;
+	  wrapper.position = (horizontal
+			      ? CGPointMake(extent * (j + .5),
+					    level.size.height / 2)
+			      : CGPointMake(level.size.width / 2,
+					    extent * (j + .5)));
+	  [wrapper addSublayer:level];
+
+	  define_state(wrapper, *b, @[@"alpha"]).alpha = .9;
+
+	  [next addSublayer:wrapper];
+	}
+
+      level.position = CGPointMake(level.size.width / 2,
+				   level.size.height / 2);
+      level = next;
+      if (!horizontal)
+	extent *= 2;
+    }
+
+  level.position = CGPointMake(CANVAS_WIDTH / 2, CANVAS_HEIGHT / 2);
+  [root addSublayer:level];
+
+  return root;
+}
+
+/* About 100,000 rects in three levels of groups, for profiling at
+   large document sizes. */
+
+static MgModuleLayer *
+make_huge_tree(MgModuleState **a, MgModuleState **b)
+{
+  MgModuleLayer *root = make_root(a, b);
+  uint32_t seed = 8;
+
+  NSMutableArray *outer = [NSMutableArray array];
+
+  for (int i = 0; i < 10; i++)
+    {
+      MgGroupLayer *group = [MgGroupLayer node];
+      group.size = CGSizeMake(CANVAS_WIDTH, CANVAS_HEIGHT);
+      group.position = CGPointMake(CANVAS_WIDTH / 2, CANVAS_HEIGHT / 2);
+
+      NSMutableArray *inner = [NSMutableArray array];
+
+      for (int j = 0; j < 100; j++)
+	{
+	  MgGroupLayer *sub = [MgGroupLayer node];
+	  sub.size = CGSizeMake(CANVAS_WIDTH, CANVAS_HEIGHT);
+	  sub.position = CGPointMake(CANVAS_WIDTH / 2, CANVAS_HEIGHT / 2);
+
+	  NSMutableArray *rects = [NSMutableArray array];
+
+	  for (int k = 0; k < 100; k++)
+	    {
+	      CGRect r = CGRectMake(random_value(&seed) * 1016,
+				    random_value(&seed) * 760, 8, 8);
+	      MgRectLayer *layer = make_rect(r, &seed, 1);
+
+	      define_state(layer, *b, @[@"alpha"]).alpha = .5;
+
+	      [rects addObject:layer];
+	    }
+
+	  sub.sublayers = rects;
+	  [inner addObject:sub];
+	}
+
+      group.sublayers = inner;
+      [outer addObject:group];
+    }
+
+  root.sublayers = outer;
+  return root;
+}
+
+/** Tests. **/
+
+static void
+evaluate_graph(MgNode *node, CFTimeInterval t, uint32_t mark)
+{
+  [node withPresentationTime:t handler:^
+    {
+      [node foreachNode:^(MgNode *child)
+	{
+	  evaluate_graph(child, t, mark);
+	} mark:mark];
+    }];
+}
+
+static int
+compare_uint64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Calls `body' repeatedly until `min_time' has passed (within the
+   iteration limits) and appends its timings to `results'. */
+
+static void
+run_test(NSMutableArray *results, NSString *graph, NSString *test,
+	 double min_time, void (^body)(void))
+{
+  /* One untimed call, to fill caches. */
+
+  @autoreleasepool
+    {
+      body();
+    }
+
+  size_t size = 64, count = 0;
+  uint64_t *samples = malloc(size * sizeof(uint64_t));
+  uint64_t total = 0, limit = min_time * 1e9;
+
+  while (count < MAX_ITERATIONS
+	 && (count < MIN_ITERATIONS || total < limit))
+    {
+      if (count == size)
+	{
+	  size *= 2;
+	  samples = realloc(samples, size * sizeof(uint64_t));
+	}
+
+      @autoreleasepool
+	{
+	  uint64_t t0 = time_ns();
+	  body();
+	  samples[count] = time_ns() - t0;
+	}
+
+      total += samples[count++];
+    }
+
+  qsort(samples, count, sizeof(uint64_t), compare_uint64);
+
+  [results addObject:@{
+    @"graph": graph,
+    @"test": test,
+    @"iterations": @(count),
+    @"min_ns": @(samples[0]),
+    @"median_ns": @(samples[count / 2]),
+    @"mean_ns": @(total / count),
+  }];
+
+  fprintf(stderr, "%-14s %-18s %12.3f ms\n", [graph UTF8String],
+	  [test UTF8String], samples[count / 2] * 1e-6);
+
+  free(samples);
+}
+
+static void
+run_graph(NSMutableArray *results, NSString *graph, MgModuleLayer *root,
+	  MgModuleState *a, MgModuleState *b, const char *test_filter,
+	  double min_time)
+{
+  bool (^wanted)(NSString *) = ^bool (NSString *test)
+    {
+      return (test_filter == NULL
+	      || strstr([test UTF8String], test_filter) != NULL);
+    };
+
+  root.moduleState = a;
+
+  if (wanted(@"state-switch"))
+    {
+      __block bool flag = false;
+
+      run_test(results, graph, @"state-switch", min_time, ^
+	{
+	  root.moduleState = (flag = !flag) ? b : a;
+	});
+
+      root.moduleState = a;
+    }
+
+  if (wanted(@"transition-frame"))
+    {
+      [root setModuleState:b options:@{
+	MgNodeAnimated: @YES,
+	MgNodeTransitionBegin: @(TRANSITION_BEGIN),
+	MgNodeTransitionDuration: @1,
+      }];
+
+      __block double t = 0;
+
+      run_test(results, graph, @"transition-frame", min_time, ^
+	{
+	  /* Advance within the transition, without retiring it. */
+
+	  t = fmod(t + 1. / 60, 1);
+	  evaluate_graph(root, TRANSITION_BEGIN + t, [MgNode nextMark]);
+	});
+
+      root.moduleState = a;
+    }
+
+  if (wanted(@"hit-test"))
+    {
+      CGPoint *points = malloc(HIT_TEST_POINTS * sizeof(CGPoint));
+      uint32_t seed = 7;
+
+      for (size_t i = 0; i < HIT_TEST_POINTS; i++)
+	{
+	  points[i] = CGPointMake(random_value(&seed) * CANVAS_WIDTH,
+				  random_value(&seed) * CANVAS_HEIGHT);
+	}
+
+      run_test(results, graph, @"hit-test", min_time, ^
+	{
+	  for (size_t i = 0; i < HIT_TEST_POINTS; i++)
+	    [root containsPoint:points[i]];
+	});
+
+      free(points);
+    }
+
+  if (wanted(@"graph-copy"))
+    {
+      run_test(results, graph, @"graph-copy", min_time, ^
+	{
+	  [root mg_graphCopy:[MgGraphCopyMap map]];
+	});
+    }
+
+  NSData *data = [MgBinaryArchiver archivedDataWithRootObject:root];
+
+  if (wanted(@"archive-save"))
+    {
+      run_test(results, graph, @"archive-save", min_time, ^
+	{
+	  [MgBinaryArchiver archivedDataWithRootObject:root];
+	});
+    }
+
+  if (wanted(@"archive-load"))
+    {
+      run_test(results, graph, @"archive-load", min_time, ^
+	{
+	  [MgBinaryUnarchiver unarchiveObjectWithData:data];
+	});
+    }
+
+  /* NSKeyedArchiver baselines for the two tests above. */
+
+  NSData *keyed_data = [NSKeyedArchiver archivedDataWithRootObject:root];
+
+  if (wanted(@"keyed-archive-save"))
+    {
+      run_test(results, graph, @"keyed-archive-save", min_time, ^
+	{
+	  [NSKeyedArchiver archivedDataWithRootObject:root];
+	});
+    }
+
+  if (wanted(@"keyed-archive-load"))
+    {
+      run_test(results, graph, @"keyed-archive-load", min_time, ^
+	{
+	  [NSKeyedUnarchiver unarchiveObjectWithData:keyed_data];
+	});
+    }
+
+  if (wanted(@"rasterize"))
+    {
+      run_test(results, graph, @"rasterize", min_time, ^
+	{
+	  CGImageRelease([root copyImageWithScale:1
+			  presentationTime:TRANSITION_BEGIN]);
+	});
+    }
+}
+
+/** Path codec. **/
+
+/* Paths of each kind the codec stores differently: fractional
+   coordinates (as floats), integers (fixed point), doubles, and empty
+   paths. */
+
+static CGPathRef
+create_codec_path(size_t i, uint32_t *seed)
+{
+  CGMutablePathRef path;
+  CGPoint c = CGPointMake(random_value(seed) * CANVAS_WIDTH,
+			  random_value(seed) * CANVAS_HEIGHT);
+
+  switch (i % 5)
+    {
+    case 0:
+      return create_star_path(c, 8 + random_value(seed) * 64,
+			      3 + i % 13, seed);
+
+    case 1:
+      path = CGPathCreateMutable();
+      CGPathAddRect(path, NULL, CGRectMake(rint(c.x), rint(c.y),
+					   1 + i % 50, 1 + i % 30));
+      CGPathMoveToPoint(path, NULL, rint(c.x), rint(c.y));
+      for (size_t j = 0; j < 32; j++)
+	{
+	  CGPathAddLineToPoint(path, NULL,
+			       rint(random_value(seed) * CANVAS_WIDTH),
+			       rint(random_value(seed) * CANVAS_HEIGHT));
+	}
+      return path;
+
+    case 2:
+      path = CGPathCreateMutable();
+      CGPathAddEllipseInRect(path, NULL, CGRectMake(c.x, c.y,
+			     random_value(seed) * 200,
+			     random_value(seed) * 200));
+      return path;
+
+    case 3:
+      path = CGPathCreateMutable();
+      for (size_t j = 0; j < 4; j++)
+	{
+	  CGPathMoveToPoint(path, NULL, random_value(seed) * 1e9,
+			    random_value(seed) * -1e9);
+	  CGPathAddCurveToPoint(path, NULL, M_PI * j, M_E,
+				random_value(seed) / 3, 1e-9,
+				random_value(seed), random_value(seed));
+	  CGPathCloseSubpath(path);
+	}
+      return path;
+
+    default:
+      return CGPathCreateMutable();
+    }
+}
+
+static void
+collect_path_element(void *info, const CGPathElement *elt)
+{
+  NSMutableData *data = (__bridge NSMutableData *)info;
+  size_t n = 0;
+
+  switch (elt->type)
+    {
+    case kCGPathElementMoveToPoint:
+    case kCGPathElementAddLineToPoint:
+      n = 1;
+      break;
+    case kCGPathElementAddQuadCurveToPoint:
+      n = 2;
+      break;
+    case kCGPathElementAddCurveToPoint:
+      n = 3;
+      break;
+    case kCGPathElementCloseSubpath:
+      break;
+    }
+
+  /* The type as a coordinate, so the two arrays of values can be
+     compared element by element. */
+
+  CGFloat type = -1 - elt->type;
+  [data appendBytes:&type length:sizeof(type)];
+  [data appendBytes:elt->points length:n * sizeof(CGPoint)];
+}
+
+/* True if `a' and `b' have the same elements, with coordinates
+   differing by no more than `error'. */
+
+static bool
+paths_match(CGPathRef a, CGPathRef b, CGFloat error)
+{
+  NSMutableData *a_data = [NSMutableData data];
+  NSMutableData *b_data = [NSMutableData data];
+
+  CGPathApply(a, (__bridge void *)a_data, collect_path_element);
+  CGPathApply(b, (__bridge void *)b_data, collect_path_element);
+
+  size_t count = [a_data length] / sizeof(CGFloat);
+  if ([b_data length] != [a_data length])
+    return false;
+
+  const CGFloat *a_values = [a_data bytes];
+  const CGFloat *b_values = [b_data bytes];
+
+  for (size_t i = 0; i < count; i++)
+    {
+      if (!(fabs(a_values[i] - b_values[i]) <= error))
+	return false;
+    }
+
+  return true;
+}
+
+/* True if `ptr' is rejected or decodes to a path that itself
+   round-trips. */
+
+static bool
+check_decoded_bytes(const void *ptr, size_t len)
+{
+  CGPathRef path = MgPathCreateWithBytes(ptr, len);
+  if (path == NULL)
+    return true;
+
+  bool ok = false;
+
+  CFDataRef data = MgPathCreateData(path, true);
+  if (data != NULL)
+    {
+      CGPathRef copy = MgPathCreateWithBytes(CFDataGetBytePtr(data),
+					     CFDataGetLength(data));
+      ok = copy != NULL && CGPathEqualToPath(path, copy);
+      CGPathRelease(copy);
+      CFRelease(data);
+    }
+
+  CGPathRelease(path);
+  return ok;
+}
+
+static bool
+check_path_codec(NSArray *paths)
+{
+  uint32_t seed = 9;
+  size_t failures = 0;
+
+  for (NSUInteger i = 0; i < [paths count]; i++)
+    {
+      CGPathRef path = (__bridge CGPathRef)paths[i];
+
+      for (int lossless = 1; lossless >= 0; lossless--)
+	{
+	  CFDataRef data = MgPathCreateData(path, lossless);
+	  if (data == NULL)
+	    {
+	      fprintf(stderr, "path %lu: encoding failed\n", (unsigned long)i);
+	      failures++;
+	      continue;
+	    }
+
+	  const uint8_t *bytes = CFDataGetBytePtr(data);
+	  size_t len = CFDataGetLength(data);
+
+	  CGPathRef copy = MgPathCreateWithBytes(bytes, len);
+
+	  if (copy == NULL
+	      || !(lossless ? CGPathEqualToPath(path, copy)
+		   : paths_match(path, copy, CODEC_LOSSY_ERROR)))
+	    {
+	      fprintf(stderr, "path %lu: %s round-trip failed\n",
+		      (unsigned long)i, lossless ? "lossless" : "lossy");
+	      failures++;
+	    }
+
+	  CGPathRelease(copy);
+
+	  /* A strict prefix is always missing elements or coordinates. */
+
+	  for (size_t n = 0; n < len; n++)
+	    {
+	      CGPathRef prefix = MgPathCreateWithBytes(bytes, n);
+	      if (prefix != NULL)
+		{
+		  fprintf(stderr, "path %lu: accepted %lu of %lu bytes\n",
+			  (unsigned long)i, (unsigned long)n,
+			  (unsigned long)len);
+		  CGPathRelease(prefix);
+		  failures++;
+		}
+	    }
+
+	  /* Copied to a buffer of exactly the right size, so reading
+	     past the end is caught by the address sanitizer. */
+
+	  uint8_t *buf = malloc(len);
+	  memcpy(buf, bytes, len);
+
+	  for (size_t j = 0; j < CODEC_FLIPS_PER_PATH && len != 0; j++)
+	    {
+	      size_t bit = (size_t)(random_value(&seed) * len * 8);
+
+	      buf[bit / 8] ^= 1 << (bit % 8);
+
+	      if (!check_decoded_bytes(buf, len))
+		{
+		  fprintf(stderr, "path %lu: flipping bit %lu gave a bad"
+			  " path\n", (unsigned long)i, (unsigned long)bit);
+		  failures++;
+		}
+
+	      /* Flips accumulate every few iterations, to reach
+		 inputs further from valid data. */
+
+	      if (j % 4 != 3)
+		buf[bit / 8] ^= 1 << (bit % 8);
+	      else
+		memcpy(buf, bytes, len);
+	    }
+
+	  free(buf);
+	  CFRelease(data);
+	}
+    }
+
+  return failures == 0;
+}
+
+static bool
+run_path_codec(NSMutableArray *results, const char *test_filter,
+	       double min_time)
+{
+  NSString *graph = @"path-codec";
+
+  bool (^wanted)(NSString *) = ^bool (NSString *test)
+    {
+      return (test_filter == NULL
+	      || strstr([test UTF8String], test_filter) != NULL);
+    };
+
+  NSMutableArray *paths = [NSMutableArray array];
+  uint32_t seed = 10;
+
+  for (size_t i = 0; i < CODEC_PATHS; i++)
+    [paths addObject:CFBridgingRelease(create_codec_path(i, &seed))];
+
+  if (wanted(@"path-check") && !check_path_codec(paths))
+    return false;
+
+  NSMutableArray *encoded = [NSMutableArray array];
+
+  for (id path in paths)
+    {
+      [encoded addObject:CFBridgingRelease(MgPathCreateData(
+		(__bridge CGPathRef)path, true))];
+    }
+
+  if (wanted(@"path-encode"))
+    {
+      run_test(results, graph, @"path-encode", min_time, ^
+	{
+	  for (id path in paths)
+	    CFRelease(MgPathCreateData((__bridge CGPathRef)path, true));
+	});
+    }
+
+  if (wanted(@"path-encode-lossy"))
+    {
+      run_test(results, graph, @"path-encode-lossy", min_time, ^
+	{
+	  for (id path in paths)
+	    CFRelease(MgPathCreateData((__bridge CGPathRef)path, false));
+	});
+    }
+
+  if (wanted(@"path-decode"))
+    {
+      run_test(results, graph, @"path-decode", min_time, ^
+	{
+	  for (NSData *data in encoded)
+	    CGPathRelease(MgPathCreateWithBytes([data bytes], [data length]));
+	});
+    }
+
+  return true;
+}
+
+typedef MgModuleLayer *(*graph_generator)(MgModuleState **a,
+					   MgModuleState **b);
+
+static const struct
+{
+  const char *name;
+  graph_generator generate;
+} graphs[] =
+{
+  {"deep-groups", make_deep_groups},
+  {"flat-rects", make_flat_rects},
+  {"blend-layers", make_blend_layers},
+  {"image-mosaic", make_image_mosaic},
+  {"path-art", make_path_art},
+  {"gradient-ramps", make_gradient_ramps},
+  {"aliased-dag", make_aliased_dag},
+  {"huge-tree", make_huge_tree},
+};
+
+int
+main(int argc, char **argv)
+{
+  @autoreleasepool
+    {
+      const char *graph_filter = NULL, *test_filter = NULL;
+      const char *output = NULL;
+      double min_time = .25;
+      int c;
+
+      if (argc > 0)
+	program_name = argv[0];
+
+      while ((c = getopt(argc, argv, "g:t:m:o:")) != -1)
+	{
+	  switch (c)
+	    {
+	    case 'g':
+	      graph_filter = optarg;
+	      break;
+	    case 't':
+	      test_filter = optarg;
+	      break;
+	    case 'm':
+	      min_time = atof(optarg);
+	      break;
+	    case 'o':
+	      output = optarg;
+	      break;
+	    default:
+	      usage();
+	    }
+	}
+
+      if (optind != argc || !(min_time >= 0))
+	usage();
+
+      NSMutableArray *results = [NSMutableArray array];
+
+      for (size_t i = 0; i < sizeof(graphs) / sizeof(graphs[0]); i++)
+	{
+	  if (graph_filter != NULL
+	      && strstr(graphs[i].name, graph_filter) == NULL)
+	    continue;
+
+	  @autoreleasepool
+	    {
+	      MgModuleState *a = nil, *b = nil;
+	      MgModuleLayer *root = graphs[i].generate(&a, &b);
+
+	      NSString *name = [NSString stringWithUTF8String:graphs[i].name];
+
+	      run_graph(results, name, root, a, b, test_filter, min_time);
+	    }
+	}
+
+      if (graph_filter == NULL || strstr("path-codec", graph_filter) != NULL)
+	{
+	  @autoreleasepool
+	    {
+	      if (!run_path_codec(results, test_filter, min_time))
+		{
+		  fprintf(stderr, "%s: path codec check failed\n",
+			  program_name);
+		  return 1;
+		}
+	    }
+	}
+
+      NSError *err = nil;
+      NSData *json = [NSJSONSerialization dataWithJSONObject:
+		      @{@"version": @1, @"results": results}
+		      options:NSJSONWritingPrettyPrinted error:&err];
+
+      if (json == nil)
+	{
+	  fprintf(stderr, "%s: %s\n", program_name,
+		  [[err localizedDescription] UTF8String]);
+	  return 1;
+	}
+
+      if (output != NULL)
+	{
+	  if (![json writeToFile:[NSString stringWithUTF8String:output]
+		options:NSDataWritingAtomic error:&err])
+	    {
+	      fprintf(stderr, "%s: %s: %s\n", program_name, output,
+		      [[err localizedDescription] UTF8String]);
+	      return 1;
+	    }
+	}
+      else
+	{
+	  fwrite([json bytes], 1, [json length], stdout);
+	  fputc('\n', stdout);
+	}
+
+      return 0;
+    }
+}
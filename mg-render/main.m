@@ -0,0 +1,478 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+/* mg-render: renders an Mg archive to PNG files without the app.
+
+   Usage: mg-render [OPTIONS] FILE
+
+     -s SCALE	scale factor (default 1)
+     -S STATE	module state to render, by name
+     -T STATE	animate from the -S state (or the saved state) to this
+		one, writing one image per frame
+     -t TIME	with -T, only write the frame TIME seconds in
+     -r RATE	with -T, frames per second (default 60)
+     -a		with -T, write a single animated image (APNG, or GIF
+		if OUTPUT ends in .gif) instead of numbered frames
+     -o OUTPUT	output file (default FILE with a .png extension).
+		Frames of a transition are written as OUTPUT-NNNN.png
+     -P TRACE	write a Chrome trace of drawing the image to TRACE, and
+		per-class statistics to stderr (not with -T unless -t)
+     -p COUNT	with -T, profile the transition and report the COUNT
+		most expensive nodes and properties on stderr. Frames
+		are rendered one at a time
+
+   Frames of a transition are rendered concurrently, and the frame
+   rate achieved is reported on stderr. */
+
+#import "Mg.h"
+
+#import "MgCoreGraphics.h"
+
+#import <Foundation/Foundation.h>
+#import <libkern/OSAtomic.h>
+
+#include <unistd.h>
+
+/* Transitions begin at this time, as zero means "now". */
+
+#define TRANSITION_BEGIN 1
+
+/* Upper bound on the number of frames written for a transition. */
+
+#define MAX_FRAMES 100000
+
+static const char *program_name = "mg-render";
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: %s [-s SCALE] [-S STATE] [-T STATE] [-t TIME]"
+	  " [-r RATE] [-a] [-o OUTPUT] [-P TRACE] [-p COUNT] FILE\n",
+	  program_name);
+  exit(2);
+}
+
+static MgModuleLayer *
+read_document(NSString *path)
+{
+  NSError *err = nil;
+  NSData *data = [NSData dataWithContentsOfFile:path
+		  options:NSDataReadingMappedIfSafe error:&err];
+  if (data == nil)
+    {
+      fprintf(stderr, "%s: %s: %s\n", program_name, [path UTF8String],
+	      [[err localizedDescription] UTF8String]);
+      return nil;
+    }
+
+  /* Same as GtDocument: both archive formats share one file type. */
+
+  MgModuleLayer *node = nil;
+
+  @try
+    {
+      if ([MgBinaryUnarchiver canReadData:data])
+	{
+	  MgBinaryUnarchiver *unarchiver
+	    = [[MgBinaryUnarchiver alloc] initForReadingWithData:data];
+	  node = [unarchiver decodeObjectOfClass:[MgModuleLayer class]
+		  forKey:NSKeyedArchiveRootObjectKey];
+	  [unarchiver finishDecoding];
+	}
+      else
+	{
+	  NSKeyedUnarchiver *unarchiver
+	    = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
+	  node = [unarchiver decodeObjectOfClass:[MgModuleLayer class]
+		  forKey:NSKeyedArchiveRootObjectKey];
+	  [unarchiver finishDecoding];
+	}
+    }
+  @catch (NSException *exception)
+    {
+      node = nil;
+    }
+
+  if (node == nil)
+    {
+      fprintf(stderr, "%s: %s: not a valid archive\n", program_name,
+	      [path UTF8String]);
+    }
+
+  return node;
+}
+
+static MgModuleState *
+find_state(MgModuleLayer *root, const char *name)
+{
+  MgModuleState *state
+    = [root moduleStateWithName:[NSString stringWithUTF8String:name]];
+
+  if (state == nil)
+    fprintf(stderr, "%s: no module state named \"%s\"\n", program_name, name);
+
+  return state;
+}
+
+/* Returns the time at which the last transition in the subgraph
+   rooted at `node' finishes, or -HUGE_VAL if nothing is animating. */
+
+static CFTimeInterval
+transition_end(MgNode *node, uint32_t mark)
+{
+  __block CFTimeInterval end = -HUGE_VAL;
+
+  MgActiveTransition *trans = node.activeTransition;
+  if (trans != nil && trans.speed > 0)
+    end = trans.begin + trans.duration / trans.speed;
+
+  [node foreachNode:^(MgNode *child)
+    {
+      end = fmax(end, transition_end(child, mark));
+    } mark:mark];
+
+  return end;
+}
+
+static bool
+write_data(CFDataRef data, NSString *path)
+{
+  NSError *err = nil;
+
+  if (data == NULL
+      || ![(__bridge NSData *)data writeToFile:path options:NSDataWritingAtomic
+	   error:&err])
+    {
+      fprintf(stderr, "%s: %s: %s\n", program_name, [path UTF8String],
+	      err != nil ? [[err localizedDescription] UTF8String]
+	      : "can't encode image");
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+write_image(CGImageRef im, NSString *path)
+{
+  if (im == NULL)
+    {
+      fprintf(stderr, "%s: %s: nothing to render\n", program_name,
+	      [path UTF8String]);
+      return false;
+    }
+
+  CFDataRef data = MgImageCreateData(im, CFSTR("public.png"));
+  bool ret = write_data(data, path);
+  if (data != NULL)
+    CFRelease(data);
+
+  return ret;
+}
+
+static void
+print_statistics(MgRenderTrace *trace)
+{
+  NSDictionary *stats = trace.statistics;
+
+  fprintf(stderr, "%-20s %8s %8s %8s %10s\n", "class", "visited",
+	  "culled", "drawn", "ms");
+
+  for (NSString *cls in [[stats allKeys]
+			 sortedArrayUsingSelector:@selector(compare:)])
+    {
+      NSDictionary *c = stats[cls];
+      fprintf(stderr, "%-20s %8lu %8lu %8lu %10.3f\n", [cls UTF8String],
+	      [c[@"visited"] unsignedLongValue],
+	      [c[@"culled"] unsignedLongValue],
+	      [c[@"drawn"] unsignedLongValue],
+	      [c[@"time"] doubleValue] * 1e3);
+    }
+}
+
+static bool
+render_image(MgLayer *layer, CGFloat scale, CFTimeInterval t, NSString *path,
+	     NSString *trace_path)
+{
+  MgRenderTrace *trace = nil;
+  if (trace_path != nil)
+    {
+      trace = [MgRenderTrace trace];
+      trace.recordsEvents = YES;
+    }
+
+  CGImageRef im = (trace == nil
+		   ? [layer copyImageWithScale:scale presentationTime:t]
+		   : [layer copyImageWithScale:scale presentationTime:t
+		      trace:trace]);
+  bool ret = write_image(im, path);
+  CGImageRelease(im);
+
+  if (trace != nil)
+    {
+      NSError *err = nil;
+      if (![trace writeTraceEventsToURL:[NSURL fileURLWithPath:trace_path]
+	    error:&err])
+	{
+	  fprintf(stderr, "%s: %s: %s\n", program_name,
+		  [trace_path UTF8String],
+		  [[err localizedDescription] UTF8String]);
+	  ret = false;
+	}
+
+      print_statistics(trace);
+    }
+
+  return ret;
+}
+
+static bool
+render_frames(MgLayer *layer, CGFloat scale, double rate, bool animated,
+	      bool serial, NSString *path)
+{
+  CFTimeInterval end = transition_end(layer, [MgNode nextMark]);
+
+  /* Always include the first frame, and the first frame at or after
+     the end of the transition. */
+
+  double frames = ceil((end - TRANSITION_BEGIN) * rate) + 1;
+  size_t count = frames > 1 ? (frames < MAX_FRAMES ? frames : MAX_FRAMES) : 1;
+
+  NSString *base = [path stringByDeletingPathExtension];
+  NSString *ext = [path pathExtension];
+  if ([ext length] == 0)
+    ext = @"png";
+
+  NSMutableArray *images = nil;
+  if (animated)
+    {
+      images = [NSMutableArray arrayWithCapacity:count];
+      for (size_t i = 0; i < count; i++)
+	[images addObject:[NSNull null]];
+    }
+
+  __block int32_t failures = 0;
+
+  CFAbsoluteTime t0 = CFAbsoluteTimeGetCurrent();
+
+  void (^handler)(size_t frame, CGImageRef im) = ^(size_t frame,
+						    CGImageRef im)
+    {
+      bool ok;
+
+      if (animated)
+	{
+	  ok = im != NULL;
+	  if (ok)
+	    {
+	      @synchronized (images)
+		{
+		  images[frame] = (__bridge id)im;
+		}
+	    }
+	}
+      else
+	{
+	  NSString *frame_path = [NSString stringWithFormat:@"%@-%04d.%@",
+				  base, (int)frame, ext];
+	  ok = write_image(im, frame_path);
+	}
+
+      if (!ok)
+	OSAtomicIncrement32(&failures);
+    };
+
+  if (!serial)
+    {
+      [layer renderFramesWithScale:scale presentationTime:TRANSITION_BEGIN
+       rate:rate count:count handler:handler];
+    }
+  else
+    {
+      for (size_t i = 0; i < count; i++)
+	{
+	  @autoreleasepool
+	    {
+	      CGImageRef im = [layer copyImageWithScale:scale
+			       presentationTime:TRANSITION_BEGIN + i / rate
+			       trace:nil];
+	      handler(i, im);
+	      CGImageRelease(im);
+	    }
+	}
+    }
+
+  CFAbsoluteTime t1 = CFAbsoluteTimeGetCurrent();
+
+  if (failures != 0)
+    return false;
+
+  if (animated)
+    {
+      CFStringRef type = ([[ext lowercaseString] isEqualToString:@"gif"]
+			  ? CFSTR("com.compuserve.gif") : CFSTR("public.png"));
+      CFDataRef data = MgImageSequenceCreateData((__bridge CFArrayRef)images,
+						 type, 1 / rate);
+      bool ret = write_data(data, path);
+      if (data != NULL)
+	CFRelease(data);
+      if (!ret)
+	return false;
+    }
+
+  fprintf(stderr, "%s: %lu frames in %.2fs (%.1f fps)\n", program_name,
+	  (unsigned long)count, t1 - t0, count / fmax(t1 - t0, 1e-6));
+
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  @autoreleasepool
+    {
+      double scale = 1, rate = 60, time = -1;
+      const char *from_name = NULL, *to_name = NULL, *output = NULL;
+      const char *trace_output = NULL;
+      int profile_count = 0;
+      bool animated = false;
+      int c;
+
+      if (argc > 0)
+	program_name = argv[0];
+
+      while ((c = getopt(argc, argv, "s:S:T:t:r:ao:P:p:")) != -1)
+	{
+	  switch (c)
+	    {
+	    case 's':
+	      scale = atof(optarg);
+	      break;
+	    case 'S':
+	      from_name = optarg;
+	      break;
+	    case 'T':
+	      to_name = optarg;
+	      break;
+	    case 't':
+	      time = atof(optarg);
+	      break;
+	    case 'r':
+	      rate = atof(optarg);
+	      break;
+	    case 'a':
+	      animated = true;
+	      break;
+	    case 'o':
+	      output = optarg;
+	      break;
+	    case 'P':
+	      trace_output = optarg;
+	      break;
+	    case 'p':
+	      profile_count = atoi(optarg);
+	      break;
+	    default:
+	      usage();
+	    }
+	}
+
+      if (optind != argc - 1 || !(scale > 0) || !(rate > 0))
+	usage();
+
+      if (trace_output != NULL && to_name != NULL && time < 0)
+	usage();
+
+      if (profile_count < 0 || (profile_count > 0 && to_name == NULL))
+	usage();
+
+      NSString *path = [NSString stringWithUTF8String:argv[optind]];
+
+      MgModuleLayer *root = read_document(path);
+      if (root == nil)
+	return 1;
+
+      if (from_name != NULL)
+	{
+	  MgModuleState *state = find_state(root, from_name);
+	  if (state == nil)
+	    return 1;
+	  root.moduleState = state;
+	}
+
+      NSString *out_path = (output != NULL
+			    ? [NSString stringWithUTF8String:output]
+			    : [[path stringByDeletingPathExtension]
+			       stringByAppendingPathExtension:@"png"]);
+
+      NSString *trace_path = (trace_output != NULL
+			      ? [NSString stringWithUTF8String:trace_output]
+			      : nil);
+
+      if (to_name == NULL)
+	{
+	  return render_image(root, scale, TRANSITION_BEGIN, out_path,
+			      trace_path) ? 0 : 1;
+	}
+
+      MgModuleState *state = find_state(root, to_name);
+      if (state == nil)
+	return 1;
+
+      MgTransitionProfiler *profiler = nil;
+      if (profile_count > 0)
+	{
+	  profiler = [MgTransitionProfiler profiler];
+	  [profiler start];
+	}
+
+      [root setModuleState:state options:@{
+	MgNodeAnimated: @YES,
+	MgNodeTransitionBegin: @(TRANSITION_BEGIN),
+      }];
+
+      bool ok;
+
+      if (time >= 0)
+	{
+	  ok = render_image(root, scale, TRANSITION_BEGIN + time, out_path,
+			    trace_path);
+	}
+      else
+	{
+	  ok = render_frames(root, scale, rate, animated, profiler != nil,
+			     out_path);
+	}
+
+      if (profiler != nil)
+	{
+	  [profiler stop];
+	  fprintf(stderr, "%s", [[profiler reportWithCount:profile_count]
+				 UTF8String]);
+	}
+
+      return ok ? 0 : 1;
+    }
+}
@@ -30,10 +30,13 @@
 #ifdef __OBJC__
 # import "MgActiveTransition.h"
 # import "MgBezierTimingFunction.h"
+# import "MgBinaryArchiver.h"
 # import "MgDrawingLayer.h"
+# import "MgFloatArray.h"
 # import "MgFunction.h"
 # import "MgGradientLayer.h"
 # import "MgGradientLayerState.h"
+# import "MgGraphSnapshot.h"
 # import "MgGroupLayer.h"
 # import "MgGroupLayerState.h"
 # import "MgImageLayer.h"
@@ -50,8 +53,10 @@
 # import "MgPathLayerState.h"
 # import "MgRectLayer.h"
 # import "MgRectLayerState.h"
+# import "MgRenderTrace.h"
 # import "MgSpringFunction.h"
 # import "MgTimingFunction.h"
+# import "MgTransitionProfiler.h"
 # import "MgTransitionTiming.h"
 # import "MgViewContext.h"
 #endif
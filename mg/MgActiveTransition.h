@@ -23,6 +23,7 @@
    SOFTWARE. */
 
 #import "MgBase.h"
+#import "MgCoreGraphics.h"
 
 @interface MgActiveTransition : NSObject
 
@@ -45,4 +46,22 @@
 
 - (double)evaluateTime:(double)t forKey:(NSString *)key;
 
+- (MgColorMixMode)colorMixModeForKey:(NSString *)key;
+
+/* Returns the earliest time, no earlier than `t', at which the value
+   of any of the transitioned properties changes. Returns `t' itself
+   if some property is currently changing, or the duration if nothing
+   changes before the end of the transition. Times are relative to the
+   start of the transition and not scaled by speed. */
+
+- (double)nextChangeAfterTime:(double)t;
+
+/* Storage for values derived from the transition's end points that
+   are too expensive to recompute every frame, e.g. the correspondence
+   between two paths. May be called from any thread (render copies of
+   a node share its active transition). */
+
+- (id)cachedObjectForKey:(NSString *)key;
+- (void)setCachedObject:(id)obj forKey:(NSString *)key;
+
 @end
@@ -27,6 +27,7 @@
 #import "MgNodeState.h"
 #import "MgNodeTransition.h"
 #import "MgTimingFunction.h"
+#import "MgTransitionProfilerInternal.h"
 #import "MgTransitionTiming.h"
 
 #import <Foundation/Foundation.h>
@@ -43,6 +44,8 @@
   MgTransitionTiming *_defaultTiming;
 
   double _duration;
+
+  NSMutableDictionary *_cache;
 }
 
 - (id)init
@@ -136,9 +139,69 @@
 
 - (double)evaluateTime:(double)t forKey:(NSString *)key
 {
+  if (mg_profiling)
+    MgProfilePropertyLap(key);
+
   MgTransitionTiming *timing = [self timingForKey:key];
 
   return timing != nil ? [timing evaluate:t] : t;
 }
 
+- (MgColorMixMode)colorMixModeForKey:(NSString *)key
+{
+  MgTransitionTiming *timing = [self timingForKey:key];
+
+  return timing != nil ? timing.colorMixMode : MgColorMixSRGB;
+}
+
+- (double)nextChangeAfterTime:(double)t
+{
+  double next = self.duration;
+
+  for (NSString *key in _properties)
+    {
+      MgTransitionTiming *timing = [self timingForKey:key];
+
+      /* Disabled timings jump to the final value immediately. */
+
+      double begin = 0, end = 0;
+      if (timing == nil)
+	end = 1;
+      else if (timing.enabled)
+	{
+	  begin = timing.begin;
+	  end = begin + timing.duration;
+	}
+
+      if (t < begin)
+	next = fmin(next, begin);
+      else if (t < end)
+	return t;
+    }
+
+  return fmax(next, t);
+}
+
+- (id)cachedObjectForKey:(NSString *)key
+{
+  @synchronized (self)
+    {
+      return _cache[key];
+    }
+}
+
+- (void)setCachedObject:(id)obj forKey:(NSString *)key
+{
+  @synchronized (self)
+    {
+      if (_cache == nil)
+	_cache = [NSMutableDictionary dictionary];
+
+      if (obj != nil)
+	_cache[key] = obj;
+      else
+	[_cache removeObjectForKey:key];
+    }
+}
+
 @end
@@ -79,14 +79,15 @@
 
 @class NSArray, NSMutableArray, NSData, NSMutableData, NSDictionary,
     NSMutableDictionary, NSMapTable, NSSet, NSMutableSet, NSIndexSet,
-    NSMutableIndexSet, NSPointerArray, NSURL;
+    NSMutableIndexSet, NSOperationQueue, NSPointerArray, NSURL;
 @class MgActiveTransition, MgBezierTimingFunction, MgDrawingLayer,
-    MgFunction, MgGradientLayer, MgGradientLayerState, MgGroupLayer,
-    MgGroupLayerState, MgImageLayer, MgImageLayerState, MgImageProvider,
-    MgLayer, MgLayerState, MgModuleLayer, MgModuleState, MgNode,
-    MgNodeState, MgNodeTransition, MgPathLayer, MgPathLayerState,
-    MgRectLayer, MgRectLayerState, MgSpringFunction, MgTimingFunction,
-    MgTransitionTiming, MgViewContext;
+    MgFunction, MgGradientLayer, MgGradientLayerState, MgGraphCopyMap,
+    MgGraphSnapshot, MgGroupLayer, MgGroupLayerState, MgImageLayer,
+    MgImageLayerState, MgImageProvider, MgLayer, MgLayerState,
+    MgModuleLayer, MgModuleState, MgNode, MgNodeState, MgNodeTransition,
+    MgPathLayer, MgPathLayerState, MgRectLayer, MgRectLayerState,
+    MgRenderTrace, MgSpringFunction, MgTimingFunction,
+    MgTransitionProfiler, MgTransitionTiming, MgViewContext;
 @class CALayer;
 
 @protocol MgDrawingState, MgImageProvider;
@@ -98,25 +99,69 @@
    copy, but calling -mg_graphCopy: for sub-objects.
 
    -mg_graphCopy is the convenience entry-point to call for the
-   top-level object, i.e. it allocates a table, calls -mg_graphCopy:
+   top-level object, i.e. it allocates a map, calls -mg_graphCopy:
    and returns the result.
 
-   -mg_graphCopy: dereferences the table to test if each copied object
+   -mg_graphCopy: dereferences the map to test if each copied object
    has already been duplicated, if not a copy is made and inserted into
-   the table.
+   the map.
 
    -mg_conditionalGraphCopy: is similar, but doesn't copy the object
-   if it's not already been copied and inserted into the table, in
-   which case it returns the original object. */
+   if it's not already been copied and inserted into the map, in
+   which case it returns the original object.
+
+   Objects that are copied often (nodes and their states) return a
+   pointer to a per-object slot from -mg_graphCopySlot. The map stores
+   the dense index of the object's copy in the slot, so finding it is
+   an array access rather than a hash table lookup. All other objects
+   return NULL and are hashed as before. Since there's only one slot
+   per object, a graph must not be copied by more than one thread at
+   once (the same restriction as -[MgNode foreachNode:mark:]). */
+
+typedef struct MgGraphCopySlot MgGraphCopySlot;
+
+struct MgGraphCopySlot
+{
+  uint32_t mark;
+  uint32_t index;
+};
+
+@interface MgGraphCopyMap : NSObject <NSFastEnumeration>
+
++ (instancetype)map;
+
+@property(nonatomic, readonly) NSUInteger count;
+
+- (id)objectForKey:(id)key;
+- (void)setObject:(id)obj forKey:(id)key;
+
+/* Keys are enumerated in the order they were inserted. */
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj,
+    BOOL *stop))block;
+
+/* Called by -mg_graphCopy: for each object not yet in the map. May
+   return an existing copy of `obj' to use instead of making a new one.
+   The default implementation returns nil. */
+
+- (id)reusableCopyOfObject:(id)obj;
+
+/* Called by -mg_graphCopy: after making a new copy of `obj'. The
+   default implementation does nothing. */
+
+- (void)didCopyObject:(id)obj toObject:(id)copy;
+
+@end
 
 @interface NSObject (MgGraphCopying)
 - (id)mg_graphCopy;
-- (id)mg_graphCopy:(NSMapTable *)map;
-- (id)mg_conditionalGraphCopy:(NSMapTable *)map;
+- (id)mg_graphCopy:(MgGraphCopyMap *)map;
+- (id)mg_conditionalGraphCopy:(MgGraphCopyMap *)map;
+- (MgGraphCopySlot *)mg_graphCopySlot;
 @end
 
 @protocol MgGraphCopying
-- (id)graphCopy:(NSMapTable *)map;
+- (id)graphCopy:(MgGraphCopyMap *)map;
 @end
 
 #endif /* __OBJC__ */
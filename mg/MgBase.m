@@ -27,15 +27,181 @@
 #import "MgNode.h"
 
 #import <Foundation/Foundation.h>
+#import <libkern/OSAtomic.h>
+
+/* Last mark given to a map. Slots are only written by the most
+   recently created map, older maps keep their slotted keys in the hash
+   table (which see). */
+
+static volatile int32_t map_mark_counter;
+
+static uint32_t
+next_map_mark(void)
+{
+  uint32_t mark;
+
+  do
+    mark = OSAtomicIncrement32Barrier(&map_mark_counter);
+  while (mark == 0);
+
+  return mark;
+}
+
+static inline bool
+is_latest_map_mark(uint32_t mark)
+{
+  OSMemoryBarrier();
+  return (uint32_t)map_mark_counter == mark;
+}
+
+@implementation MgGraphCopyMap
+{
+  uint32_t _mark;
+  NSMutableArray *_keys;
+  NSMutableArray *_values;
+  NSMapTable *_table;			/* key -> NSNumber index */
+  NSUInteger _tableCount;		/* all keys below this are in _table */
+}
+
++ (instancetype)map
+{
+  return [[self alloc] init];
+}
+
+- (id)init
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _mark = next_map_mark();
+  _keys = [NSMutableArray array];
+  _values = [NSMutableArray array];
+  _table = [NSMapTable strongToStrongObjectsMapTable];
+
+  return self;
+}
+
+- (NSUInteger)count
+{
+  return [_keys count];
+}
+
+/* Called once a newer map exists, as it may overwrite our slots: adds
+   every key not yet in the hash table, after which lookups go through
+   the table. */
+
+- (void)_indexAllKeys
+{
+  NSUInteger count = [_keys count];
+
+  for (NSUInteger i = _tableCount; i < count; i++)
+    [_table setObject:@(i) forKey:_keys[i]];
+
+  _tableCount = count;
+}
+
+- (NSUInteger)_indexOfKey:(id)key
+{
+  MgGraphCopySlot *slot = [key mg_graphCopySlot];
+
+  if (slot != NULL)
+    {
+      uint32_t idx = slot->index;
+
+      if (slot->mark == _mark && idx < [_keys count] && _keys[idx] == key)
+	return idx;
+
+      /* While no newer map exists a slot miss is authoritative. */
+
+      if (is_latest_map_mark(_mark))
+	return NSNotFound;
+
+      [self _indexAllKeys];
+    }
+
+  NSNumber *idx = [_table objectForKey:key];
+
+  return idx != nil ? [idx unsignedIntegerValue] : NSNotFound;
+}
+
+- (id)objectForKey:(id)key
+{
+  if (key == nil)
+    return nil;
+
+  NSUInteger idx = [self _indexOfKey:key];
+
+  return idx != NSNotFound ? _values[idx] : nil;
+}
+
+- (void)setObject:(id)obj forKey:(id)key
+{
+  if (key == nil || obj == nil)
+    return;
+
+  NSUInteger idx = [self _indexOfKey:key];
+
+  if (idx != NSNotFound)
+    {
+      _values[idx] = obj;
+      return;
+    }
+
+  idx = [_keys count];
+  [_keys addObject:key];
+  [_values addObject:obj];
+
+  MgGraphCopySlot *slot = [key mg_graphCopySlot];
+
+  if (slot != NULL && idx <= UINT32_MAX && is_latest_map_mark(_mark))
+    {
+      slot->mark = _mark;
+      slot->index = (uint32_t)idx;
+    }
+  else
+    {
+      [_table setObject:@(idx) forKey:key];
+      if (_tableCount == idx)
+	_tableCount = idx + 1;
+    }
+}
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj,
+    BOOL *stop))block
+{
+  NSUInteger count = [_keys count];
+  BOOL stop = NO;
+
+  for (NSUInteger i = 0; i < count && !stop; i++)
+    block(_keys[i], _values[i], &stop);
+}
+
+- (id)reusableCopyOfObject:(id)obj
+{
+  return nil;
+}
+
+- (void)didCopyObject:(id)obj toObject:(id)copy
+{
+}
+
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state
+    objects:(id __unsafe_unretained [])buf count:(NSUInteger)len
+{
+  return [_keys countByEnumeratingWithState:state objects:buf count:len];
+}
+
+@end
 
 @implementation NSObject (MgGraphCopying)
 
 - (id)mg_graphCopy
 {
-  return [self mg_graphCopy:[NSMapTable strongToStrongObjectsMapTable]];
+  return [self mg_graphCopy:[MgGraphCopyMap map]];
 }
 
-- (id)mg_graphCopy:(NSMapTable *)map
+- (id)mg_graphCopy:(MgGraphCopyMap *)map
 {
   id copy = [map objectForKey:self];
 
@@ -43,13 +209,20 @@
 
   if (copy == nil)
     {
-      if ([self conformsToProtocol:@protocol(MgGraphCopying)])
-	copy = [(id<MgGraphCopying>)self graphCopy:map];
-      else
-	copy = [self copy];
+      copy = [map reusableCopyOfObject:self];
 
       if (copy == nil)
-	copy = null_object;
+	{
+	  if ([self conformsToProtocol:@protocol(MgGraphCopying)])
+	    copy = [(id<MgGraphCopying>)self graphCopy:map];
+	  else
+	    copy = [self copy];
+
+	  if (copy != nil)
+	    [map didCopyObject:self toObject:copy];
+	  else
+	    copy = null_object;
+	}
 
       [map setObject:copy forKey:self];
     }
@@ -60,7 +233,7 @@
   return copy;
 }
 
-- (id)mg_conditionalGraphCopy:(NSMapTable *)map
+- (id)mg_conditionalGraphCopy:(MgGraphCopyMap *)map
 {
   id copy = [map objectForKey:self];
 
@@ -75,4 +248,9 @@
   return copy;
 }
 
+- (MgGraphCopySlot *)mg_graphCopySlot
+{
+  return NULL;
+}
+
 @end
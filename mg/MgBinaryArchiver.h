@@ -0,0 +1,124 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+#import "MgBase.h"
+#import <Foundation/NSCoder.h>
+
+/* Compact binary alternatives to NSKeyedArchiver/NSKeyedUnarchiver.
+   They support keyed coding only, and are intended for archiving Mg
+   graphs, i.e. objects that encode themselves using the keyed NSCoder
+   methods and the MgCoderExtensions category.
+
+   The archive starts with a fixed header, followed by a table of all
+   strings (keys, class names and string objects), a table of the
+   file offsets of every object record, then the records themselves.
+   Objects encoded more than once are stored once and referenced by
+   index, so shared nodes in the graph remain shared after decoding.
+   Numbers and geometry are stored as raw little-endian values rather
+   than as boxed objects.
+
+   Large data objects (e.g. image files) are stored in a page-aligned
+   section at the end of the archive. When decoding they reference the
+   archive's bytes rather than copying them, so if the archive data is
+   a file mapping, they are only read from disk when first used. Other
+   objects aren't deferred: decoding the root object decodes every
+   node and state reachable from it.
+
+   An archive may be followed by segments appended by later saves of
+   the same graph, each holding only the objects that changed. See
+   MgBinaryArchiveJournal. */
+
+@class MgBinaryArchiveJournal;
+
+@interface MgBinaryArchiver : NSCoder
+
++ (NSData *)archivedDataWithRootObject:(id)obj;
+
+- (id)init;
+
+/* If `journal' is empty, the archiver writes a complete archive and
+   records its contents in `journal'. Otherwise it writes a segment to
+   be appended at the journal's old length, containing the root object
+   and every object that may have changed since the journal was last
+   updated. If the segment can't be written, the journal must not be
+   used again. */
+
+- (id)initWithJournal:(MgBinaryArchiveJournal *)journal;
+
+/* Writes the accumulated objects and returns the archive or segment.
+   Nothing may be encoded after calling this. */
+
+- (NSData *)finishEncoding;
+
+@end
+
+@interface MgBinaryUnarchiver : NSCoder
+
+/* Returns true if `data' starts with the binary archive header. */
+
++ (BOOL)canReadData:(NSData *)data;
+
++ (id)unarchiveObjectWithData:(NSData *)data;
+
+/* Returns nil if `data' isn't a supported archive. Malformed archives
+   are detected as they are read, causing decode methods to return
+   nil or zero values. */
+
+- (id)initForReadingWithData:(NSData *)data;
+
+/* Returns a journal for appending segments to the archive being read,
+   knowing the indices of the objects decoded so far, i.e. it should be
+   called after decoding the root object and before -finishDecoding.
+   Returns nil if the archive's format doesn't support segments. */
+
+- (MgBinaryArchiveJournal *)journal;
+
+- (void)finishDecoding;
+
+@end
+
+/* Remembers where each object of a graph was written to an archive,
+   so that later saves can append only the objects that changed. A
+   node is considered unchanged if its version is the same as when it
+   was written; since node versions include their descendants, whole
+   unchanged subtrees are skipped. Strings and data objects are assumed
+   never to change. Other objects (e.g. node states) are written again
+   along with the node that refers to them. */
+
+@interface MgBinaryArchiveJournal : NSObject
+
+- (id)init;
+
+/* Length of the archive including all segments, i.e. the offset at
+   which the next segment is to be appended. */
+
+@property(nonatomic, readonly) uint64_t length;
+
+/* Length of the complete archive the segments follow. */
+
+@property(nonatomic, readonly) uint64_t baseLength;
+
+@property(nonatomic, readonly) NSUInteger segmentCount;
+
+@end
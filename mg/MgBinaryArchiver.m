@@ -0,0 +1,2044 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+#import "MgBinaryArchiver.h"
+
+#import "MgCoderExtensions.h"
+#import "MgCoreGraphics.h"
+#import "MgNode.h"
+
+#import <Foundation/Foundation.h>
+
+#define MAGIC "MgBA"
+#define FORMAT_VERSION 3
+
+/* Header: magic[4], u32 version, u32 string count, u32 object count,
+   u64 string table offset, u64 object table offset, u64 root record
+   offset, then from version 2, u64 blob section offset, and from
+   version 3, u64 length of the archive before any segments. */
+
+#define HEADER_SIZE_V1 40
+#define HEADER_SIZE_V2 48
+#define HEADER_SIZE 56
+
+/* Version 3 archives may be followed by segments appended by
+   incremental saves. Each has a header: magic[4], u32 number of
+   strings added, u32 total object count, u32 number of object table
+   entries, u64 segment length, u64 string offset, u64 table offset,
+   u64 root record offset. Its table entries (u32 object index, u64
+   record offset) replace those of earlier segments. An incomplete
+   segment, e.g. from a crash while appending, and anything after it
+   is ignored. */
+
+#define SEGMENT_MAGIC "MgBJ"
+#define SEGMENT_HEADER_SIZE 48
+#define SEGMENT_ENTRY_SIZE 12
+
+/* Data objects at least this large are stored out of line in the
+   blob section at the end of the file, which is page-aligned, so that
+   when the archive is mapped their bytes can be used directly and
+   are only paged in when needed. */
+
+#define BLOB_MIN_SIZE 4096
+#define BLOB_SECTION_ALIGN 4096
+#define BLOB_ALIGN 16
+
+/* Each record starts with one of these bytes. */
+
+enum
+{
+  KIND_KEYED = 1,		/* class, field count, fields */
+  KIND_STRING,			/* string index */
+  KIND_NUMBER,			/* field type, payload */
+  KIND_DATA,			/* length, bytes */
+  KIND_ARRAY,			/* count, object refs */
+  KIND_SET,			/* count, object refs */
+  KIND_DICTIONARY,		/* count, key and value refs */
+  KIND_VALUE,			/* objc type string, length, bytes */
+  KIND_COLOR,			/* color payload */
+  KIND_NULL,
+  KIND_BLOB,			/* blob section offset, length */
+};
+
+/* Each field of a keyed record is a key string index, one of these
+   bytes, then the value. Object refs are the index of the object
+   record plus one, zero for nil. */
+
+enum
+{
+  TYPE_OBJECT = 1,		/* varint ref */
+  TYPE_BOOL,			/* u8 */
+  TYPE_INT,			/* zigzag varint */
+  TYPE_DOUBLE,			/* f64 */
+  TYPE_FLOAT,			/* f32 */
+  TYPE_BYTES,			/* varint length, bytes */
+  TYPE_POINT,			/* f64 x 2 */
+  TYPE_SIZE,			/* f64 x 2 */
+  TYPE_RECT,			/* f64 x 4 */
+  TYPE_TRANSFORM,		/* f64 x 6 */
+  TYPE_COLOR,			/* varint space name + 1, u8 count, f64s */
+  TYPE_PATH,			/* varint length, MgPathCreateData() bytes */
+};
+
+/** Writing primitives. **/
+
+static void
+write_u8(NSMutableData *d, uint8_t x)
+{
+  [d appendBytes:&x length:1];
+}
+
+static void
+write_u32(NSMutableData *d, uint32_t x)
+{
+  x = CFSwapInt32HostToLittle(x);
+  [d appendBytes:&x length:4];
+}
+
+static void
+write_u64(NSMutableData *d, uint64_t x)
+{
+  x = CFSwapInt64HostToLittle(x);
+  [d appendBytes:&x length:8];
+}
+
+static void
+write_varint(NSMutableData *d, uint64_t x)
+{
+  uint8_t buf[10];
+  size_t n = 0;
+
+  while (x >= 0x80)
+    {
+      buf[n++] = (uint8_t)x | 0x80;
+      x >>= 7;
+    }
+
+  buf[n++] = (uint8_t)x;
+
+  [d appendBytes:buf length:n];
+}
+
+static void
+write_svarint(NSMutableData *d, int64_t x)
+{
+  write_varint(d, ((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+}
+
+static void
+write_f64(NSMutableData *d, double x)
+{
+  uint64_t u;
+  memcpy(&u, &x, 8);
+  write_u64(d, u);
+}
+
+static void
+write_f32(NSMutableData *d, float x)
+{
+  uint32_t u;
+  memcpy(&u, &x, 4);
+  write_u32(d, u);
+}
+
+/** Reading primitives. **/
+
+/* All reads are bounds-checked, returning false at the end of the
+   buffer. */
+
+typedef struct reader reader;
+
+struct reader
+{
+  const uint8_t *ptr;
+  const uint8_t *end;
+};
+
+static bool
+read_u8(reader *r, uint8_t *x)
+{
+  if (r->ptr >= r->end)
+    return false;
+
+  *x = *r->ptr++;
+  return true;
+}
+
+static bool
+read_u32(reader *r, uint32_t *x)
+{
+  if (r->end - r->ptr < 4)
+    return false;
+
+  memcpy(x, r->ptr, 4);
+  *x = CFSwapInt32LittleToHost(*x);
+  r->ptr += 4;
+  return true;
+}
+
+static bool
+read_u64(reader *r, uint64_t *x)
+{
+  if (r->end - r->ptr < 8)
+    return false;
+
+  memcpy(x, r->ptr, 8);
+  *x = CFSwapInt64LittleToHost(*x);
+  r->ptr += 8;
+  return true;
+}
+
+static bool
+read_varint(reader *r, uint64_t *x)
+{
+  uint64_t value = 0;
+
+  for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+      uint8_t b;
+      if (!read_u8(r, &b))
+	return false;
+
+      value |= (uint64_t)(b & 0x7f) << shift;
+
+      if (!(b & 0x80))
+	{
+	  *x = value;
+	  return true;
+	}
+    }
+
+  return false;
+}
+
+static bool
+read_svarint(reader *r, int64_t *x)
+{
+  uint64_t u;
+  if (!read_varint(r, &u))
+    return false;
+
+  *x = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+  return true;
+}
+
+static bool
+read_f64(reader *r, double *x)
+{
+  uint64_t u;
+  if (!read_u64(r, &u))
+    return false;
+
+  memcpy(x, &u, 8);
+  return true;
+}
+
+static bool
+read_f32(reader *r, float *x)
+{
+  uint32_t u;
+  if (!read_u32(r, &u))
+    return false;
+
+  memcpy(x, &u, 4);
+  return true;
+}
+
+static bool
+read_bytes(reader *r, uint64_t n, const uint8_t **ptr)
+{
+  if ((uint64_t)(r->end - r->ptr) < n)
+    return false;
+
+  *ptr = r->ptr;
+  r->ptr += n;
+  return true;
+}
+
+static bool
+read_f64s(reader *r, size_t n, CGFloat *v)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      double x;
+      if (!read_f64(r, &x))
+	return false;
+      v[i] = x;
+    }
+
+  return true;
+}
+
+/* Advances over the value of a field of type `type'. */
+
+static bool
+skip_value(reader *r, uint8_t type)
+{
+  uint64_t n;
+  const uint8_t *ptr;
+  uint8_t count;
+
+  switch (type)
+    {
+    case TYPE_OBJECT:
+    case TYPE_INT:
+      return read_varint(r, &n);
+
+    case TYPE_BOOL:
+      return read_bytes(r, 1, &ptr);
+
+    case TYPE_DOUBLE:
+      return read_bytes(r, 8, &ptr);
+
+    case TYPE_FLOAT:
+      return read_bytes(r, 4, &ptr);
+
+    case TYPE_BYTES:
+    case TYPE_PATH:
+      return read_varint(r, &n) && read_bytes(r, n, &ptr);
+
+    case TYPE_POINT:
+    case TYPE_SIZE:
+      return read_bytes(r, 16, &ptr);
+
+    case TYPE_RECT:
+      return read_bytes(r, 32, &ptr);
+
+    case TYPE_TRANSFORM:
+      return read_bytes(r, 48, &ptr);
+
+    case TYPE_COLOR:
+      return (read_varint(r, &n) && read_u8(r, &count)
+	      && read_bytes(r, count * 8, &ptr));
+
+    default:
+      return false;
+    }
+}
+
+/** Journal. **/
+
+/* True if the journal should remember where `obj' was written. Strings
+   are tracked by value; other values are cheaper to rewrite. */
+
+static bool
+journal_tracks_object(id obj)
+{
+  return !(CFGetTypeID((__bridge CFTypeRef)obj) == CGColorGetTypeID()
+	   || [obj isKindOfClass:[NSString class]]
+	   || [obj isKindOfClass:[NSValue class]]
+	   || [obj isKindOfClass:[NSNull class]]);
+}
+
+@interface MgBinaryArchiveJournal ()
+{
+@public
+  NSMutableArray *_strings;
+  NSMutableDictionary *_stringIndices;	/* NSString -> NSNumber */
+  NSMutableDictionary *_stringIds;	/* NSString -> NSNumber */
+  NSMapTable *_objectIds;		/* object -> NSNumber */
+  NSMapTable *_versions;		/* MgNode -> NSNumber */
+  uint32_t _objectCount;
+  uint64_t _blobOffset;
+}
+
+@property(nonatomic, readwrite) uint64_t length;
+@property(nonatomic, readwrite) uint64_t baseLength;
+@property(nonatomic, readwrite) NSUInteger segmentCount;
+
+@end
+
+@implementation MgBinaryArchiveJournal
+
+@synthesize length = _length;
+@synthesize baseLength = _baseLength;
+@synthesize segmentCount = _segmentCount;
+
+- (id)init
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _strings = [NSMutableArray array];
+  _stringIndices = [NSMutableDictionary dictionary];
+  _stringIds = [NSMutableDictionary dictionary];
+
+  /* Weak keys, so the journal doesn't keep deleted objects alive. */
+
+  _objectIds = [NSMapTable mapTableWithKeyOptions:
+		(NSPointerFunctionsWeakMemory
+		 | NSPointerFunctionsObjectPointerPersonality)
+		valueOptions:NSPointerFunctionsStrongMemory];
+  _versions = [NSMapTable mapTableWithKeyOptions:
+	       (NSPointerFunctionsWeakMemory
+		| NSPointerFunctionsObjectPointerPersonality)
+	       valueOptions:NSPointerFunctionsStrongMemory];
+
+  return self;
+}
+
+/* True if the previously written record of `obj' is still valid.
+   Nodes are compared by version, which covers their descendants;
+   strings and data are assumed never to be modified. Other objects
+   are written again each time their owner is, so owners must change
+   version when they do, e.g. module layers when their module states
+   are edited. */
+
+- (BOOL)_objectIsUnchanged:(id)obj
+{
+  if ([obj isKindOfClass:[MgNode class]])
+    {
+      NSNumber *version = [_versions objectForKey:obj];
+      return (version != nil
+	      && [version unsignedIntegerValue] == [(MgNode *)obj version]);
+    }
+  else
+    {
+      return ([obj isKindOfClass:[NSString class]]
+	      || [obj isKindOfClass:[NSData class]]);
+    }
+}
+
+@end
+
+/** Archiver. **/
+
+@implementation MgBinaryArchiver
+{
+  NSMutableArray *_strings;
+  NSMutableDictionary *_stringIndices;	/* NSString -> NSNumber */
+
+  NSMapTable *_objectIds;		/* object -> NSNumber */
+  NSMutableDictionary *_stringIds;	/* NSString -> NSNumber */
+  NSMutableArray *_records;		/* NSData, or NSNull if unwritten */
+
+  /* Fields of the keyed record being encoded. */
+
+  NSMutableData *_fields;
+  NSUInteger _fieldCount;
+
+  NSMutableArray *_blobs;
+  uint64_t _blobSize;
+
+  /* When appending a segment: objects in earlier segments, and the
+     records rewritten for them (NSNull if their old record is kept). */
+
+  MgBinaryArchiveJournal *_journal;
+  NSUInteger _baseCount;
+  NSUInteger _baseStringCount;
+  NSMutableDictionary *_rewrites;	/* NSNumber -> NSData or NSNull */
+  uint64_t _blobBias;
+
+  NSData *_archive;
+}
+
++ (NSData *)archivedDataWithRootObject:(id)obj
+{
+  MgBinaryArchiver *archiver = [[self alloc] init];
+
+  [archiver encodeObject:obj forKey:NSKeyedArchiveRootObjectKey];
+
+  return [archiver finishEncoding];
+}
+
+- (id)init
+{
+  return [self initWithJournal:nil];
+}
+
+- (id)initWithJournal:(MgBinaryArchiveJournal *)journal
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  if (journal != nil)
+    {
+      _journal = journal;
+      _strings = journal->_strings;
+      _stringIndices = journal->_stringIndices;
+      _stringIds = journal->_stringIds;
+    }
+  else
+    {
+      _strings = [NSMutableArray array];
+      _stringIndices = [NSMutableDictionary dictionary];
+      _stringIds = [NSMutableDictionary dictionary];
+    }
+
+  if (journal.length != 0)
+    {
+      _baseCount = journal->_objectCount;
+      _baseStringCount = [_strings count];
+      _rewrites = [NSMutableDictionary dictionary];
+
+      /* The segment's blobs start at the first page boundary after its
+	 header, but offsets are relative to the original archive's
+	 blob section. */
+
+      uint64_t blob_start = ((journal.length + SEGMENT_HEADER_SIZE
+			      + BLOB_SECTION_ALIGN - 1)
+			     & ~(uint64_t)(BLOB_SECTION_ALIGN - 1));
+      _blobBias = blob_start - journal->_blobOffset;
+    }
+
+  _objectIds = [NSMapTable mapTableWithKeyOptions:
+		(NSPointerFunctionsStrongMemory
+		 | NSPointerFunctionsObjectPointerPersonality)
+		valueOptions:NSPointerFunctionsStrongMemory];
+  _records = [NSMutableArray array];
+
+  _fields = [NSMutableData data];
+
+  _blobs = [NSMutableArray array];
+
+  return self;
+}
+
+- (BOOL)allowsKeyedCoding
+{
+  return YES;
+}
+
+- (NSUInteger)_indexOfString:(NSString *)str
+{
+  NSNumber *idx = _stringIndices[str];
+
+  if (idx == nil)
+    {
+      str = [str copy];
+      idx = @([_strings count]);
+      [_strings addObject:str];
+      _stringIndices[str] = idx;
+    }
+
+  return [idx unsignedIntegerValue];
+}
+
+- (void)_beginField:(NSString *)key type:(uint8_t)type
+{
+  write_varint(_fields, [self _indexOfString:key]);
+  write_u8(_fields, type);
+  _fieldCount++;
+}
+
+- (void)_writeColor:(CGColorRef)c toData:(NSMutableData *)d
+{
+  CGColorSpaceRef space = CGColorGetColorSpace(c);
+  CFStringRef name = space != NULL ? CGColorSpaceCopyName(space) : NULL;
+
+  if (name != NULL)
+    {
+      write_varint(d, [self _indexOfString:(__bridge NSString *)name] + 1);
+      CFRelease(name);
+    }
+  else
+    write_varint(d, 0);
+
+  /* Pattern colors have no components and are written as empty. */
+
+  const CGFloat *v = CGColorGetComponents(c);
+  size_t n = v != NULL ? CGColorGetNumberOfComponents(c) : 0;
+
+  write_u8(d, n);
+
+  for (size_t i = 0; i < n; i++)
+    write_f64(d, v[i]);
+}
+
+- (NSData *)_recordForObject:(id)obj
+{
+  NSMutableData *d = [NSMutableData data];
+
+  if (CFGetTypeID((__bridge CFTypeRef)obj) == CGColorGetTypeID())
+    {
+      write_u8(d, KIND_COLOR);
+      [self _writeColor:(__bridge CGColorRef)obj toData:d];
+    }
+  else if ([obj isKindOfClass:[NSString class]])
+    {
+      write_u8(d, KIND_STRING);
+      write_varint(d, [self _indexOfString:obj]);
+    }
+  else if ([obj isKindOfClass:[NSNumber class]])
+    {
+      CFNumberRef n = (__bridge CFNumberRef)obj;
+
+      write_u8(d, KIND_NUMBER);
+
+      if (CFGetTypeID(n) == CFBooleanGetTypeID())
+	{
+	  write_u8(d, TYPE_BOOL);
+	  write_u8(d, [obj boolValue]);
+	}
+      else if (CFNumberIsFloatType(n))
+	{
+	  write_u8(d, TYPE_DOUBLE);
+	  write_f64(d, [obj doubleValue]);
+	}
+      else
+	{
+	  write_u8(d, TYPE_INT);
+	  write_svarint(d, [obj longLongValue]);
+	}
+    }
+  else if ([obj isKindOfClass:[NSData class]]
+	   && [obj length] >= BLOB_MIN_SIZE)
+    {
+      _blobSize = (_blobSize + BLOB_ALIGN - 1) & ~(uint64_t)(BLOB_ALIGN - 1);
+
+      write_u8(d, KIND_BLOB);
+      write_varint(d, _blobBias + _blobSize);
+      write_varint(d, [obj length]);
+
+      [_blobs addObject:[obj copy]];
+      _blobSize += [obj length];
+    }
+  else if ([obj isKindOfClass:[NSData class]])
+    {
+      write_u8(d, KIND_DATA);
+      write_varint(d, [obj length]);
+      [d appendData:obj];
+    }
+  else if ([obj isKindOfClass:[NSArray class]]
+	   || [obj isKindOfClass:[NSSet class]])
+    {
+      write_u8(d, [obj isKindOfClass:[NSArray class]]
+	       ? KIND_ARRAY : KIND_SET);
+      write_varint(d, [obj count]);
+
+      for (id elt in obj)
+	write_varint(d, [self _refForObject:elt conditional:NO]);
+    }
+  else if ([obj isKindOfClass:[NSDictionary class]])
+    {
+      write_u8(d, KIND_DICTIONARY);
+      write_varint(d, [obj count]);
+
+      [obj enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop)
+	{
+	  write_varint(d, [self _refForObject:key conditional:NO]);
+	  write_varint(d, [self _refForObject:value conditional:NO]);
+	}];
+    }
+  else if ([obj isKindOfClass:[NSNull class]])
+    {
+      write_u8(d, KIND_NULL);
+    }
+  else if ([obj isKindOfClass:[NSValue class]])
+    {
+      const char *type = [obj objCType];
+      NSUInteger size = 0;
+      NSGetSizeAndAlignment(type, &size, NULL);
+
+      void *buf = alloca(size);
+      [obj getValue:buf];
+
+      write_u8(d, KIND_VALUE);
+      write_varint(d, [self _indexOfString:@(type)]);
+      write_varint(d, size);
+      [d appendBytes:buf length:size];
+    }
+  else if ([obj conformsToProtocol:@protocol(NSCoding)])
+    {
+      NSMutableData *saved_fields = _fields;
+      NSUInteger saved_count = _fieldCount;
+
+      _fields = [NSMutableData data];
+      _fieldCount = 0;
+
+      [obj encodeWithCoder:self];
+
+      write_u8(d, KIND_KEYED);
+      write_varint(d, [self _indexOfString:
+		       NSStringFromClass([obj classForCoder])]);
+      write_varint(d, _fieldCount);
+      [d appendData:_fields];
+
+      _fields = saved_fields;
+      _fieldCount = saved_count;
+    }
+  else
+    {
+      [NSException raise:NSInvalidArgumentException
+       format:@"MgBinaryArchiver: can't encode %@", [obj class]];
+    }
+
+  return d;
+}
+
+- (BOOL)_isWrittenIndex:(NSUInteger)idx
+{
+  if (idx < _baseCount)
+    return _rewrites[@(idx)] != nil;
+  else
+    return _records[idx - _baseCount] != [NSNull null];
+}
+
+- (void)_setRecord:(id)record atIndex:(NSUInteger)idx
+{
+  if (idx < _baseCount)
+    _rewrites[@(idx)] = record;
+  else
+    _records[idx - _baseCount] = record;
+}
+
+/* Returns the reference to `obj', writing its record unless
+   `conditional' is true. Conditional objects that are never written
+   unconditionally decode as nil. When appending to a journal, objects
+   from earlier segments keep their index, and are only written again
+   if they may have changed. */
+
+- (uint64_t)_refForObject:(id)obj conditional:(BOOL)conditional
+{
+  obj = [obj replacementObjectForCoder:self];
+  if (obj == nil)
+    return 0;
+
+  BOOL is_string = [obj isKindOfClass:[NSString class]];
+
+  NSNumber *num = (is_string ? _stringIds[obj]
+		   : [_objectIds objectForKey:obj]);
+
+  if (num == nil && !is_string && _baseCount != 0)
+    {
+      num = [_journal->_objectIds objectForKey:obj];
+      if (num != nil)
+	[_objectIds setObject:num forKey:obj];
+    }
+
+  NSUInteger idx;
+
+  if (num == nil)
+    {
+      idx = _baseCount + [_records count];
+      [_records addObject:[NSNull null]];
+
+      if (is_string)
+	_stringIds[[obj copy]] = @(idx);
+      else
+	[_objectIds setObject:@(idx) forKey:obj];
+    }
+  else
+    idx = [num unsignedIntegerValue];
+
+  if (!conditional && ![self _isWrittenIndex:idx])
+    {
+      if (idx < _baseCount && [_journal _objectIsUnchanged:obj])
+	_rewrites[@(idx)] = [NSNull null];
+      else
+	{
+	  /* Mark as written first, in case the graph has cycles. */
+
+	  [self _setRecord:[NSData data] atIndex:idx];
+	  [self _setRecord:[self _recordForObject:obj] atIndex:idx];
+	}
+    }
+
+  return idx + 1;
+}
+
+- (void)encodeObject:(id)obj forKey:(NSString *)key
+{
+  uint64_t ref = [self _refForObject:obj conditional:NO];
+  [self _beginField:key type:TYPE_OBJECT];
+  write_varint(_fields, ref);
+}
+
+- (void)encodeConditionalObject:(id)obj forKey:(NSString *)key
+{
+  uint64_t ref = [self _refForObject:obj conditional:YES];
+  [self _beginField:key type:TYPE_OBJECT];
+  write_varint(_fields, ref);
+}
+
+- (void)encodeBool:(BOOL)x forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_BOOL];
+  write_u8(_fields, x != NO);
+}
+
+- (void)encodeInt:(int)x forKey:(NSString *)key
+{
+  [self encodeInt64:x forKey:key];
+}
+
+- (void)encodeInt32:(int32_t)x forKey:(NSString *)key
+{
+  [self encodeInt64:x forKey:key];
+}
+
+- (void)encodeInteger:(NSInteger)x forKey:(NSString *)key
+{
+  [self encodeInt64:x forKey:key];
+}
+
+- (void)encodeInt64:(int64_t)x forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_INT];
+  write_svarint(_fields, x);
+}
+
+- (void)encodeFloat:(float)x forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_FLOAT];
+  write_f32(_fields, x);
+}
+
+- (void)encodeDouble:(double)x forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_DOUBLE];
+  write_f64(_fields, x);
+}
+
+- (void)encodeBytes:(const uint8_t *)ptr length:(NSUInteger)len
+    forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_BYTES];
+  write_varint(_fields, len);
+  [_fields appendBytes:ptr length:len];
+}
+
+- (void)mg_encodeCGPoint:(CGPoint)p forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_POINT];
+  write_f64(_fields, p.x);
+  write_f64(_fields, p.y);
+}
+
+- (void)mg_encodeCGSize:(CGSize)s forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_SIZE];
+  write_f64(_fields, s.width);
+  write_f64(_fields, s.height);
+}
+
+- (void)mg_encodeCGRect:(CGRect)r forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_RECT];
+  write_f64(_fields, r.origin.x);
+  write_f64(_fields, r.origin.y);
+  write_f64(_fields, r.size.width);
+  write_f64(_fields, r.size.height);
+}
+
+- (void)mg_encodeCGAffineTransform:(CGAffineTransform)m
+    forKey:(NSString *)key
+{
+  [self _beginField:key type:TYPE_TRANSFORM];
+  write_f64(_fields, m.a);
+  write_f64(_fields, m.b);
+  write_f64(_fields, m.c);
+  write_f64(_fields, m.d);
+  write_f64(_fields, m.tx);
+  write_f64(_fields, m.ty);
+}
+
+- (void)mg_encodeCGColor:(CGColorRef)c forKey:(NSString *)key
+{
+  if (c == NULL)
+    return;
+
+  [self _beginField:key type:TYPE_COLOR];
+  [self _writeColor:c toData:_fields];
+}
+
+- (void)mg_encodeCGPath:(CGPathRef)p forKey:(NSString *)key
+{
+  if (p == NULL)
+    return;
+
+  CFDataRef data = MgPathCreateData(p, true);
+  if (data == NULL)
+    return;
+
+  [self _beginField:key type:TYPE_PATH];
+  write_varint(_fields, CFDataGetLength(data));
+  [_fields appendBytes:CFDataGetBytePtr(data) length:CFDataGetLength(data)];
+
+  CFRelease(data);
+}
+
+- (void)_writeStringsFromIndex:(NSUInteger)first toData:(NSMutableData *)out
+{
+  NSUInteger count = [_strings count];
+
+  for (NSUInteger i = first; i < count; i++)
+    {
+      NSData *utf8 = [_strings[i] dataUsingEncoding:NSUTF8StringEncoding];
+      write_varint(out, [utf8 length]);
+      [out appendData:utf8];
+    }
+}
+
+- (NSData *)_archiveWithRoot:(NSData *)root
+{
+  NSMutableData *out = [NSMutableData dataWithLength:HEADER_SIZE];
+
+  uint64_t strings_offset = [out length];
+
+  [self _writeStringsFromIndex:0 toData:out];
+
+  uint32_t object_count = (uint32_t)[_records count];
+
+  uint64_t table_offset = [out length];
+  [out increaseLengthBy:object_count * 8];
+
+  uint64_t *table = (uint64_t *)((uint8_t *)[out mutableBytes]
+				 + table_offset);
+
+  for (uint32_t i = 0; i < object_count; i++)
+    {
+      NSData *record = _records[i];
+      uint64_t offset = 0;
+
+      if (record != (id)[NSNull null])
+	{
+	  offset = [out length];
+	  [out appendData:record];
+
+	  /* Appending may have moved the buffer. */
+
+	  table = (uint64_t *)((uint8_t *)[out mutableBytes] + table_offset);
+	}
+
+      uint64_t le = CFSwapInt64HostToLittle(offset);
+      memcpy(&table[i], &le, 8);
+    }
+
+  uint64_t root_offset = [out length];
+  [out appendData:root];
+
+  /* The blob section offset is also the base of blob offsets in later
+     segments, so is set even if there are no blobs. */
+
+  if ([_blobs count] != 0)
+    {
+      [out increaseLengthBy:(BLOB_SECTION_ALIGN - [out length]
+			     % BLOB_SECTION_ALIGN) % BLOB_SECTION_ALIGN];
+    }
+
+  uint64_t blob_offset = [out length];
+
+  for (NSData *blob in _blobs)
+    {
+      [out increaseLengthBy:(BLOB_ALIGN - ([out length] - blob_offset)
+			     % BLOB_ALIGN) % BLOB_ALIGN];
+      [out appendData:blob];
+    }
+
+  NSMutableData *header = [NSMutableData data];
+  [header appendBytes:MAGIC length:4];
+  write_u32(header, FORMAT_VERSION);
+  write_u32(header, (uint32_t)[_strings count]);
+  write_u32(header, object_count);
+  write_u64(header, strings_offset);
+  write_u64(header, table_offset);
+  write_u64(header, root_offset);
+  write_u64(header, blob_offset);
+  write_u64(header, [out length]);
+
+  [out replaceBytesInRange:NSMakeRange(0, HEADER_SIZE)
+   withBytes:[header bytes]];
+
+  if (_journal != nil)
+    {
+      _journal->_blobOffset = blob_offset;
+      _journal.baseLength = [out length];
+      _journal.segmentCount = 0;
+    }
+
+  return out;
+}
+
+- (NSData *)_segmentWithRoot:(NSData *)root
+{
+  uint64_t base = _journal.length;
+
+  NSMutableData *out = [NSMutableData dataWithLength:SEGMENT_HEADER_SIZE];
+
+  if ([_blobs count] != 0)
+    {
+      uint64_t blob_start = _journal->_blobOffset + _blobBias;
+
+      [out setLength:blob_start - base];
+
+      for (NSData *blob in _blobs)
+	{
+	  [out increaseLengthBy:(BLOB_ALIGN - (base + [out length]
+					       - blob_start)
+				 % BLOB_ALIGN) % BLOB_ALIGN];
+	  [out appendData:blob];
+	}
+    }
+
+  uint64_t strings_offset = base + [out length];
+
+  [self _writeStringsFromIndex:_baseStringCount toData:out];
+
+  NSMutableData *table = [NSMutableData data];
+  uint32_t entry_count = 0;
+
+  for (NSNumber *idx in _rewrites)
+    {
+      NSData *record = _rewrites[idx];
+
+      if (record != (id)[NSNull null])
+	{
+	  write_u32(table, [idx unsignedIntValue]);
+	  write_u64(table, base + [out length]);
+	  [out appendData:record];
+	  entry_count++;
+	}
+    }
+
+  NSUInteger count = [_records count];
+
+  for (NSUInteger i = 0; i < count; i++)
+    {
+      NSData *record = _records[i];
+
+      if (record != (id)[NSNull null])
+	{
+	  write_u32(table, (uint32_t)(_baseCount + i));
+	  write_u64(table, base + [out length]);
+	  [out appendData:record];
+	  entry_count++;
+	}
+    }
+
+  uint64_t table_offset = base + [out length];
+  [out appendData:table];
+
+  uint64_t root_offset = base + [out length];
+  [out appendData:root];
+
+  NSMutableData *header = [NSMutableData data];
+  [header appendBytes:SEGMENT_MAGIC length:4];
+  write_u32(header, (uint32_t)([_strings count] - _baseStringCount));
+  write_u32(header, (uint32_t)(_baseCount + count));
+  write_u32(header, entry_count);
+  write_u64(header, [out length]);
+  write_u64(header, strings_offset);
+  write_u64(header, table_offset);
+  write_u64(header, root_offset);
+
+  [out replaceBytesInRange:NSMakeRange(0, SEGMENT_HEADER_SIZE)
+   withBytes:[header bytes]];
+
+  _journal.segmentCount = _journal.segmentCount + 1;
+
+  return out;
+}
+
+/* Remembers where every tracked object written (or kept) by this
+   archiver is, and the versions of the nodes among them. */
+
+- (void)_updateJournal
+{
+  MgBinaryArchiveJournal *journal = _journal;
+
+  for (id obj in _objectIds)
+    {
+      NSUInteger idx = [[_objectIds objectForKey:obj] unsignedIntegerValue];
+
+      if (!journal_tracks_object(obj) || ![self _isWrittenIndex:idx])
+	continue;
+
+      [journal->_objectIds setObject:@(idx) forKey:obj];
+
+      if ([obj isKindOfClass:[MgNode class]])
+	{
+	  [journal->_versions setObject:@([(MgNode *)obj version])
+	   forKey:obj];
+	}
+    }
+
+  journal->_objectCount = (uint32_t)(_baseCount + [_records count]);
+}
+
+- (NSData *)finishEncoding
+{
+  if (_archive != nil)
+    return _archive;
+
+  NSMutableData *root = [NSMutableData data];
+  write_u8(root, KIND_KEYED);
+  write_varint(root, [self _indexOfString:@""]);
+  write_varint(root, _fieldCount);
+  [root appendData:_fields];
+
+  if (_journal.length == 0)
+    _archive = [[self _archiveWithRoot:root] copy];
+  else
+    _archive = [[self _segmentWithRoot:root] copy];
+
+  if (_journal != nil)
+    {
+      [self _updateJournal];
+      _journal.length = _journal.length + [_archive length];
+    }
+
+  _records = nil;
+  _objectIds = nil;
+  _stringIds = nil;
+  _rewrites = nil;
+  _blobs = nil;
+
+  return _archive;
+}
+
+@end
+
+/** Unarchiver. **/
+
+typedef struct field field;
+
+struct field
+{
+  uint64_t key;
+  uint8_t type;
+  const uint8_t *value;
+};
+
+@implementation MgBinaryUnarchiver
+{
+  NSData *_data;
+  const uint8_t *_bytes;
+  const uint8_t *_end;
+  const uint8_t *_blobs;
+
+  NSMutableArray *_strings;
+  NSMutableDictionary *_stringIndices;	/* NSString -> NSNumber */
+
+  uint32_t _objectCount;
+  const uint8_t *_table;
+  uint64_t *_offsets;			/* replaces _table if segments */
+  NSMutableArray *_objects;		/* NSNull if not yet decoded */
+
+  /* Length of the original archive, and of it plus every valid
+     segment following it; zero before version 3. */
+
+  uint64_t _archiveLength;
+  uint64_t _validLength;
+  uint64_t _blobOffset;
+  NSUInteger _segmentCount;
+  NSMutableIndexSet *_decoding;
+
+  /* Fields of the keyed record being decoded. */
+
+  field *_fields;
+  size_t _fieldCount;
+}
+
++ (BOOL)canReadData:(NSData *)data
+{
+  return ([data length] >= HEADER_SIZE_V1
+	  && memcmp([data bytes], MAGIC, 4) == 0);
+}
+
++ (id)unarchiveObjectWithData:(NSData *)data
+{
+  MgBinaryUnarchiver *unarchiver
+    = [[self alloc] initForReadingWithData:data];
+
+  id obj = [unarchiver decodeObjectForKey:NSKeyedArchiveRootObjectKey];
+
+  [unarchiver finishDecoding];
+
+  return obj;
+}
+
+- (id)initForReadingWithData:(NSData *)data
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  if (![[self class] canReadData:data])
+    return nil;
+
+  /* Decoded data objects may reference the archive's bytes, so it
+     must not change. (Copying immutable data is free.) */
+
+  _data = [data copy];
+  _bytes = [_data bytes];
+  _end = _bytes + [_data length];
+
+  reader r = {_bytes + 4, _end};
+
+  uint32_t version, string_count, object_count;
+  uint64_t strings_offset, table_offset, root_offset;
+  uint64_t blob_offset = 0, archive_length = 0;
+
+  if (!read_u32(&r, &version) || version < 1 || version > FORMAT_VERSION
+      || !read_u32(&r, &string_count)
+      || !read_u32(&r, &object_count)
+      || !read_u64(&r, &strings_offset)
+      || !read_u64(&r, &table_offset)
+      || !read_u64(&r, &root_offset)
+      || (version >= 2 && !read_u64(&r, &blob_offset))
+      || (version >= 3 && !read_u64(&r, &archive_length)))
+    return nil;
+
+  size_t length = _end - _bytes;
+
+  if (strings_offset > length || table_offset > length
+      || (length - table_offset) / 8 < object_count
+      || blob_offset > length || archive_length > length
+      || (version >= 3 && archive_length < HEADER_SIZE))
+    return nil;
+
+  _blobs = blob_offset != 0 ? _bytes + blob_offset : NULL;
+  _blobOffset = blob_offset;
+
+  /* Strings are needed to look up keys, so are read up front. */
+
+  _strings = [NSMutableArray array];
+  _stringIndices = [NSMutableDictionary dictionary];
+
+  r.ptr = _bytes + strings_offset;
+
+  if (![self _readStrings:&r count:string_count])
+    return nil;
+
+  _objectCount = object_count;
+  _table = _bytes + table_offset;
+
+  _archiveLength = _validLength = archive_length;
+
+  if (archive_length != 0)
+    {
+      while (_validLength < length)
+	{
+	  uint64_t n = [self _readSegmentAt:_validLength
+			rootOffset:&root_offset];
+	  if (n == 0)
+	    break;
+
+	  _validLength += n;
+	  _segmentCount++;
+	}
+    }
+
+  _objects = [NSMutableArray arrayWithCapacity:_objectCount];
+  for (uint32_t i = 0; i < _objectCount; i++)
+    [_objects addObject:[NSNull null]];
+  _decoding = [NSMutableIndexSet indexSet];
+
+  /* Make the root record current. */
+
+  if (root_offset > length)
+    return nil;
+
+  r.ptr = _bytes + root_offset;
+
+  uint8_t kind;
+  uint64_t class_idx;
+  if (!read_u8(&r, &kind) || kind != KIND_KEYED
+      || !read_varint(&r, &class_idx)
+      || ![self _readFields:&r])
+    return nil;
+
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_fields);
+  free(_offsets);
+}
+
+- (BOOL)_readStrings:(reader *)r count:(uint32_t)count
+{
+  for (uint32_t i = 0; i < count; i++)
+    {
+      uint64_t len;
+      const uint8_t *ptr;
+      if (!read_varint(r, &len) || !read_bytes(r, len, &ptr))
+	return NO;
+
+      NSString *str = [[NSString alloc] initWithBytes:ptr length:len
+		       encoding:NSUTF8StringEncoding];
+      if (str == nil)
+	return NO;
+
+      _stringIndices[str] = @([_strings count]);
+      [_strings addObject:str];
+    }
+
+  return YES;
+}
+
+- (uint64_t)_offsetOfObject:(NSUInteger)idx
+{
+  if (_offsets != NULL)
+    return _offsets[idx];
+
+  uint64_t offset;
+  memcpy(&offset, _table + idx * 8, 8);
+  return CFSwapInt64LittleToHost(offset);
+}
+
+/* Applies the segment at `offset', returning its length, or zero if
+   it's incomplete or malformed, in which case nothing is changed. */
+
+- (uint64_t)_readSegmentAt:(uint64_t)offset rootOffset:(uint64_t *)root_ptr
+{
+  uint64_t length = _end - _bytes;
+
+  if (length - offset < SEGMENT_HEADER_SIZE
+      || memcmp(_bytes + offset, SEGMENT_MAGIC, 4) != 0)
+    return 0;
+
+  reader r = {_bytes + offset + 4, _end};
+
+  uint32_t string_count, object_count, entry_count;
+  uint64_t seg_length, strings_offset, table_offset, root_offset;
+
+  if (!read_u32(&r, &string_count)
+      || !read_u32(&r, &object_count)
+      || !read_u32(&r, &entry_count)
+      || !read_u64(&r, &seg_length)
+      || !read_u64(&r, &strings_offset)
+      || !read_u64(&r, &table_offset)
+      || !read_u64(&r, &root_offset))
+    return 0;
+
+  if (seg_length < SEGMENT_HEADER_SIZE || seg_length > length - offset
+      || object_count < _objectCount
+      || strings_offset < offset || strings_offset > offset + seg_length
+      || table_offset < offset || table_offset > offset + seg_length
+      || root_offset < offset || root_offset >= offset + seg_length
+      || (offset + seg_length - table_offset) / SEGMENT_ENTRY_SIZE
+	  < entry_count)
+    return 0;
+
+  const uint8_t *seg_end = _bytes + offset + seg_length;
+
+  /* Check the table before changing anything. */
+
+  r = (reader){_bytes + table_offset, seg_end};
+
+  for (uint32_t i = 0; i < entry_count; i++)
+    {
+      uint32_t idx;
+      uint64_t record;
+      if (!read_u32(&r, &idx) || !read_u64(&r, &record)
+	  || idx >= object_count || record < offset
+	  || record >= offset + seg_length)
+	return 0;
+    }
+
+  NSUInteger old_count = [_strings count];
+
+  r = (reader){_bytes + strings_offset, seg_end};
+
+  if (![self _readStrings:&r count:string_count])
+    {
+      while ([_strings count] > old_count)
+	{
+	  [_stringIndices removeObjectForKey:[_strings lastObject]];
+	  [_strings removeLastObject];
+	}
+      return 0;
+    }
+
+  uint64_t *offsets = realloc(_offsets, (size_t)object_count * 8);
+  if (offsets == NULL && object_count != 0)
+    return 0;
+
+  if (_offsets == NULL)
+    {
+      for (uint32_t i = 0; i < _objectCount; i++)
+	{
+	  uint64_t x;
+	  memcpy(&x, _table + i * 8, 8);
+	  offsets[i] = CFSwapInt64LittleToHost(x);
+	}
+    }
+
+  for (uint32_t i = _objectCount; i < object_count; i++)
+    offsets[i] = 0;
+
+  _offsets = offsets;
+  _objectCount = object_count;
+
+  r = (reader){_bytes + table_offset, seg_end};
+
+  for (uint32_t i = 0; i < entry_count; i++)
+    {
+      uint32_t idx;
+      uint64_t record;
+      read_u32(&r, &idx);
+      read_u64(&r, &record);
+      _offsets[idx] = record;
+    }
+
+  *root_ptr = root_offset;
+
+  return seg_length;
+}
+
+- (MgBinaryArchiveJournal *)journal
+{
+  if (_archiveLength == 0 || _objects == nil)
+    return nil;
+
+  MgBinaryArchiveJournal *journal = [[MgBinaryArchiveJournal alloc] init];
+
+  [journal->_strings setArray:_strings];
+  [journal->_stringIndices setDictionary:_stringIndices];
+
+  NSUInteger count = [_objects count];
+
+  for (NSUInteger i = 0; i < count; i++)
+    {
+      id obj = _objects[i];
+
+      if (obj == [NSNull null])
+	continue;
+
+      if ([obj isKindOfClass:[NSString class]])
+	journal->_stringIds[obj] = @(i);
+      else if (journal_tracks_object(obj))
+	{
+	  [journal->_objectIds setObject:@(i) forKey:obj];
+
+	  if ([obj isKindOfClass:[MgNode class]])
+	    {
+	      [journal->_versions setObject:@([(MgNode *)obj version])
+	       forKey:obj];
+	    }
+	}
+    }
+
+  journal->_objectCount = _objectCount;
+  journal->_blobOffset = _blobOffset;
+  journal.length = _validLength;
+  journal.baseLength = _archiveLength;
+  journal.segmentCount = _segmentCount;
+
+  return journal;
+}
+
+- (void)finishDecoding
+{
+  free(_fields);
+  _fields = NULL;
+  _fieldCount = 0;
+
+  _objects = nil;
+}
+
+- (BOOL)allowsKeyedCoding
+{
+  return YES;
+}
+
+/* Parses the field list at `r' into _fields. */
+
+- (BOOL)_readFields:(reader *)r
+{
+  uint64_t count;
+  if (!read_varint(r, &count))
+    return NO;
+
+  /* Each field takes at least three bytes. */
+
+  if (count > (uint64_t)(r->end - r->ptr) / 3)
+    return NO;
+
+  field *fields = malloc(count * sizeof(field));
+
+  for (uint64_t i = 0; i < count; i++)
+    {
+      if (!read_varint(r, &fields[i].key)
+	  || !read_u8(r, &fields[i].type))
+	{
+	  free(fields);
+	  return NO;
+	}
+
+      fields[i].value = r->ptr;
+
+      if (!skip_value(r, fields[i].type))
+	{
+	  free(fields);
+	  return NO;
+	}
+    }
+
+  free(_fields);
+  _fields = fields;
+  _fieldCount = count;
+
+  return YES;
+}
+
+- (const field *)_fieldForKey:(NSString *)key
+{
+  NSNumber *idx = _stringIndices[key];
+  if (idx == nil)
+    return NULL;
+
+  uint64_t k = [idx unsignedLongLongValue];
+
+  for (size_t i = 0; i < _fieldCount; i++)
+    {
+      if (_fields[i].key == k)
+	return &_fields[i];
+    }
+
+  return NULL;
+}
+
+- (reader)_readerForField:(const field *)f
+{
+  return (reader){f->value, _end};
+}
+
+- (CGColorRef)_copyColorWithReader:(reader *)r CF_RETURNS_RETAINED
+{
+  uint64_t name_idx;
+  uint8_t count;
+  if (!read_varint(r, &name_idx) || !read_u8(r, &count)
+      || name_idx > [_strings count] || count == 0 || count > 8)
+    return NULL;
+
+  CGFloat v[8];
+  if (!read_f64s(r, count, v))
+    return NULL;
+
+  CGColorSpaceRef space = NULL;
+
+  if (name_idx != 0)
+    {
+      space = CGColorSpaceCreateWithName((__bridge CFStringRef)
+					 _strings[name_idx - 1]);
+    }
+  else if (count == 4)
+    space = CGColorSpaceRetain(MgSRGBColorSpace());
+  else if (count == 2)
+    space = CGColorSpaceCreateWithName(kCGColorSpaceGenericGray);
+
+  if (space == NULL)
+    return NULL;
+
+  CGColorRef c = NULL;
+  if (CGColorSpaceGetNumberOfComponents(space) + 1 == count)
+    c = CGColorCreate(space, v);
+
+  CGColorSpaceRelease(space);
+
+  return c;
+}
+
+- (id)_objectForRef:(uint64_t)ref
+{
+  if (ref == 0 || ref > _objectCount)
+    return nil;
+
+  NSUInteger idx = ref - 1;
+
+  id obj = _objects[idx];
+  if (obj != [NSNull null])
+    return obj;
+
+  /* A non-keyed object that refers back to itself. */
+
+  if ([_decoding containsIndex:idx])
+    return nil;
+
+  uint64_t offset = [self _offsetOfObject:idx];
+
+  /* Zero means a conditional object that wasn't archived. */
+
+  if (offset == 0 || offset >= (uint64_t)(_end - _bytes))
+    return nil;
+
+  reader r = {_bytes + offset, _end};
+
+  [_decoding addIndex:idx];
+  obj = [self _decodeRecord:&r index:idx];
+  [_decoding removeIndex:idx];
+
+  if (obj != nil)
+    _objects[idx] = obj;
+
+  return obj;
+}
+
+- (NSArray *)_decodeObjects:(reader *)r count:(uint64_t)count
+{
+  /* Each ref takes at least one byte. */
+
+  if (count > (uint64_t)(r->end - r->ptr))
+    return nil;
+
+  NSMutableArray *array = [NSMutableArray arrayWithCapacity:count];
+
+  for (uint64_t i = 0; i < count; i++)
+    {
+      uint64_t ref;
+      if (!read_varint(r, &ref))
+	return nil;
+
+      id obj = [self _objectForRef:ref];
+      if (obj != nil)
+	[array addObject:obj];
+    }
+
+  return array;
+}
+
+/* Returns data referencing the archive's bytes directly, which keeps
+   the archive data (e.g. a file mapping) alive. */
+
+- (NSData *)_dataWithBytes:(const uint8_t *)ptr length:(NSUInteger)len
+{
+  NSData *archive = _data;
+
+  return [[NSData alloc] initWithBytesNoCopy:(void *)ptr length:len
+	  deallocator:^(void *p, NSUInteger l)
+	    {
+	      (void)archive;
+	    }];
+}
+
+- (NSData *)_decodeBlob:(reader *)r
+{
+  uint64_t offset, len;
+  if (_blobs == NULL || !read_varint(r, &offset) || !read_varint(r, &len))
+    return nil;
+
+  if (offset > (uint64_t)(_end - _blobs)
+      || len > (uint64_t)(_end - _blobs) - offset)
+    return nil;
+
+  return [self _dataWithBytes:_blobs + offset length:len];
+}
+
+- (NSDictionary *)_decodeDictionary:(reader *)r
+{
+  uint64_t n;
+  if (!read_varint(r, &n) || n > UINT32_MAX)
+    return nil;
+
+  NSArray *objs = [self _decodeObjects:r count:n * 2];
+  if ([objs count] != n * 2)
+    return nil;
+
+  NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+
+  for (NSUInteger i = 0; i < n; i++)
+    dict[objs[i*2]] = objs[i*2+1];
+
+  return [dict copy];
+}
+
+- (NSValue *)_decodeValue:(reader *)r
+{
+  uint64_t type_idx, n;
+  const uint8_t *ptr;
+
+  if (!read_varint(r, &type_idx) || type_idx >= [_strings count])
+    return nil;
+
+  /* Only accept types whose size we know, rather than trusting the
+     type string from the archive. */
+
+  const char *type = [_strings[type_idx] UTF8String];
+  size_t size = 0;
+
+  if (strcmp(type, @encode(CGPoint)) == 0
+      || strcmp(type, @encode(CGSize)) == 0)
+    size = sizeof(CGPoint);
+  else if (strcmp(type, @encode(CGRect)) == 0)
+    size = sizeof(CGRect);
+  else if (strcmp(type, @encode(CGAffineTransform)) == 0)
+    size = sizeof(CGAffineTransform);
+
+  if (size == 0 || !read_varint(r, &n) || n != size
+      || !read_bytes(r, n, &ptr))
+    return nil;
+
+  return [NSValue valueWithBytes:ptr objCType:type];
+}
+
+- (id)_decodeRecord:(reader *)r index:(NSUInteger)idx
+{
+  uint8_t kind, type;
+  uint64_t n;
+  const uint8_t *ptr;
+
+  if (!read_u8(r, &kind))
+    return nil;
+
+  switch (kind)
+    {
+    case KIND_KEYED:
+      return [self _decodeKeyedRecord:r index:idx];
+
+    case KIND_STRING:
+      if (!read_varint(r, &n) || n >= [_strings count])
+	return nil;
+      return _strings[n];
+
+    case KIND_NUMBER:
+      if (!read_u8(r, &type))
+	return nil;
+      if (type == TYPE_BOOL)
+	{
+	  uint8_t x;
+	  return read_u8(r, &x) ? @(x != 0) : nil;
+	}
+      else if (type == TYPE_DOUBLE)
+	{
+	  double x;
+	  return read_f64(r, &x) ? @(x) : nil;
+	}
+      else if (type == TYPE_INT)
+	{
+	  int64_t x;
+	  return read_svarint(r, &x) ? @(x) : nil;
+	}
+      return nil;
+
+    case KIND_DATA:
+      if (!read_varint(r, &n) || !read_bytes(r, n, &ptr))
+	return nil;
+      return [self _dataWithBytes:ptr length:n];
+
+    case KIND_BLOB:
+      return [self _decodeBlob:r];
+
+    case KIND_ARRAY:
+      if (!read_varint(r, &n))
+	return nil;
+      return [[self _decodeObjects:r count:n] copy];
+
+    case KIND_SET:
+      if (!read_varint(r, &n))
+	return nil;
+      return [NSSet setWithArray:[self _decodeObjects:r count:n]];
+
+    case KIND_DICTIONARY:
+      return [self _decodeDictionary:r];
+
+    case KIND_VALUE:
+      return [self _decodeValue:r];
+
+    case KIND_COLOR:
+      return CFBridgingRelease([self _copyColorWithReader:r]);
+
+    case KIND_NULL:
+      return [NSNull null];
+
+    default:
+      return nil;
+    }
+}
+
+- (id)_decodeKeyedRecord:(reader *)r index:(NSUInteger)idx
+{
+  uint64_t class_idx;
+  if (!read_varint(r, &class_idx) || class_idx >= [_strings count])
+    return nil;
+
+  Class cls = NSClassFromString(_strings[class_idx]);
+  if (cls == Nil || ![cls conformsToProtocol:@protocol(NSCoding)])
+    return nil;
+
+  field *saved_fields = _fields;
+  size_t saved_count = _fieldCount;
+
+  _fields = NULL;
+  _fieldCount = 0;
+
+  id obj = nil;
+
+  if ([self _readFields:r])
+    {
+      /* Make the object visible before initializing it, so that
+	 cycles resolve to it (as with NSKeyedUnarchiver). */
+
+      [_decoding removeIndex:idx];
+
+      obj = [cls alloc];
+      _objects[idx] = obj;
+
+      obj = [obj initWithCoder:self];
+      obj = [obj awakeAfterUsingCoder:self];
+
+      _objects[idx] = obj != nil ? obj : [NSNull null];
+    }
+
+  free(_fields);
+  _fields = saved_fields;
+  _fieldCount = saved_count;
+
+  return obj;
+}
+
+- (BOOL)containsValueForKey:(NSString *)key
+{
+  return [self _fieldForKey:key] != NULL;
+}
+
+- (id)decodeObjectForKey:(NSString *)key
+{
+  const field *f = [self _fieldForKey:key];
+  if (f == NULL || f->type != TYPE_OBJECT)
+    return nil;
+
+  reader r = [self _readerForField:f];
+  uint64_t ref;
+  if (!read_varint(&r, &ref))
+    return nil;
+
+  return [self _objectForRef:ref];
+}
+
+- (id)decodeObjectOfClass:(Class)cls forKey:(NSString *)key
+{
+  id obj = [self decodeObjectForKey:key];
+
+  return [obj isKindOfClass:cls] ? obj : nil;
+}
+
+- (id)decodeObjectOfClasses:(NSSet *)classes forKey:(NSString *)key
+{
+  id obj = [self decodeObjectForKey:key];
+
+  for (Class cls in classes)
+    {
+      if ([obj isKindOfClass:cls])
+	return obj;
+    }
+
+  return nil;
+}
+
+static bool
+field_int64(const field *f, const uint8_t *end, int64_t *x)
+{
+  reader r = {f->value, end};
+  uint8_t b;
+  double d;
+  float s;
+
+  switch (f->type)
+    {
+    case TYPE_INT:
+      return read_svarint(&r, x);
+    case TYPE_BOOL:
+      if (!read_u8(&r, &b))
+	return false;
+      *x = b != 0;
+      return true;
+    case TYPE_DOUBLE:
+      if (!read_f64(&r, &d))
+	return false;
+      *x = (int64_t)d;
+      return true;
+    case TYPE_FLOAT:
+      if (!read_f32(&r, &s))
+	return false;
+      *x = (int64_t)s;
+      return true;
+    default:
+      return false;
+    }
+}
+
+static bool
+field_double(const field *f, const uint8_t *end, double *x)
+{
+  reader r = {f->value, end};
+  float s;
+  int64_t i;
+
+  switch (f->type)
+    {
+    case TYPE_DOUBLE:
+      return read_f64(&r, x);
+    case TYPE_FLOAT:
+      if (!read_f32(&r, &s))
+	return false;
+      *x = s;
+      return true;
+    default:
+      if (!field_int64(f, end, &i))
+	return false;
+      *x = i;
+      return true;
+    }
+}
+
+- (int64_t)decodeInt64ForKey:(NSString *)key
+{
+  const field *f = [self _fieldForKey:key];
+  int64_t x;
+  return f != NULL && field_int64(f, _end, &x) ? x : 0;
+}
+
+- (BOOL)decodeBoolForKey:(NSString *)key
+{
+  return [self decodeInt64ForKey:key] != 0;
+}
+
+- (int)decodeIntForKey:(NSString *)key
+{
+  return (int)[self decodeInt64ForKey:key];
+}
+
+- (int32_t)decodeInt32ForKey:(NSString *)key
+{
+  return (int32_t)[self decodeInt64ForKey:key];
+}
+
+- (NSInteger)decodeIntegerForKey:(NSString *)key
+{
+  return (NSInteger)[self decodeInt64ForKey:key];
+}
+
+- (double)decodeDoubleForKey:(NSString *)key
+{
+  const field *f = [self _fieldForKey:key];
+  double x;
+  return f != NULL && field_double(f, _end, &x) ? x : 0;
+}
+
+- (float)decodeFloatForKey:(NSString *)key
+{
+  return [self decodeDoubleForKey:key];
+}
+
+- (const uint8_t *)decodeBytesForKey:(NSString *)key
+    returnedLength:(NSUInteger *)lenp
+{
+  const field *f = [self _fieldForKey:key];
+
+  reader r;
+  uint64_t n;
+  const uint8_t *ptr;
+
+  if (f != NULL && f->type == TYPE_BYTES)
+    {
+      r = [self _readerForField:f];
+      if (read_varint(&r, &n) && read_bytes(&r, n, &ptr))
+	{
+	  if (lenp != NULL)
+	    *lenp = n;
+	  return ptr;
+	}
+    }
+
+  if (lenp != NULL)
+    *lenp = 0;
+  return NULL;
+}
+
+/* Reads `n' doubles from field `key' if it has type `type'. */
+
+- (BOOL)_decodeFloats:(CGFloat *)v count:(size_t)n type:(uint8_t)type
+    forKey:(NSString *)key
+{
+  const field *f = [self _fieldForKey:key];
+  if (f == NULL || f->type != type)
+    return NO;
+
+  reader r = [self _readerForField:f];
+  return read_f64s(&r, n, v);
+}
+
+- (CGPoint)mg_decodeCGPointForKey:(NSString *)key
+{
+  CGPoint p;
+  if ([self _decodeFloats:&p.x count:2 type:TYPE_POINT forKey:key])
+    return p;
+  else
+    return CGPointZero;
+}
+
+- (CGSize)mg_decodeCGSizeForKey:(NSString *)key
+{
+  CGSize s;
+  if ([self _decodeFloats:&s.width count:2 type:TYPE_SIZE forKey:key])
+    return s;
+  else
+    return CGSizeZero;
+}
+
+- (CGRect)mg_decodeCGRectForKey:(NSString *)key
+{
+  CGRect r;
+  if ([self _decodeFloats:&r.origin.x count:4 type:TYPE_RECT forKey:key])
+    return r;
+  else
+    return CGRectNull;
+}
+
+- (CGAffineTransform)mg_decodeCGAffineTransformForKey:(NSString *)key
+{
+  CGAffineTransform m;
+  if ([self _decodeFloats:&m.a count:6 type:TYPE_TRANSFORM forKey:key])
+    return m;
+  else
+    return CGAffineTransformIdentity;
+}
+
+- (CGColorRef)mg_decodeCGColorForKey:(NSString *)key
+{
+  const field *f = [self _fieldForKey:key];
+  if (f == NULL || f->type != TYPE_COLOR)
+    return NULL;
+
+  reader r = [self _readerForField:f];
+  CGColorRef c = [self _copyColorWithReader:&r];
+
+  return c != NULL ? (CGColorRef)CFAutorelease(c) : NULL;
+}
+
+- (CGPathRef)mg_decodeCGPathForKey:(NSString *)key
+{
+  const field *f = [self _fieldForKey:key];
+  if (f == NULL || f->type != TYPE_PATH)
+    return NULL;
+
+  reader r = [self _readerForField:f];
+  uint64_t n;
+  const uint8_t *ptr;
+
+  if (!read_varint(&r, &n) || !read_bytes(&r, n, &ptr))
+    return NULL;
+
+  CGPathRef p = MgPathCreateWithBytes(ptr, n);
+
+  return p != NULL ? (CGPathRef)CFAutorelease(p) : NULL;
+}
+
+@end
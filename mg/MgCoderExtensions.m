@@ -24,6 +24,8 @@
 
 #import "MgCoderExtensions.h"
 
+#import "MgCoreGraphics.h"
+
 #import <Foundation/Foundation.h>
 #import <QuartzCore/QuartzCore.h>
 
@@ -64,7 +66,16 @@ struct mgColorComponents
 
 - (void)mg_encodeCGPath:(CGPathRef)p forKey:(NSString *)key
 {
-  /* FIXME: implement this. */
+  if (p == NULL)
+    return;
+
+  CFDataRef data = MgPathCreateData(p, true);
+
+  if (data != NULL)
+    {
+      [self encodeObject:(__bridge NSData *)data forKey:key];
+      CFRelease(data);
+    }
 }
 
 static BOOL
@@ -127,9 +138,13 @@ decodeType(NSCoder *c, NSString *key, const char *type, void *ptr)
 
 - (CGPathRef)mg_decodeCGPathForKey:(NSString *)key
 {
-  /* FIXME: implement this. */
+  NSData *data = [self decodeObjectOfClass:[NSData class] forKey:key];
+  if (data == nil)
+    return NULL;
+
+  CGPathRef p = MgPathCreateWithBytes([data bytes], [data length]);
 
-  return NULL;
+  return p != NULL ? (CGPathRef)CFAutorelease(p) : NULL;
 }
 
 @end
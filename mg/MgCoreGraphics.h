@@ -47,12 +47,42 @@ MG_EXTERN void MgRectGetCorners(CGRect r, CGPoint p[4]);
 MG_EXTERN CGPathRef MgPathCreateWithRoundRect(CGRect rect, CGFloat radius)
     CF_RETURNS_RETAINED;
 
+/* Compact serialized form of a path: a stream of element types packed
+   two per byte, followed by the points. Coordinates are stored as
+   deltas between successive points in 1/256 units when that loses
+   nothing (or when `lossless' is false), else as 32- or 64-bit floats,
+   whichever is exact. Decoding checks the whole buffer and returns
+   NULL if it isn't a valid path. */
+
+MG_EXTERN CFDataRef MgPathCreateData(CGPathRef path, bool lossless)
+    CF_RETURNS_RETAINED;
+MG_EXTERN CGPathRef MgPathCreateWithBytes(const void *ptr, size_t len)
+    CF_RETURNS_RETAINED;
+
 MG_EXTERN CGImageRef MgImageCreateByDrawing(size_t w, size_t, bool opaque,
     void (^block)(CGContextRef ctx)) CF_RETURNS_RETAINED;
 
+/* Renders the image in tiles, concurrently on `nthreads' threads.
+   `block' is called once for each tile, from the thread identified by
+   `thread', with a context whose CTM maps the whole image (origin at
+   the bottom-left) and whose clip is the tile's bounds. Tiles are
+   pixel-aligned and share a single backing store, so there are no
+   seams between them. */
+
+MG_EXTERN CGImageRef MgImageCreateByDrawingTiles(size_t w, size_t h,
+    bool opaque, size_t nthreads, void (^block)(CGContextRef ctx,
+    size_t thread)) CF_RETURNS_RETAINED;
+
 MG_EXTERN CFDataRef MgImageCreateData(CGImageRef im, CFStringRef type)
     CF_RETURNS_RETAINED;
 
+/* Encodes an array of images as an animation that loops forever,
+   showing each for `delay' seconds. `type' must be PNG (for an
+   animated PNG) or GIF. */
+
+MG_EXTERN CFDataRef MgImageSequenceCreateData(CFArrayRef images,
+    CFStringRef type, double delay) CF_RETURNS_RETAINED;
+
 MG_INLINE CGFloat MgFloatMix(CGFloat a, CGFloat b, double t) {
   return a + (b - a) * t;
 }
@@ -77,11 +107,38 @@ MG_INLINE CGSize MgSizeMix(CGSize a, CGSize b, double t) {
 
 MG_EXTERN CGRect MgRectMix(CGRect a, CGRect b, double t);
 
+/* Unpremultiplied sRGB color components (red, green, blue, alpha),
+   for working with colors without creating CGColor objects. */
+
+typedef float MgRGBA __attribute__((vector_size(16)));
+
+typedef NS_ENUM(NSInteger, MgColorMixMode)
+{
+  MgColorMixSRGB,		/* mix the sRGB components directly */
+  MgColorMixLinear,		/* mix in linear light */
+  MgColorMixOKLab,		/* mix in the OKLab perceptual space */
+};
+
+/* Doesn't allocate for sRGB or gray colors; other colors are converted
+   once and their components cached. */
+
+MG_EXTERN MgRGBA MgColorGetRGBA(CGColorRef c);
+
+/* May return a previously created color with the same components. */
+
+MG_EXTERN CGColorRef MgColorCreateWithRGBA(MgRGBA c) CF_RETURNS_RETAINED;
+
+MG_EXTERN MgRGBA MgRGBAMix(MgRGBA a, MgRGBA b, double t, MgColorMixMode mode);
+
 MG_EXTERN CGColorRef MgColorMix(CGColorRef a, CGColorRef b, double t)
     CF_RETURNS_RETAINED;
+MG_EXTERN CGColorRef MgColorMixWithMode(CGColorRef a, CGColorRef b,
+    double t, MgColorMixMode mode) CF_RETURNS_RETAINED;
 
 MG_EXTERN NSArray *MgFloatArrayMix(NSArray *a, NSArray *b, double t);
 
 MG_EXTERN NSArray *MgColorArrayMix(NSArray *a, NSArray *b, double t);
+MG_EXTERN NSArray *MgColorArrayMixWithMode(NSArray *a, NSArray *b, double t,
+    MgColorMixMode mode);
 
 MG_EXTERN_C_END
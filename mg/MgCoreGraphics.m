@@ -24,9 +24,13 @@
 
 #import "MgCoreGraphics.h"
 
+#import "MgFloatArray.h"
+
 #import <Foundation/Foundation.h>
 #import <ImageIO/ImageIO.h>
 #import <QuartzCore/QuartzCore.h>
+#import <libkern/OSAtomic.h>
+#import <libkern/OSByteOrder.h>
 
 #import "MgMacros.h"
 
@@ -91,6 +95,13 @@ MgContextSetLineDash(CGContextRef ctx, NSArray *pattern, CGFloat phase)
       return;
     }
 
+  if ([pattern isKindOfClass:[MgFloatArray class]])
+    {
+      CGContextSetLineDash(ctx, phase, ((MgFloatArray *)pattern).values,
+			   count);
+      return;
+    }
+
   CGFloat *vec = STACK_ALLOC(CGFloat, count);
   if (vec == NULL)
     return;
@@ -120,6 +131,12 @@ MgCreateGradient(NSArray *colors, NSArray *locations)
       grad = CGGradientCreateWithColors(MgSRGBColorSpace(),
 					(__bridge CFArrayRef)colors, NULL);
     }
+  else if ([locations isKindOfClass:[MgFloatArray class]])
+    {
+      grad = CGGradientCreateWithColors(MgSRGBColorSpace(),
+					(__bridge CFArrayRef)colors,
+					((MgFloatArray *)locations).values);
+    }
   else
     {
       CGFloat *vec = STACK_ALLOC(CGFloat, count);
@@ -175,6 +192,379 @@ MgPathCreateWithRoundRect(CGRect rect, CGFloat radius)
   return CGPathCreateWithRoundedRect(rect, radius, radius, NULL);
 }
 
+/** Path serialization. **/
+
+#define PATH_DATA_VERSION 1
+
+/* Fixed-point coordinates are in units of 1/PATH_QUANTUM. */
+
+#define PATH_QUANTUM 256
+
+enum
+{
+  PATH_COORDS_FIXED,		/* zigzag varint deltas */
+  PATH_COORDS_FLOAT,		/* f32 */
+  PATH_COORDS_DOUBLE,		/* f64 */
+};
+
+typedef struct path_elements path_elements;
+
+struct path_elements
+{
+  uint8_t *types;
+  size_t ntypes, types_size;
+  CGPoint *points;
+  size_t npoints, points_size;
+  bool failed;
+};
+
+static size_t
+path_element_point_count(int type)
+{
+  switch (type)
+    {
+    case kCGPathElementMoveToPoint:
+    case kCGPathElementAddLineToPoint:
+      return 1;
+    case kCGPathElementAddQuadCurveToPoint:
+      return 2;
+    case kCGPathElementAddCurveToPoint:
+      return 3;
+    default:
+      return 0;
+    }
+}
+
+static bool
+path_elements_reserve(void **ptr, size_t *size, size_t needed, size_t elt)
+{
+  if (needed <= *size)
+    return true;
+
+  size_t new_size = *size != 0 ? *size : 64;
+  while (new_size < needed)
+    new_size *= 2;
+
+  void *new_ptr = realloc(*ptr, new_size * elt);
+  if (new_ptr == NULL)
+    return false;
+
+  *ptr = new_ptr;
+  *size = new_size;
+  return true;
+}
+
+static void
+path_elements_apply(void *info, const CGPathElement *e)
+{
+  path_elements *pe = info;
+
+  if (pe->failed)
+    return;
+
+  size_t n = path_element_point_count(e->type);
+
+  if (!path_elements_reserve((void **)&pe->types, &pe->types_size,
+			     pe->ntypes + 1, sizeof(uint8_t))
+      || !path_elements_reserve((void **)&pe->points, &pe->points_size,
+				pe->npoints + n, sizeof(CGPoint)))
+    {
+      pe->failed = true;
+      return;
+    }
+
+  pe->types[pe->ntypes++] = (uint8_t)e->type;
+
+  for (size_t i = 0; i < n; i++)
+    pe->points[pe->npoints++] = e->points[i];
+}
+
+static bool
+path_fixed_coord(CGFloat x, int64_t *ret)
+{
+  double q = x * PATH_QUANTUM;
+
+  /* Also false for NaNs. */
+
+  if (!(fabs(q) < 0x1p52))
+    return false;
+
+  *ret = (int64_t)rint(q);
+  return true;
+}
+
+static uint8_t *
+path_write_varint(uint8_t *p, uint64_t x)
+{
+  while (x >= 0x80)
+    {
+      *p++ = (uint8_t)(x | 0x80);
+      x >>= 7;
+    }
+
+  *p++ = (uint8_t)x;
+  return p;
+}
+
+static bool
+path_read_varint(const uint8_t **pp, const uint8_t *end, uint64_t *ret)
+{
+  const uint8_t *p = *pp;
+  uint64_t x = 0;
+
+  for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (p == end)
+	return false;
+
+      uint8_t b = *p++;
+      x |= (uint64_t)(b & 0x7f) << shift;
+
+      if (!(b & 0x80))
+	{
+	  *pp = p;
+	  *ret = x;
+	  return true;
+	}
+    }
+
+  return false;
+}
+
+static int
+path_coords_mode(const path_elements *pe, bool lossless)
+{
+  bool fixed = true, single = lossless;
+
+  for (size_t i = 0; i < pe->npoints * 2 && (fixed || single); i++)
+    {
+      CGFloat x = ((const CGFloat *)pe->points)[i];
+      int64_t v;
+
+      if (fixed && (!path_fixed_coord(x, &v)
+		    || (lossless && v != x * PATH_QUANTUM)))
+	fixed = false;
+
+      if (single && (double)(float)x != x)
+	single = false;
+    }
+
+  return (fixed ? PATH_COORDS_FIXED
+	  : single ? PATH_COORDS_FLOAT : PATH_COORDS_DOUBLE);
+}
+
+CFDataRef
+MgPathCreateData(CGPathRef path, bool lossless)
+{
+  path_elements pe = {0};
+
+  CGPathApply(path, &pe, path_elements_apply);
+
+  if (pe.failed)
+    {
+      free(pe.types);
+      free(pe.points);
+      return NULL;
+    }
+
+  int mode = path_coords_mode(&pe, lossless);
+
+  /* Worst case is ten bytes per varint coordinate. */
+
+  size_t size = (2 + 10 + (pe.ntypes + 1) / 2
+		 + pe.npoints * 2 * (mode == PATH_COORDS_FIXED ? 10 : 8));
+
+  uint8_t *buf = malloc(size);
+  if (buf == NULL)
+    {
+      free(pe.types);
+      free(pe.points);
+      return NULL;
+    }
+
+  uint8_t *p = buf;
+
+  *p++ = PATH_DATA_VERSION;
+  *p++ = (uint8_t)mode;
+  p = path_write_varint(p, pe.ntypes);
+
+  for (size_t i = 0; i < pe.ntypes; i += 2)
+    {
+      uint8_t b = pe.types[i];
+      if (i + 1 < pe.ntypes)
+	b |= pe.types[i + 1] << 4;
+      *p++ = b;
+    }
+
+  const CGFloat *coords = (const CGFloat *)pe.points;
+  size_t ncoords = pe.npoints * 2;
+
+  int64_t last[2] = {0, 0};
+  union {float f; uint32_t u;} v32;
+  union {double f; uint64_t u;} v64;
+
+  switch (mode)
+    {
+    case PATH_COORDS_FIXED:
+      for (size_t i = 0; i < ncoords; i++)
+	{
+	  int64_t v;
+	  path_fixed_coord(coords[i], &v);
+	  int64_t d = v - last[i & 1];
+	  last[i & 1] = v;
+	  p = path_write_varint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+	}
+      break;
+
+    case PATH_COORDS_FLOAT:
+      for (size_t i = 0; i < ncoords; i++)
+	{
+	  v32.f = (float)coords[i];
+	  OSWriteLittleInt32(p, 0, v32.u);
+	  p += 4;
+	}
+      break;
+
+    case PATH_COORDS_DOUBLE:
+      for (size_t i = 0; i < ncoords; i++)
+	{
+	  v64.f = coords[i];
+	  OSWriteLittleInt64(p, 0, v64.u);
+	  p += 8;
+	}
+      break;
+    }
+
+  CFDataRef data = CFDataCreate(NULL, buf, p - buf);
+
+  free(buf);
+  free(pe.types);
+  free(pe.points);
+
+  return data;
+}
+
+static bool
+path_read_coord(const uint8_t **pp, const uint8_t *end, int mode,
+		int64_t *last, CGFloat *ret)
+{
+  const uint8_t *p = *pp;
+  uint64_t u;
+  union {uint32_t u; float f;} v32;
+  union {uint64_t u; double f;} v64;
+
+  switch (mode)
+    {
+    case PATH_COORDS_FIXED:
+      if (!path_read_varint(&p, end, &u))
+	return false;
+      *last = (int64_t)((uint64_t)*last + ((u >> 1) ^ -(u & 1)));
+      *ret = (CGFloat)*last / PATH_QUANTUM;
+      break;
+
+    case PATH_COORDS_FLOAT:
+      if (end - p < 4)
+	return false;
+      v32.u = OSReadLittleInt32(p, 0);
+      *ret = v32.f;
+      p += 4;
+      break;
+
+    case PATH_COORDS_DOUBLE:
+      if (end - p < 8)
+	return false;
+      v64.u = OSReadLittleInt64(p, 0);
+      *ret = v64.f;
+      p += 8;
+      break;
+
+    default:
+      return false;
+    }
+
+  if (!isfinite(*ret))
+    return false;
+
+  *pp = p;
+  return true;
+}
+
+CGPathRef
+MgPathCreateWithBytes(const void *ptr, size_t len)
+{
+  const uint8_t *p = ptr, *end = p + len;
+
+  if (len < 2 || p[0] != PATH_DATA_VERSION || p[1] > PATH_COORDS_DOUBLE)
+    return NULL;
+
+  int mode = p[1];
+  p += 2;
+
+  uint64_t count;
+  if (!path_read_varint(&p, end, &count) || count > (uint64_t)(end - p) * 2)
+    return NULL;
+
+  const uint8_t *types = p;
+  p += (count + 1) / 2;
+
+  CGMutablePathRef path = CGPathCreateMutable();
+
+  int64_t last[2] = {0, 0};
+  bool has_point = false;
+
+  for (uint64_t i = 0; i < count; i++)
+    {
+      int type = (types[i / 2] >> ((i & 1) * 4)) & 15;
+      if (type > kCGPathElementCloseSubpath)
+	goto fail;
+
+      /* Everything but a move needs a current point. */
+
+      if (type != kCGPathElementMoveToPoint && !has_point)
+	goto fail;
+
+      CGFloat c[6];
+      size_t n = path_element_point_count(type) * 2;
+
+      for (size_t j = 0; j < n; j++)
+	{
+	  if (!path_read_coord(&p, end, mode, &last[j & 1], &c[j]))
+	    goto fail;
+	}
+
+      switch (type)
+	{
+	case kCGPathElementMoveToPoint:
+	  CGPathMoveToPoint(path, NULL, c[0], c[1]);
+	  break;
+	case kCGPathElementAddLineToPoint:
+	  CGPathAddLineToPoint(path, NULL, c[0], c[1]);
+	  break;
+	case kCGPathElementAddQuadCurveToPoint:
+	  CGPathAddQuadCurveToPoint(path, NULL, c[0], c[1], c[2], c[3]);
+	  break;
+	case kCGPathElementAddCurveToPoint:
+	  CGPathAddCurveToPoint(path, NULL, c[0], c[1], c[2], c[3],
+				c[4], c[5]);
+	  break;
+	case kCGPathElementCloseSubpath:
+	  CGPathCloseSubpath(path);
+	  break;
+	}
+
+      has_point = true;
+    }
+
+  if (p != end)
+    goto fail;
+
+  return path;
+
+fail:
+  CGPathRelease(path);
+  return NULL;
+}
+
 CGImageRef
 MgImageCreateByDrawing(size_t w, size_t h, bool opaque,
 		       void (^block)(CGContextRef ctx))
@@ -195,6 +585,74 @@ MgImageCreateByDrawing(size_t w, size_t h, bool opaque,
   return im;
 }
 
+#define TILE_SIZE 512
+
+CGImageRef
+MgImageCreateByDrawingTiles(size_t w, size_t h, bool opaque,
+			    size_t nthreads, void (^block)(CGContextRef ctx,
+			    size_t thread))
+{
+  CGBitmapInfo info = (opaque ? kCGImageAlphaNoneSkipFirst
+		       : kCGImageAlphaPremultipliedFirst)
+		      | kCGBitmapByteOrder32Host;
+
+  CGContextRef ctx = CGBitmapContextCreate(NULL, w, h, 8, 0,
+				MgSRGBColorSpace(), info);
+  if (ctx == NULL)
+    return NULL;
+
+  uint8_t *data = CGBitmapContextGetData(ctx);
+  size_t stride = CGBitmapContextGetBytesPerRow(ctx);
+
+  size_t x_tiles = (w + TILE_SIZE - 1) / TILE_SIZE;
+  size_t y_tiles = (h + TILE_SIZE - 1) / TILE_SIZE;
+  size_t n_tiles = x_tiles * y_tiles;
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > n_tiles)
+    nthreads = n_tiles;
+
+  __block int32_t next_tile = 0;
+
+  dispatch_apply(nthreads, dispatch_get_global_queue(
+		  DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread)
+    {
+      while (1)
+	{
+	  size_t i = (size_t)OSAtomicIncrement32(&next_tile) - 1;
+	  if (i >= n_tiles)
+	    break;
+
+	  /* Tile coordinates with y down, i.e. in memory order. */
+
+	  size_t tx = (i % x_tiles) * TILE_SIZE;
+	  size_t ty = (i / x_tiles) * TILE_SIZE;
+	  size_t tw = MIN(TILE_SIZE, w - tx);
+	  size_t th = MIN(TILE_SIZE, h - ty);
+
+	  CGContextRef tile_ctx = CGBitmapContextCreate(data + ty * stride
+				+ tx * 4, tw, th, 8, stride,
+				MgSRGBColorSpace(), info);
+	  if (tile_ctx == NULL)
+	    continue;
+
+	  CGContextTranslateCTM(tile_ctx, -(CGFloat)tx,
+				-(CGFloat)(h - ty - th));
+
+	  block(tile_ctx, thread);
+
+	  CGContextRelease(tile_ctx);
+	}
+    });
+
+  CGImageRef im = CGBitmapContextCreateImage(ctx);
+
+  CGContextRelease(ctx);
+
+  return im;
+}
+
 CFDataRef
 MgImageCreateData(CGImageRef im, CFStringRef type)
 {
@@ -218,6 +676,67 @@ MgImageCreateData(CGImageRef im, CFStringRef type)
   return data;
 }
 
+CFDataRef
+MgImageSequenceCreateData(CFArrayRef images, CFStringRef type, double delay)
+{
+  CFStringRef dict_key, delay_key, loop_key;
+
+  if (CFEqual(type, CFSTR("public.png")))
+    {
+      dict_key = kCGImagePropertyPNGDictionary;
+      delay_key = kCGImagePropertyAPNGDelayTime;
+      loop_key = kCGImagePropertyAPNGLoopCount;
+    }
+  else if (CFEqual(type, CFSTR("com.compuserve.gif")))
+    {
+      dict_key = kCGImagePropertyGIFDictionary;
+      delay_key = kCGImagePropertyGIFDelayTime;
+      loop_key = kCGImagePropertyGIFLoopCount;
+    }
+  else
+    return NULL;
+
+  size_t count = CFArrayGetCount(images);
+
+  CFMutableDataRef data = CFDataCreateMutable(NULL, 0);
+  if (data == NULL)
+    return NULL;
+
+  CGImageDestinationRef dest
+    = CGImageDestinationCreateWithData(data, type, count, NULL);
+
+  if (dest == NULL)
+    {
+      CFRelease(data);
+      return NULL;
+    }
+
+  NSDictionary *file_props = @{(__bridge id)dict_key:
+			       @{(__bridge id)loop_key: @0}};
+  NSDictionary *frame_props = @{(__bridge id)dict_key:
+				@{(__bridge id)delay_key: @(delay)}};
+
+  CGImageDestinationSetProperties(dest, (__bridge CFDictionaryRef)file_props);
+
+  for (size_t i = 0; i < count; i++)
+    {
+      CGImageRef im = (CGImageRef)CFArrayGetValueAtIndex(images, i);
+      CGImageDestinationAddImage(dest, im,
+				 (__bridge CFDictionaryRef)frame_props);
+    }
+
+  bool ok = CGImageDestinationFinalize(dest);
+  CFRelease(dest);
+
+  if (!ok)
+    {
+      CFRelease(data);
+      return NULL;
+    }
+
+  return data;
+}
+
 CGRect
 MgRectMix(CGRect a, CGRect b, double t)
 {
@@ -239,12 +758,257 @@ MgRectMix(CGRect a, CGRect b, double t)
   return CGRectMake(c_x0, c_y0, c_x1 - c_x0, c_y1 - c_y0);
 }
 
+/* Small direct-mapped caches, one mapping non-sRGB colors to their
+   components, the other mapping components to sRGB colors. Each entry
+   holds a reference to its color, so a cached pointer can't be reused
+   by a different color. */
+
+#define COLOR_CACHE_SIZE 256
+
+typedef struct color_cache_entry color_cache_entry;
+
+struct color_cache_entry
+{
+  CGColorRef color;
+  MgRGBA rgba;
+};
+
+static color_cache_entry component_cache[COLOR_CACHE_SIZE];
+static color_cache_entry color_cache[COLOR_CACHE_SIZE];
+
+static id
+color_cache_lock(void)
+{
+  static id lock;
+  static dispatch_once_t once;
+
+  dispatch_once(&once, ^
+    {
+      lock = [[NSObject alloc] init];
+    });
+
+  return lock;
+}
+
+static size_t
+pointer_hash(const void *ptr)
+{
+  uintptr_t x = (uintptr_t)ptr;
+  return (x >> 4) ^ (x >> 12);
+}
+
+static size_t
+rgba_hash(MgRGBA c)
+{
+  uint32_t v[4];
+  memcpy(v, &c, sizeof(v));
+
+  uint32_t h = v[0];
+  for (size_t i = 1; i < 4; i++)
+    h = (h ^ v[i]) * 0x9e3779b1;
+
+  /* MurmurHash3 finalizer. */
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* Stores `color' (retained) in `entry', returning the color that was
+   there for the caller to release outside the lock. */
+
+static CGColorRef
+color_cache_set(color_cache_entry *entry, CGColorRef color, MgRGBA rgba)
+{
+  CGColorRef old = entry->color;
+  entry->color = CGColorRetain(color);
+  entry->rgba = rgba;
+  return old;
+}
+
+MgRGBA
+MgColorGetRGBA(CGColorRef c)
+{
+  CGColorSpaceRef space = CGColorGetColorSpace(c);
+  const CGFloat *v = CGColorGetComponents(c);
+
+  if (space == MgSRGBColorSpace())
+    return (MgRGBA){v[0], v[1], v[2], v[3]};
+
+  if (CGColorSpaceGetModel(space) == kCGColorSpaceModelMonochrome
+      && CGColorGetNumberOfComponents(c) == 2)
+    return (MgRGBA){v[0], v[0], v[0], v[1]};
+
+  color_cache_entry *entry
+    = &component_cache[pointer_hash(c) & (COLOR_CACHE_SIZE - 1)];
+
+  @synchronized (color_cache_lock())
+    {
+      if (entry->color == c)
+	return entry->rgba;
+    }
+
+  /* FIXME: will this do the right thing for non-sRGB colors..? */
+
+  CIColor *ci = [CIColor colorWithCGColor:c];
+  MgRGBA rgba = (MgRGBA){[ci red], [ci green], [ci blue], [ci alpha]};
+
+  CGColorRef old;
+  @synchronized (color_cache_lock())
+    {
+      old = color_cache_set(entry, c, rgba);
+    }
+
+  CGColorRelease(old);
+  return rgba;
+}
+
+CGColorRef
+MgColorCreateWithRGBA(MgRGBA c)
+{
+  color_cache_entry *entry
+    = &color_cache[rgba_hash(c) & (COLOR_CACHE_SIZE - 1)];
+
+  @synchronized (color_cache_lock())
+    {
+      if (entry->color != NULL && memcmp(&entry->rgba, &c, sizeof(c)) == 0)
+	return CGColorRetain(entry->color);
+    }
+
+  CGFloat vec[4] = {c[0], c[1], c[2], c[3]};
+  CGColorRef color = CGColorCreate(MgSRGBColorSpace(), vec);
+  if (color == NULL)
+    return NULL;
+
+  CGColorRef old;
+  @synchronized (color_cache_lock())
+    {
+      old = color_cache_set(entry, color, c);
+    }
+
+  CGColorRelease(old);
+  return color;
+}
+
+/* Transfer functions extended to negative values by symmetry, as for
+   extended sRGB. */
+
+static inline float
+srgb_to_linear(float x)
+{
+  float y = fabsf(x);
+  y = y <= .04045f ? y * (1 / 12.92f) : powf((y + .055f) * (1 / 1.055f), 2.4f);
+  return copysignf(y, x);
+}
+
+static inline float
+linear_to_srgb(float x)
+{
+  float y = fabsf(x);
+  y = y <= .0031308f ? y * 12.92f : 1.055f * powf(y, 1 / 2.4f) - .055f;
+  return copysignf(y, x);
+}
+
+static MgRGBA
+rgba_to_linear(MgRGBA c)
+{
+  return (MgRGBA){srgb_to_linear(c[0]), srgb_to_linear(c[1]),
+		  srgb_to_linear(c[2]), c[3]};
+}
+
+static MgRGBA
+linear_to_rgba(MgRGBA c)
+{
+  return (MgRGBA){linear_to_srgb(c[0]), linear_to_srgb(c[1]),
+		  linear_to_srgb(c[2]), c[3]};
+}
+
+/* OKLab conversions, from Björn Ottosson's reference implementation.
+   Inputs and outputs are linear sRGB; alpha passes through. */
+
+static MgRGBA
+linear_to_oklab(MgRGBA c)
+{
+  float l = .4122214708f * c[0] + .5363325363f * c[1] + .0514459929f * c[2];
+  float m = .2119034982f * c[0] + .6806995451f * c[1] + .1073969566f * c[2];
+  float s = .0883024619f * c[0] + .2817188376f * c[1] + .6299787005f * c[2];
+
+  l = cbrtf(l), m = cbrtf(m), s = cbrtf(s);
+
+  return (MgRGBA){.2104542553f * l + .7936177850f * m - .0040720468f * s,
+		  1.9779984951f * l - 2.4285922050f * m + .4505937099f * s,
+		  .0259040371f * l + .7827717662f * m - .8086757660f * s,
+		  c[3]};
+}
+
+static MgRGBA
+oklab_to_linear(MgRGBA c)
+{
+  float l = c[0] + .3963377774f * c[1] + .2158037573f * c[2];
+  float m = c[0] - .1055613458f * c[1] - .0638541728f * c[2];
+  float s = c[0] - .0894841775f * c[1] - 1.2914855480f * c[2];
+
+  l = l * l * l, m = m * m * m, s = s * s * s;
+
+  return (MgRGBA){4.0767416621f * l - 3.3077115913f * m + .2309699292f * s,
+		  -1.2684380046f * l + 2.6097574011f * m - .3413193965f * s,
+		  -.0041960863f * l - .7034186147f * m + 1.7076147010f * s,
+		  c[3]};
+}
+
+MgRGBA
+MgRGBAMix(MgRGBA a, MgRGBA b, double t, MgColorMixMode mode)
+{
+  float f = t;
+
+  if (f == 0)
+    return a;
+  else if (f == 1)
+    return b;
+
+  switch (mode)
+    {
+    case MgColorMixSRGB:
+    default:
+      return a + (b - a) * f;
+
+    case MgColorMixLinear:
+      a = rgba_to_linear(a);
+      b = rgba_to_linear(b);
+      return linear_to_rgba(a + (b - a) * f);
+
+    case MgColorMixOKLab:
+      a = linear_to_oklab(rgba_to_linear(a));
+      b = linear_to_oklab(rgba_to_linear(b));
+      return linear_to_rgba(oklab_to_linear(a + (b - a) * f));
+    }
+}
+
 CGColorRef
 MgColorMix(CGColorRef a, CGColorRef b, double t)
 {
+  return MgColorMixWithMode(a, b, t, MgColorMixSRGB);
+}
+
+CGColorRef
+MgColorMixWithMode(CGColorRef a, CGColorRef b, double t,
+		   MgColorMixMode mode)
+{
+  if (a == b || CGColorEqualToColor(a, b))
+    return CGColorRetain(a);
+
   CGColorSpaceRef space = CGColorGetColorSpace(a);
 
-  if (CGColorGetColorSpace(b) == space)
+  /* Colors sharing some other RGB space are mixed in that space, so
+     they don't lose anything by going through sRGB. */
+
+  if (mode == MgColorMixSRGB && CGColorGetColorSpace(b) == space
+      && space != MgSRGBColorSpace()
+      && CGColorSpaceGetModel(space) != kCGColorSpaceModelMonochrome)
     {
       size_t count = CGColorSpaceGetNumberOfComponents(space) + 1;
 
@@ -257,43 +1021,39 @@ MgColorMix(CGColorRef a, CGColorRef b, double t)
 
       return CGColorCreate(space, vc);
     }
-  else
-    {
-      /* FIXME: will this do the right thing for non-sRGB colors..? */
-
-      CIColor *ca = [CIColor colorWithCGColor:a];
-      CIColor *cb = [CIColor colorWithCGColor:b];
-
-      CGFloat vc[4];
-      vc[0] = MgFloatMix([ca red], [cb red], t);
-      vc[1] = MgFloatMix([ca green], [cb green], t);
-      vc[2] = MgFloatMix([ca blue], [cb blue], t);
-      vc[3] = MgFloatMix([ca alpha], [cb alpha], t);
 
-      return CGColorCreate(MgSRGBColorSpace(), vc);
-    }
+  MgRGBA c = MgRGBAMix(MgColorGetRGBA(a), MgColorGetRGBA(b), t, mode);
+  return MgColorCreateWithRGBA(c);
 }
 
 NSArray *
 MgFloatArrayMix(NSArray *a, NSArray *b, double t)
 {
+  if (a == b)
+    return a;
+
   size_t count = [a count];
   if (count == 0 || [b count] != count)
     return t < .5 ? a : b;
 
-  __unsafe_unretained id *a_values = STACK_ALLOC_ARC(id, count);
-  __unsafe_unretained id *b_values = STACK_ALLOC_ARC(id, count);
+  MgFloatArray *fa = [MgFloatArray floatArrayWithArray:a];
+  MgFloatArray *fb = [MgFloatArray floatArrayWithArray:b];
+  if (fa == nil || fb == nil)
+    return t < .5 ? a : b;
 
-  [a getObjects:a_values];
-  [b getObjects:b_values];
+  const CGFloat *a_values = fa.values;
+  const CGFloat *b_values = fb.values;
+
+  CGFloat *c_values = STACK_ALLOC(CGFloat, count);
+  if (c_values == NULL)
+    return t < .5 ? a : b;
 
   for (size_t i = 0; i < count; i++)
-    a_values[i] = @(MgFloatMix([a_values[i] doubleValue], [b_values[i] doubleValue], t));
+    c_values[i] = MgFloatMix(a_values[i], b_values[i], t);
 
-  NSArray *ret = [NSArray arrayWithObjects:a_values count:count];
+  MgFloatArray *ret = [MgFloatArray floatArrayWithValues:c_values count:count];
 
-  STACK_FREE(id, count, b_values);
-  STACK_FREE(id, count, a_values);
+  STACK_FREE(CGFloat, count, c_values);
 
   return ret;
 }
@@ -301,6 +1061,16 @@ MgFloatArrayMix(NSArray *a, NSArray *b, double t)
 NSArray *
 MgColorArrayMix(NSArray *a, NSArray *b, double t)
 {
+  return MgColorArrayMixWithMode(a, b, t, MgColorMixSRGB);
+}
+
+NSArray *
+MgColorArrayMixWithMode(NSArray *a, NSArray *b, double t,
+			MgColorMixMode mode)
+{
+  if (a == b)
+    return a;
+
   size_t count = [a count];
   if (count == 0 || [b count] != count)
     return t < .5 ? a : b;
@@ -313,10 +1083,14 @@ MgColorArrayMix(NSArray *a, NSArray *b, double t)
 
   NSMutableArray *ret = [NSMutableArray arrayWithCapacity:count];
 
+  /* Colors that don't change keep the same object (see MgColorMix),
+     so anything comparing the result can do so cheaply. */
+
   for (size_t i = 0; i < count; i++)
     {
-      CGColorRef c = MgColorMix((__bridge CGColorRef)a_values[i],
-				(__bridge CGColorRef)b_values[i], t);
+      CGColorRef c = MgColorMixWithMode((__bridge CGColorRef)a_values[i],
+					(__bridge CGColorRef)b_values[i],
+					t, mode);
       [ret addObject:CFBridgingRelease(c)];
     }
 
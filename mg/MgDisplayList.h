@@ -0,0 +1,114 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgLayerInternal.h"
+
+@class MgGradientRamp;
+
+/* A flat list of drawing commands, recorded while a group's contents
+   are drawn and replayed into a context in place of traversing its
+   sublayers again, for as long as they stay static. Commands retain
+   the objects they refer to, so replaying doesn't touch the graph.
+
+   Layers don't draw into the context directly, but through the
+   MgRender functions below. Each draws into `rs->ctx' and, if
+   `rs->list' is non-nil, also appends itself to that list. */
+
+@interface MgDisplayList : NSObject
+
+/* False if something was drawn that can't be recorded, e.g. by an
+   MgDrawingLayer, or the list grew too large. Invalid lists ignore
+   further commands and must not be replayed. */
+
+@property(nonatomic, readonly, getter=isValid) BOOL valid;
+
+- (void)invalidate;
+
+@property(nonatomic, readonly) size_t count;
+
+- (void)replayInContext:(CGContextRef)ctx;
+
+@end
+
+MG_EXTERN void MgRenderSaveGState(MgLayerRenderState *rs);
+MG_EXTERN void MgRenderRestoreGState(MgLayerRenderState *rs);
+MG_EXTERN void MgRenderConcatCTM(MgLayerRenderState *rs,
+    CGAffineTransform m);
+MG_EXTERN void MgRenderSetAlpha(MgLayerRenderState *rs, CGFloat alpha);
+MG_EXTERN void MgRenderSetBlendMode(MgLayerRenderState *rs,
+    CGBlendMode mode);
+MG_EXTERN void MgRenderSetInterpolationQuality(MgLayerRenderState *rs,
+    CGInterpolationQuality q);
+
+MG_EXTERN void MgRenderClipToRect(MgLayerRenderState *rs, CGRect r);
+
+/* Clips to the union of `p' and `p2', which may be null. */
+
+MG_EXTERN void MgRenderClipToPaths(MgLayerRenderState *rs, CGPathRef p,
+    CGPathRef p2);
+
+MG_EXTERN void MgRenderBeginTransparencyLayer(MgLayerRenderState *rs);
+MG_EXTERN void MgRenderEndTransparencyLayer(MgLayerRenderState *rs);
+
+MG_EXTERN void MgRenderSetFillColor(MgLayerRenderState *rs,
+    CGColorRef c);
+MG_EXTERN void MgRenderSetStrokeColor(MgLayerRenderState *rs,
+    CGColorRef c);
+MG_EXTERN void MgRenderSetLineWidth(MgLayerRenderState *rs, CGFloat w);
+MG_EXTERN void MgRenderSetLineCap(MgLayerRenderState *rs, CGLineCap cap);
+MG_EXTERN void MgRenderSetLineJoin(MgLayerRenderState *rs,
+    CGLineJoin join);
+MG_EXTERN void MgRenderSetMiterLimit(MgLayerRenderState *rs,
+    CGFloat limit);
+MG_EXTERN void MgRenderSetLineDash(MgLayerRenderState *rs,
+    NSArray *pattern, CGFloat phase);
+
+MG_EXTERN void MgRenderFillRect(MgLayerRenderState *rs, CGRect r);
+MG_EXTERN void MgRenderStrokeRect(MgLayerRenderState *rs, CGRect r,
+    CGFloat width);
+MG_EXTERN void MgRenderDrawPath(MgLayerRenderState *rs, CGPathRef p,
+    CGPathDrawingMode mode);
+MG_EXTERN void MgRenderDrawImage(MgLayerRenderState *rs, CGRect r,
+    CGImageRef im);
+
+/* Draws a linear gradient from `p0' to `p1' if `radial' is false,
+   else a radial gradient between the circles (`p0', `r0') and (`p1',
+   `r1'). Ramps are immutable, so the list can keep `ramp'. */
+
+MG_EXTERN void MgRenderDrawGradient(MgLayerRenderState *rs,
+    MgGradientRamp *ramp, bool radial, CGPoint p0, CGFloat r0,
+    CGPoint p1, CGFloat r1, CGGradientDrawingOptions options);
+
+/* Bracket the commands drawing a layer whose content lies within `r'
+   in the current user space. On replay they're skipped if `r' lies
+   outside the clip, as they would have been when traversing. */
+
+MG_EXTERN size_t MgRenderBeginBounds(MgLayerRenderState *rs, CGRect r);
+MG_EXTERN void MgRenderEndBounds(MgLayerRenderState *rs, size_t idx);
+
+/* Replays `list' into `rs->ctx', appending it to `rs->list'. */
+
+MG_EXTERN void MgRenderDisplayList(MgLayerRenderState *rs,
+    MgDisplayList *list);
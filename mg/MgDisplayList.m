@@ -0,0 +1,552 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgDisplayList.h"
+
+#import "MgCoreGraphics.h"
+#import "MgGradientRamp.h"
+
+#import <Foundation/Foundation.h>
+
+/* Lists with more commands than this are abandoned, traversing is
+   cheap relative to drawing that much anyway. */
+
+#define MAX_COMMANDS 100000
+
+enum
+{
+  OP_SAVE,
+  OP_RESTORE,
+  OP_CONCAT_CTM,
+  OP_SET_ALPHA,
+  OP_SET_BLEND_MODE,
+  OP_SET_INTERPOLATION_QUALITY,
+  OP_CLIP_TO_RECT,
+  OP_CLIP_TO_PATHS,
+  OP_BEGIN_TRANSPARENCY_LAYER,
+  OP_END_TRANSPARENCY_LAYER,
+  OP_SET_FILL_COLOR,
+  OP_SET_STROKE_COLOR,
+  OP_SET_LINE_WIDTH,
+  OP_SET_LINE_CAP,
+  OP_SET_LINE_JOIN,
+  OP_SET_MITER_LIMIT,
+  OP_SET_LINE_DASH,
+  OP_FILL_RECT,
+  OP_STROKE_RECT,
+  OP_DRAW_PATH,
+  OP_DRAW_IMAGE,
+  OP_DRAW_LINEAR_GRADIENT,
+  OP_DRAW_RADIAL_GRADIENT,
+  OP_BOUNDS,
+  OP_DISPLAY_LIST,
+};
+
+typedef struct dl_command dl_command;
+
+/* Objects are retained by the list's `_objects' array. */
+
+struct dl_command
+{
+  uint32_t op;
+  int32_t i;				/* enum values, skip counts */
+  CGFloat f;
+  void *obj;
+  void *obj2;
+  union
+    {
+      CGAffineTransform m;
+      CGRect r;
+      struct
+	{
+	  CGPoint p0, p1;
+	  CGFloat r0, r1;
+	} g;
+    } u;
+};
+
+@implementation MgDisplayList
+{
+  dl_command *_commands;
+  size_t _count;
+  size_t _capacity;
+  NSMutableArray *_objects;
+  BOOL _invalid;
+}
+
+- (id)init
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _objects = [[NSMutableArray alloc] init];
+
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_commands);
+}
+
+- (BOOL)isValid
+{
+  return !_invalid;
+}
+
+- (void)invalidate
+{
+  _invalid = YES;
+
+  free(_commands);
+  _commands = NULL;
+  _count = _capacity = 0;
+  [_objects removeAllObjects];
+}
+
+- (size_t)count
+{
+  return _count;
+}
+
+/* Returns a new zeroed command, or NULL if the state has no list or
+   the list is invalid. */
+
+static dl_command *
+append(MgLayerRenderState *rs, uint32_t op)
+{
+  MgDisplayList *self = rs->list;
+
+  if (self == nil || self->_invalid)
+    return NULL;
+
+  if (self->_count == MAX_COMMANDS)
+    {
+      [self invalidate];
+      return NULL;
+    }
+
+  if (self->_count == self->_capacity)
+    {
+      size_t capacity = MAX(self->_capacity * 2, 64);
+      dl_command *commands = realloc(self->_commands,
+				     capacity * sizeof(dl_command));
+      if (commands == NULL)
+	{
+	  [self invalidate];
+	  return NULL;
+	}
+
+      self->_commands = commands;
+      self->_capacity = capacity;
+    }
+
+  dl_command *c = &self->_commands[self->_count++];
+  memset(c, 0, sizeof(*c));
+  c->op = op;
+
+  return c;
+}
+
+static void
+execute(const dl_command *c, CGContextRef ctx)
+{
+  switch (c->op)
+    {
+    case OP_SAVE:
+      CGContextSaveGState(ctx);
+      break;
+    case OP_RESTORE:
+      CGContextRestoreGState(ctx);
+      break;
+    case OP_CONCAT_CTM:
+      CGContextConcatCTM(ctx, c->u.m);
+      break;
+    case OP_SET_ALPHA:
+      CGContextSetAlpha(ctx, c->f);
+      break;
+    case OP_SET_BLEND_MODE:
+      CGContextSetBlendMode(ctx, c->i);
+      break;
+    case OP_SET_INTERPOLATION_QUALITY:
+      CGContextSetInterpolationQuality(ctx, c->i);
+      break;
+    case OP_CLIP_TO_RECT:
+      CGContextClipToRect(ctx, c->u.r);
+      break;
+    case OP_CLIP_TO_PATHS:
+      CGContextBeginPath(ctx);
+      CGContextAddPath(ctx, c->obj);
+      if (c->obj2 != NULL)
+	CGContextAddPath(ctx, c->obj2);
+      CGContextClip(ctx);
+      break;
+    case OP_BEGIN_TRANSPARENCY_LAYER:
+      CGContextBeginTransparencyLayer(ctx, NULL);
+      break;
+    case OP_END_TRANSPARENCY_LAYER:
+      CGContextEndTransparencyLayer(ctx);
+      break;
+    case OP_SET_FILL_COLOR:
+      CGContextSetFillColorWithColor(ctx, c->obj);
+      break;
+    case OP_SET_STROKE_COLOR:
+      CGContextSetStrokeColorWithColor(ctx, c->obj);
+      break;
+    case OP_SET_LINE_WIDTH:
+      CGContextSetLineWidth(ctx, c->f);
+      break;
+    case OP_SET_LINE_CAP:
+      CGContextSetLineCap(ctx, c->i);
+      break;
+    case OP_SET_LINE_JOIN:
+      CGContextSetLineJoin(ctx, c->i);
+      break;
+    case OP_SET_MITER_LIMIT:
+      CGContextSetMiterLimit(ctx, c->f);
+      break;
+    case OP_SET_LINE_DASH:
+      MgContextSetLineDash(ctx, (__bridge NSArray *)c->obj, c->f);
+      break;
+    case OP_FILL_RECT:
+      CGContextFillRect(ctx, c->u.r);
+      break;
+    case OP_STROKE_RECT:
+      CGContextStrokeRectWithWidth(ctx, c->u.r, c->f);
+      break;
+    case OP_DRAW_PATH:
+      CGContextBeginPath(ctx);
+      CGContextAddPath(ctx, c->obj);
+      CGContextDrawPath(ctx, c->i);
+      break;
+    case OP_DRAW_IMAGE:
+      CGContextDrawImage(ctx, c->u.r, c->obj);
+      break;
+    case OP_DRAW_LINEAR_GRADIENT:
+      [(__bridge MgGradientRamp *)c->obj drawLinearInContext:ctx
+       startPoint:c->u.g.p0 endPoint:c->u.g.p1 options:c->i];
+      break;
+    case OP_DRAW_RADIAL_GRADIENT:
+      [(__bridge MgGradientRamp *)c->obj drawRadialInContext:ctx
+       startCenter:c->u.g.p0 radius:c->u.g.r0 endCenter:c->u.g.p1
+       radius:c->u.g.r1 options:c->i];
+      break;
+    case OP_BOUNDS:
+      break;
+    case OP_DISPLAY_LIST:
+      [(__bridge MgDisplayList *)c->obj replayInContext:ctx];
+      break;
+    }
+}
+
+- (void)replayInContext:(CGContextRef)ctx
+{
+  if (_invalid)
+    return;
+
+  const dl_command *commands = _commands;
+  size_t count = _count;
+
+  for (size_t i = 0; i < count; i++)
+    {
+      const dl_command *c = &commands[i];
+
+      if (c->op == OP_BOUNDS)
+	{
+	  if (!CGRectIntersectsRect(c->u.r, CGContextGetClipBoundingBox(ctx)))
+	    i += c->i;
+	}
+      else
+	execute(c, ctx);
+    }
+}
+
+/** Render functions. **/
+
+/* Each fills in a command and executes it, so what is drawn now is
+   exactly what replaying will draw. Returns the command to fill in:
+   appended to the list if recording, otherwise `tem'. */
+
+static dl_command *
+command(MgLayerRenderState *rs, uint32_t op, dl_command *tem)
+{
+  dl_command *c = append(rs, op);
+
+  if (c == NULL)
+    {
+      c = tem;
+      memset(c, 0, sizeof(*c));
+      c->op = op;
+    }
+
+  return c;
+}
+
+/* Returns `obj', retained by the list if `c' is part of it. */
+
+static void *
+keep(MgLayerRenderState *rs, dl_command *c, dl_command *tem, id obj)
+{
+  if (c != tem && obj != nil)
+    [rs->list->_objects addObject:obj];
+
+  return (__bridge void *)obj;
+}
+
+void
+MgRenderSaveGState(MgLayerRenderState *rs)
+{
+  dl_command tem, *c = command(rs, OP_SAVE, &tem);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderRestoreGState(MgLayerRenderState *rs)
+{
+  dl_command tem, *c = command(rs, OP_RESTORE, &tem);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderConcatCTM(MgLayerRenderState *rs, CGAffineTransform m)
+{
+  dl_command tem, *c = command(rs, OP_CONCAT_CTM, &tem);
+  c->u.m = m;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetAlpha(MgLayerRenderState *rs, CGFloat alpha)
+{
+  dl_command tem, *c = command(rs, OP_SET_ALPHA, &tem);
+  c->f = alpha;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetBlendMode(MgLayerRenderState *rs, CGBlendMode mode)
+{
+  dl_command tem, *c = command(rs, OP_SET_BLEND_MODE, &tem);
+  c->i = mode;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetInterpolationQuality(MgLayerRenderState *rs,
+				CGInterpolationQuality q)
+{
+  dl_command tem, *c = command(rs, OP_SET_INTERPOLATION_QUALITY, &tem);
+  c->i = q;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderClipToRect(MgLayerRenderState *rs, CGRect r)
+{
+  dl_command tem, *c = command(rs, OP_CLIP_TO_RECT, &tem);
+  c->u.r = r;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderClipToPaths(MgLayerRenderState *rs, CGPathRef p, CGPathRef p2)
+{
+  dl_command tem, *c = command(rs, OP_CLIP_TO_PATHS, &tem);
+  c->obj = keep(rs, c, &tem, (__bridge id)p);
+  c->obj2 = keep(rs, c, &tem, (__bridge id)p2);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderBeginTransparencyLayer(MgLayerRenderState *rs)
+{
+  dl_command tem, *c = command(rs, OP_BEGIN_TRANSPARENCY_LAYER, &tem);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderEndTransparencyLayer(MgLayerRenderState *rs)
+{
+  dl_command tem, *c = command(rs, OP_END_TRANSPARENCY_LAYER, &tem);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetFillColor(MgLayerRenderState *rs, CGColorRef col)
+{
+  dl_command tem, *c = command(rs, OP_SET_FILL_COLOR, &tem);
+  c->obj = keep(rs, c, &tem, (__bridge id)col);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetStrokeColor(MgLayerRenderState *rs, CGColorRef col)
+{
+  dl_command tem, *c = command(rs, OP_SET_STROKE_COLOR, &tem);
+  c->obj = keep(rs, c, &tem, (__bridge id)col);
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetLineWidth(MgLayerRenderState *rs, CGFloat w)
+{
+  dl_command tem, *c = command(rs, OP_SET_LINE_WIDTH, &tem);
+  c->f = w;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetLineCap(MgLayerRenderState *rs, CGLineCap cap)
+{
+  dl_command tem, *c = command(rs, OP_SET_LINE_CAP, &tem);
+  c->i = cap;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetLineJoin(MgLayerRenderState *rs, CGLineJoin join)
+{
+  dl_command tem, *c = command(rs, OP_SET_LINE_JOIN, &tem);
+  c->i = join;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetMiterLimit(MgLayerRenderState *rs, CGFloat limit)
+{
+  dl_command tem, *c = command(rs, OP_SET_MITER_LIMIT, &tem);
+  c->f = limit;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderSetLineDash(MgLayerRenderState *rs, NSArray *pattern,
+		    CGFloat phase)
+{
+  /* Layers' dash patterns are immutable copies, so can be kept. */
+
+  dl_command tem, *c = command(rs, OP_SET_LINE_DASH, &tem);
+  c->obj = keep(rs, c, &tem, pattern);
+  c->f = phase;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderFillRect(MgLayerRenderState *rs, CGRect r)
+{
+  dl_command tem, *c = command(rs, OP_FILL_RECT, &tem);
+  c->u.r = r;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderStrokeRect(MgLayerRenderState *rs, CGRect r, CGFloat width)
+{
+  dl_command tem, *c = command(rs, OP_STROKE_RECT, &tem);
+  c->u.r = r;
+  c->f = width;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderDrawPath(MgLayerRenderState *rs, CGPathRef p,
+		 CGPathDrawingMode mode)
+{
+  dl_command tem, *c = command(rs, OP_DRAW_PATH, &tem);
+  c->obj = keep(rs, c, &tem, (__bridge id)p);
+  c->i = mode;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderDrawImage(MgLayerRenderState *rs, CGRect r, CGImageRef im)
+{
+  dl_command tem, *c = command(rs, OP_DRAW_IMAGE, &tem);
+  c->obj = keep(rs, c, &tem, (__bridge id)im);
+  c->u.r = r;
+  execute(c, rs->ctx);
+}
+
+void
+MgRenderDrawGradient(MgLayerRenderState *rs, MgGradientRamp *ramp,
+		     bool radial, CGPoint p0, CGFloat r0, CGPoint p1,
+		     CGFloat r1, CGGradientDrawingOptions options)
+{
+  dl_command tem, *c = command(rs, !radial ? OP_DRAW_LINEAR_GRADIENT
+			       : OP_DRAW_RADIAL_GRADIENT, &tem);
+  c->obj = keep(rs, c, &tem, ramp);
+  c->i = options;
+  c->u.g.p0 = p0;
+  c->u.g.p1 = p1;
+  c->u.g.r0 = r0;
+  c->u.g.r1 = r1;
+  execute(c, rs->ctx);
+}
+
+size_t
+MgRenderBeginBounds(MgLayerRenderState *rs, CGRect r)
+{
+  dl_command *c = append(rs, OP_BOUNDS);
+  if (c == NULL)
+    return SIZE_MAX;
+
+  c->u.r = r;
+
+  return rs->list->_count - 1;
+}
+
+void
+MgRenderEndBounds(MgLayerRenderState *rs, size_t idx)
+{
+  MgDisplayList *self = rs->list;
+
+  /* The list may have been invalidated in between. */
+
+  if (idx == SIZE_MAX || self == nil || self->_invalid)
+    return;
+
+  self->_commands[idx].i = (int32_t)(self->_count - idx - 1);
+}
+
+void
+MgRenderDisplayList(MgLayerRenderState *rs, MgDisplayList *list)
+{
+  if (rs->list != nil)
+    {
+      if (list->_invalid)
+	[rs->list invalidate];
+      else
+	{
+	  dl_command *c = append(rs, OP_DISPLAY_LIST);
+	  if (c != NULL)
+	    c->obj = keep(rs, c, NULL, list);
+	}
+    }
+
+  [list replayInContext:rs->ctx];
+}
+
+@end
@@ -24,6 +24,7 @@
 
 #import "MgDrawingLayerInternal.h"
 
+#import "MgDisplayList.h"
 #import "MgDrawingCALayer.h"
 #import "MgLayerInternal.h"
 #import "MgNodeInternal.h"
@@ -82,10 +83,22 @@
 {
 }
 
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  /* Subclasses may draw anywhere. */
+
+  return CGRectInfinite;
+}
+
 - (void)_renderLayerWithState:(MgLayerRenderState *)rs
 {
   _rs = rs;
 
+  /* Arbitrary drawing can't be recorded. */
+
+  [rs->list invalidate];
+
   CGContextSaveGState(rs->ctx);
 
   [self drawWithState:(id)self];
@@ -99,6 +112,8 @@
 {
   _rs = rs;
 
+  [rs->list invalidate];
+
   float alpha = rs->alpha * self.alpha;
 
   if (alpha != 1)
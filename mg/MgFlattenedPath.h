@@ -0,0 +1,46 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgBase.h"
+
+/* A path approximated by polygons, for answering point containment
+   queries without going back to the curves each time. Each polygon is
+   split into chains of edges that are monotone in y, and the chains
+   are bucketed by the horizontal bands they cross, so a query only
+   looks at the chains that could cross a horizontal ray through the
+   point, and finds the crossing in each by binary search. */
+
+@interface MgFlattenedPath : NSObject
+
+/* Curves are approximated by line segments deviating from them by no
+   more than `tolerance'. Subpaths are implicitly closed. */
+
+- (id)initWithPath:(CGPathRef)path tolerance:(CGFloat)tolerance;
+
+@property(nonatomic, readonly) CGRect bounds;
+
+- (BOOL)containsPoint:(CGPoint)p evenOdd:(BOOL)flag;
+
+@end
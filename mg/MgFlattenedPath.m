@@ -0,0 +1,520 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgFlattenedPath.h"
+
+#import <Foundation/Foundation.h>
+
+/* Upper bounds on the number of line segments per curve, and on the
+   number of bands in the chain index. */
+
+#define MAX_CURVE_SEGMENTS 1024
+#define MAX_BANDS 4096
+
+typedef struct flatten_state flatten_state;
+
+struct flatten_state
+{
+  CGFloat tolerance;
+  CGPoint *points;
+  size_t npoints, points_size;
+  size_t *subpaths;			/* index of first point */
+  size_t nsubpaths, subpaths_size;
+  CGPoint current;
+  bool open;				/* current subpath takes lines */
+  bool failed;
+};
+
+/* A run of edges that are all going up or all going down. The points
+   are stored in increasing y order, the chain covers [y0, y1). */
+
+typedef struct path_chain path_chain;
+
+struct path_chain
+{
+  CGFloat y0, y1;
+  CGFloat x0, x1;
+  uint32_t start, count;
+  int32_t dir;
+};
+
+static bool
+reserve(void **ptr, size_t *size, size_t needed, size_t elt)
+{
+  if (needed <= *size)
+    return true;
+
+  size_t new_size = *size != 0 ? *size : 64;
+  while (new_size < needed)
+    new_size *= 2;
+
+  void *new_ptr = realloc(*ptr, new_size * elt);
+  if (new_ptr == NULL)
+    return false;
+
+  *ptr = new_ptr;
+  *size = new_size;
+  return true;
+}
+
+static void
+flatten_add_point(flatten_state *fs, CGPoint p)
+{
+  if (!reserve((void **)&fs->points, &fs->points_size,
+	       fs->npoints + 1, sizeof(CGPoint)))
+    {
+      fs->failed = true;
+      return;
+    }
+
+  fs->points[fs->npoints++] = p;
+  fs->current = p;
+}
+
+static void
+flatten_move_to(flatten_state *fs, CGPoint p)
+{
+  if (!reserve((void **)&fs->subpaths, &fs->subpaths_size,
+	       fs->nsubpaths + 1, sizeof(size_t)))
+    {
+      fs->failed = true;
+      return;
+    }
+
+  fs->subpaths[fs->nsubpaths++] = fs->npoints;
+  fs->open = true;
+
+  flatten_add_point(fs, p);
+}
+
+static void
+flatten_line_to(flatten_state *fs, CGPoint p)
+{
+  /* After a close, drawing continues from the start of the closed
+     subpath in a new subpath. */
+
+  if (!fs->open)
+    flatten_move_to(fs, fs->current);
+
+  flatten_add_point(fs, p);
+}
+
+/* Number of line segments needed to stay within tolerance of a curve
+   whose second differences have maximum length `m' (Wang's formula,
+   `k' is n(n-1)/8 for a curve of degree n). */
+
+static size_t
+curve_segments(CGFloat m, CGFloat k, CGFloat tolerance)
+{
+  double n = ceil(sqrt(k * m / tolerance));
+
+  if (!(n >= 1))
+    return 1;
+  else if (n > MAX_CURVE_SEGMENTS)
+    return MAX_CURVE_SEGMENTS;
+  else
+    return (size_t)n;
+}
+
+static void
+flatten_quad_to(flatten_state *fs, CGPoint c, CGPoint p)
+{
+  if (!fs->open)
+    flatten_move_to(fs, fs->current);
+
+  CGPoint p0 = fs->current;
+
+  CGFloat m = hypot(p0.x - 2*c.x + p.x, p0.y - 2*c.y + p.y);
+  size_t n = curve_segments(m, (CGFloat).25, fs->tolerance);
+
+  for (size_t i = 1; i < n; i++)
+    {
+      CGFloat t = (CGFloat)i / n, u = 1 - t;
+      CGFloat a = u*u, b = 2*u*t, d = t*t;
+      flatten_add_point(fs, CGPointMake(a*p0.x + b*c.x + d*p.x,
+					a*p0.y + b*c.y + d*p.y));
+    }
+
+  flatten_add_point(fs, p);
+}
+
+static void
+flatten_cubic_to(flatten_state *fs, CGPoint c1, CGPoint c2, CGPoint p)
+{
+  if (!fs->open)
+    flatten_move_to(fs, fs->current);
+
+  CGPoint p0 = fs->current;
+
+  CGFloat m = fmax(hypot(p0.x - 2*c1.x + c2.x, p0.y - 2*c1.y + c2.y),
+		   hypot(c1.x - 2*c2.x + p.x, c1.y - 2*c2.y + p.y));
+  size_t n = curve_segments(m, (CGFloat).75, fs->tolerance);
+
+  for (size_t i = 1; i < n; i++)
+    {
+      CGFloat t = (CGFloat)i / n, u = 1 - t;
+      CGFloat a = u*u*u, b = 3*u*u*t, d = 3*u*t*t, e = t*t*t;
+      flatten_add_point(fs, CGPointMake(a*p0.x + b*c1.x + d*c2.x + e*p.x,
+					a*p0.y + b*c1.y + d*c2.y + e*p.y));
+    }
+
+  flatten_add_point(fs, p);
+}
+
+static void
+flatten_close(flatten_state *fs)
+{
+  if (fs->open)
+    {
+      fs->current = fs->points[fs->subpaths[fs->nsubpaths - 1]];
+      fs->open = false;
+    }
+}
+
+static void
+flatten_apply(void *info, const CGPathElement *e)
+{
+  flatten_state *fs = info;
+
+  if (fs->failed)
+    return;
+
+  switch (e->type)
+    {
+    case kCGPathElementMoveToPoint:
+      flatten_move_to(fs, e->points[0]);
+      break;
+
+    case kCGPathElementAddLineToPoint:
+      flatten_line_to(fs, e->points[0]);
+      break;
+
+    case kCGPathElementAddQuadCurveToPoint:
+      flatten_quad_to(fs, e->points[0], e->points[1]);
+      break;
+
+    case kCGPathElementAddCurveToPoint:
+      flatten_cubic_to(fs, e->points[0], e->points[1], e->points[2]);
+      break;
+
+    case kCGPathElementCloseSubpath:
+      flatten_close(fs);
+      break;
+    }
+}
+
+@implementation MgFlattenedPath
+{
+  CGRect _bounds;
+  path_chain *_chains;
+  size_t _chainCount;
+  CGPoint *_chainPoints;
+  size_t _bandCount;
+  CGFloat _bandScale;
+  uint32_t *_bandStarts;		/* _bandCount + 1 entries */
+  uint32_t *_bandChains;
+}
+
+/* Appends a chain made from the `n' points at `p' (in path order) to
+   the receiver's chain arrays. */
+
+- (BOOL)_addChain:(const CGPoint *)p count:(size_t)n direction:(int)dir
+    chainsSize:(size_t *)chains_size pointsSize:(size_t *)points_size
+    pointCount:(size_t *)npoints
+{
+  if (n < 2)
+    return YES;
+
+  if (!reserve((void **)&_chains, chains_size,
+	       _chainCount + 1, sizeof(path_chain))
+      || !reserve((void **)&_chainPoints, points_size,
+		  *npoints + n, sizeof(CGPoint))
+      || *npoints + n > UINT32_MAX)
+    return NO;
+
+  path_chain *c = &_chains[_chainCount++];
+  CGPoint *q = _chainPoints + *npoints;
+
+  c->start = (uint32_t)*npoints;
+  c->count = (uint32_t)n;
+  c->dir = dir;
+  c->x0 = c->x1 = p[0].x;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      q[i] = dir > 0 ? p[i] : p[n - 1 - i];
+      c->x0 = fmin(c->x0, q[i].x);
+      c->x1 = fmax(c->x1, q[i].x);
+    }
+
+  c->y0 = q[0].y;
+  c->y1 = q[n - 1].y;
+
+  *npoints += n;
+  return YES;
+}
+
+- (BOOL)_buildChains:(const flatten_state *)fs
+{
+  size_t chains_size = 0, points_size = 0, npoints = 0;
+
+  /* Scratch buffer holding the chain being built, in path order. */
+
+  CGPoint *run = NULL;
+  size_t run_size = 0;
+
+  for (size_t i = 0; i < fs->nsubpaths; i++)
+    {
+      size_t start = fs->subpaths[i];
+      size_t end = i + 1 < fs->nsubpaths ? fs->subpaths[i + 1] : fs->npoints;
+      size_t n = end - start;
+
+      if (n < 2)
+	continue;
+
+      if (!reserve((void **)&run, &run_size, n + 1, sizeof(CGPoint)))
+	goto failed;
+
+      size_t run_count = 0;
+      int run_dir = 0;
+
+      /* Includes the implicit closing edge. Horizontal edges never
+	 cross the query ray, so they just end the current chain. */
+
+      for (size_t j = 0; j < n; j++)
+	{
+	  CGPoint a = fs->points[start + j];
+	  CGPoint b = fs->points[start + (j + 1) % n];
+
+	  int dir = b.y > a.y ? 1 : b.y < a.y ? -1 : 0;
+
+	  if (dir != run_dir || dir == 0)
+	    {
+	      if (![self _addChain:run count:run_count direction:run_dir
+		    chainsSize:&chains_size pointsSize:&points_size
+		    pointCount:&npoints])
+		goto failed;
+
+	      run_count = 0;
+	      run_dir = dir;
+
+	      if (dir == 0)
+		continue;
+
+	      run[run_count++] = a;
+	    }
+
+	  run[run_count++] = b;
+	}
+
+      if (![self _addChain:run count:run_count direction:run_dir
+	    chainsSize:&chains_size pointsSize:&points_size
+	    pointCount:&npoints])
+	goto failed;
+    }
+
+  free(run);
+  return YES;
+
+failed:
+  free(run);
+  return NO;
+}
+
+static size_t
+band_index(CGFloat y, CGFloat y0, CGFloat scale, size_t count)
+{
+  CGFloat b = (y - y0) * scale;
+
+  if (!(b > 0))
+    return 0;
+  else if (b >= count)
+    return count - 1;
+  else
+    return (size_t)b;
+}
+
+- (BOOL)_buildBands
+{
+  if (_chainCount == 0)
+    return YES;
+
+  CGFloat height = CGRectGetHeight(_bounds);
+
+  _bandCount = _chainCount < MAX_BANDS ? _chainCount : MAX_BANDS;
+  _bandScale = height > 0 ? _bandCount / height : 0;
+
+  _bandStarts = calloc(_bandCount + 1, sizeof(uint32_t));
+  if (_bandStarts == NULL)
+    return NO;
+
+  CGFloat y0 = _bounds.origin.y;
+  size_t total = 0;
+
+  for (size_t i = 0; i < _chainCount; i++)
+    {
+      const path_chain *c = &_chains[i];
+      size_t b0 = band_index(c->y0, y0, _bandScale, _bandCount);
+      size_t b1 = band_index(c->y1, y0, _bandScale, _bandCount);
+      for (size_t b = b0; b <= b1; b++)
+	_bandStarts[b + 1]++;
+      total += b1 - b0 + 1;
+    }
+
+  if (total > UINT32_MAX)
+    return NO;
+
+  for (size_t b = 0; b < _bandCount; b++)
+    _bandStarts[b + 1] += _bandStarts[b];
+
+  _bandChains = malloc(total * sizeof(uint32_t));
+  uint32_t *fill = malloc(_bandCount * sizeof(uint32_t));
+  if (_bandChains == NULL || fill == NULL)
+    {
+      free(fill);
+      return NO;
+    }
+
+  memcpy(fill, _bandStarts, _bandCount * sizeof(uint32_t));
+
+  for (size_t i = 0; i < _chainCount; i++)
+    {
+      const path_chain *c = &_chains[i];
+      size_t b0 = band_index(c->y0, y0, _bandScale, _bandCount);
+      size_t b1 = band_index(c->y1, y0, _bandScale, _bandCount);
+      for (size_t b = b0; b <= b1; b++)
+	_bandChains[fill[b]++] = (uint32_t)i;
+    }
+
+  free(fill);
+  return YES;
+}
+
+- (id)initWithPath:(CGPathRef)path tolerance:(CGFloat)tolerance
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  if (path == NULL || !(tolerance > 0))
+    return nil;
+
+  flatten_state fs = {0};
+  fs.tolerance = tolerance;
+
+  CGPathApply(path, &fs, flatten_apply);
+
+  BOOL ok = !fs.failed;
+
+  if (ok)
+    {
+      CGFloat x0 = HUGE_VAL, y0 = HUGE_VAL;
+      CGFloat x1 = -HUGE_VAL, y1 = -HUGE_VAL;
+
+      for (size_t i = 0; i < fs.npoints; i++)
+	{
+	  CGPoint p = fs.points[i];
+	  if (!isfinite(p.x) || !isfinite(p.y))
+	    {
+	      ok = NO;
+	      break;
+	    }
+	  x0 = fmin(x0, p.x), x1 = fmax(x1, p.x);
+	  y0 = fmin(y0, p.y), y1 = fmax(y1, p.y);
+	}
+
+      _bounds = (fs.npoints != 0 ? CGRectMake(x0, y0, x1 - x0, y1 - y0)
+		 : CGRectNull);
+    }
+
+  if (ok)
+    ok = [self _buildChains:&fs] && [self _buildBands];
+
+  free(fs.points);
+  free(fs.subpaths);
+
+  return ok ? self : nil;
+}
+
+- (void)dealloc
+{
+  free(_chains);
+  free(_chainPoints);
+  free(_bandStarts);
+  free(_bandChains);
+}
+
+- (CGRect)bounds
+{
+  return _bounds;
+}
+
+- (BOOL)containsPoint:(CGPoint)p evenOdd:(BOOL)flag
+{
+  if (_chainCount == 0
+      || !(p.y >= CGRectGetMinY(_bounds) && p.y < CGRectGetMaxY(_bounds))
+      || !(p.x < CGRectGetMaxX(_bounds)))
+    return NO;
+
+  size_t b = band_index(p.y, _bounds.origin.y, _bandScale, _bandCount);
+  int winding = 0;
+
+  for (uint32_t i = _bandStarts[b]; i < _bandStarts[b + 1]; i++)
+    {
+      const path_chain *c = &_chains[_bandChains[i]];
+
+      /* Counts crossings of the ray from `p' towards +x. */
+
+      if (!(p.y >= c->y0 && p.y < c->y1) || c->x1 <= p.x)
+	continue;
+
+      if (c->x0 > p.x)
+	{
+	  winding += c->dir;
+	  continue;
+	}
+
+      const CGPoint *q = _chainPoints + c->start;
+      uint32_t lo = 0, hi = c->count - 1;
+
+      while (hi - lo > 1)
+	{
+	  uint32_t mid = (lo + hi) / 2;
+	  if (q[mid].y <= p.y)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+
+      CGFloat x = q[lo].x + ((p.y - q[lo].y) * (q[hi].x - q[lo].x)
+			     / (q[hi].y - q[lo].y));
+      if (x > p.x)
+	winding += c->dir;
+    }
+
+  return flag ? (winding & 1) != 0 : winding != 0;
+}
+
+@end
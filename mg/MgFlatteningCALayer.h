@@ -27,7 +27,4 @@
 #import <QuartzCore/CALayer.h>
 
 @interface MgFlatteningCALayer : CALayer <MgViewLayer>
-
-@property(nonatomic) double currentTime;
-
 @end
@@ -24,26 +24,48 @@
 
 #import "MgFlatteningCALayer.h"
 
-#import "MgLayer.h"
+#import "MgLayerInternal.h"
 
+#import <CoreVideo/CoreVideo.h>
 #import <Foundation/Foundation.h>
 #import <QuartzCore/QuartzCore.h>
+#import <libkern/OSAtomic.h>
 
-#define LONG_TIME (3600*24*365*10)
+/* Context of a layer's display link, called on the link's thread. It
+   refers to the layer weakly, so the link doesn't keep it alive. */
+
+@interface MgFlatteningDisplayTarget : NSObject
+{
+@public
+  __weak MgFlatteningCALayer *_layer;
+  volatile int32_t _pending;		/* main queue block outstanding */
+}
+@end
+
+@interface MgFlatteningCALayer ()
+- (void)_displayRefreshed;
+@end
 
 @implementation MgFlatteningCALayer
 {
   MgLayer *_layer;
   __weak MgViewContext *_viewContext;
 
-  double _currentTime;
   NSInteger _lastVersion;
-  BOOL _addedAnimation;
 
-  __weak MgFlatteningCALayer *_modelLayer;
-}
+  /* Presentation time of the next draw, if scheduled, and the area
+     that was animating when last drawn. */
+
+  CFTimeInterval _drawTime;
+  CGRect _lastDamage;
 
-@synthesize currentTime = _currentTime;
+  /* Presentation time of the next redraw, infinite if none. The
+     display link runs only while one is scheduled. */
+
+  CFTimeInterval _redrawTime;
+  CVDisplayLinkRef _displayLink;
+  MgFlatteningDisplayTarget *_displayTarget;
+}
 
 + (id)defaultValueForKey:(NSString *)key
 {
@@ -55,14 +77,6 @@
     return [super defaultValueForKey:key];
 }
 
-+ (BOOL)needsDisplayForKey:(NSString *)key
-{
-  if ([key isEqualToString:@"currentTime"])
-    return YES;
-  else
-    return [super needsDisplayForKey:key];
-}
-
 - (id)initWithMgLayer:(MgLayer *)layer viewContext:(MgViewContext *)ctx
 {
   self = [super init];
@@ -72,6 +86,9 @@
   _layer = layer;
   _viewContext = ctx;
 
+  _lastDamage = CGRectNull;
+  _redrawTime = HUGE_VAL;
+
   return self;
 }
 
@@ -84,11 +101,21 @@
   _layer = layer->_layer;
   _lastVersion = layer->_lastVersion;
 
-  _modelLayer = layer;
+  _lastDamage = CGRectNull;
+  _redrawTime = HUGE_VAL;
 
   return self;
 }
 
+- (void)dealloc
+{
+  if (_displayLink != NULL)
+    {
+      CVDisplayLinkStop(_displayLink);
+      CVDisplayLinkRelease(_displayLink);
+    }
+}
+
 - (MgLayer *)layer
 {
   return _layer;
@@ -120,56 +147,141 @@
   self.bounds = _layer.bounds;
 }
 
-- (void)drawInContext:(CGContextRef)ctx
+/* Returns the area of the receiver whose pixels are being changed by
+   transitions at time `t'. */
+
+- (CGRect)_damageAtTime:(CFTimeInterval)t
 {
-  /* FIXME: -[CALayer modelLayer] seems to be broken for client-side
-     animation copies?
+  __block CGRect r = CGRectNull;
 
-     FIXME: and self.bounds seems to return CGRectZero, wtf!? */
+  [_layer withPresentationTime:t handler:^
+    {
+      r = [_layer _contentDamageAtTime:t];
+    }];
 
-  MgFlatteningCALayer *model = _modelLayer;
+  return r;
+}
 
-  CFTimeInterval now;
-  if (model == nil)
-    model = self;
+- (void)drawInContext:(CGContextRef)ctx
+{
+  CFTimeInterval now = _drawTime;
+  if (now == 0)
+    now = CACurrentMediaTime();
 
-  if (model == self)
-    now = [self convertTime:CACurrentMediaTime() fromLayer:nil];
-  else
-    now = self.currentTime;
+  _drawTime = 0;
+  _lastDamage = [self _damageAtTime:now];
 
-  MgLayer *layer = model->_layer;
+  CFTimeInterval start = CACurrentMediaTime();
 
-  CFTimeInterval next = [layer renderInContext:ctx scale:self.contentsScale
+  CFTimeInterval next = [_layer renderInContext:ctx scale:self.contentsScale
 			 presentationTime:now];
 
-  [model _updateCurrentTime:now nextTime:next];
+  [_viewContext viewLayer:self
+   didDrawWithDuration:CACurrentMediaTime() - start];
+
+  [self _scheduleRedrawAtTime:next];
 }
 
-- (void)_updateCurrentTime:(CFTimeInterval)t nextTime:(CFTimeInterval)tn
+static CVReturn
+display_link_callback(CVDisplayLinkRef link, const CVTimeStamp *now,
+		      const CVTimeStamp *output, CVOptionFlags flags,
+		      CVOptionFlags *flags_out, void *info)
 {
-  if (isfinite(tn))
+  MgFlatteningDisplayTarget *target
+    = (__bridge MgFlatteningDisplayTarget *)info;
+
+  /* At most one block is queued at a time, so that a busy main thread
+     doesn't get a backlog of refreshes. */
+
+  if (OSAtomicCompareAndSwap32(0, 1, &target->_pending))
     {
-      if (!_addedAnimation)
+      dispatch_async(dispatch_get_main_queue(), ^
 	{
-	  CABasicAnimation *anim = [CABasicAnimation animation];
-	  anim.keyPath = @"currentTime";
-	  anim.beginTime = t;
-	  anim.duration = LONG_TIME;
-	  anim.fromValue = @(t);
-	  anim.toValue = @(t + LONG_TIME);
-	  [self addAnimation:anim forKey:@"currentTime"];
-	  _addedAnimation = YES;
-	}
+	  target->_pending = 0;
+	  [target->_layer _displayRefreshed];
+	});
     }
-  else
+
+  return kCVReturnSuccess;
+}
+
+/* Arranges for the parts of the layer being changed by transitions to
+   be redrawn at the first display refresh at or after time `t'.
+   Nothing is scheduled, and the display link is stopped, while no
+   transitions are running. */
+
+- (void)_scheduleRedrawAtTime:(CFTimeInterval)t
+{
+  _redrawTime = t;
+
+  if (!isfinite(t))
+    {
+      if (_displayLink != NULL)
+	CVDisplayLinkStop(_displayLink);
+      return;
+    }
+
+  if (_displayLink == NULL)
     {
-      if (_addedAnimation)
+      if (CVDisplayLinkCreateWithActiveCGDisplays(&_displayLink)
+	  != kCVReturnSuccess)
 	{
-	  [self removeAnimationForKey:@"currentTime"];
-	  _addedAnimation = NO;
+	  _displayLink = NULL;
+	  return;
 	}
+
+      _displayTarget = [[MgFlatteningDisplayTarget alloc] init];
+      _displayTarget->_layer = self;
+
+      CVDisplayLinkSetOutputCallback(_displayLink, display_link_callback,
+				     (__bridge void *)_displayTarget);
+    }
+
+  if (!CVDisplayLinkIsRunning(_displayLink))
+    CVDisplayLinkStart(_displayLink);
+}
+
+- (void)_displayRefreshed
+{
+  if (!isfinite(_redrawTime))
+    {
+      /* Drawing didn't schedule another redraw. */
+
+      if (_displayLink != NULL)
+	CVDisplayLinkStop(_displayLink);
+      return;
     }
+
+  if (CACurrentMediaTime() < _redrawTime)
+    return;
+
+  _redrawTime = HUGE_VAL;
+
+  [self _redraw];
+}
+
+- (void)_redraw
+{
+  /* Redraw where the animating layers were when last drawn and where
+     they are now, drawing at exactly the time the damage was
+     computed for. */
+
+  CFTimeInterval now = CACurrentMediaTime();
+
+  CGRect r = CGRectUnion(_lastDamage, [self _damageAtTime:now]);
+
+  if (CGRectIsNull(r))
+    return;
+
+  _drawTime = now;
+
+  if (CGRectIsInfinite(r))
+    [self setNeedsDisplay];
+  else
+    [self setNeedsDisplayInRect:CGRectIntegral(r)];
 }
 
 @end
+
+@implementation MgFlatteningDisplayTarget
+@end
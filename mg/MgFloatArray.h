@@ -0,0 +1,50 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgBase.h"
+#import <Foundation/NSArray.h>
+
+/* An immutable array of numbers, stored unboxed. Being an NSArray (of
+   NSNumbers, created on demand) it can be passed anywhere the state
+   classes take arrays of numbers, e.g. through KVC, while drawing and
+   interpolation code reads the values directly. Arrays of up to eight
+   values need no storage outside the object itself. */
+
+@interface MgFloatArray : NSArray
+
+/* Returns `array' itself if it's already an MgFloatArray, otherwise a
+   new array of the doubleValue of each of its elements. Returns nil if
+   `array' is nil. */
+
++ (MgFloatArray *)floatArrayWithArray:(NSArray *)array;
+
++ (MgFloatArray *)floatArrayWithValues:(const CGFloat *)values
+    count:(size_t)count;
+
+- (id)initWithValues:(const CGFloat *)values count:(size_t)count;
+
+@property(nonatomic, readonly) const CGFloat *values NS_RETURNS_INNER_POINTER;
+
+@end
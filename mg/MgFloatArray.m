@@ -0,0 +1,185 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgFloatArray.h"
+
+#import <Foundation/Foundation.h>
+
+#import "MgMacros.h"
+
+#define INLINE_COUNT 8
+
+@implementation MgFloatArray
+{
+  size_t _count;
+  CGFloat *_values;
+  CGFloat _inlineValues[INLINE_COUNT];
+}
+
++ (MgFloatArray *)floatArrayWithArray:(NSArray *)array
+{
+  if (array == nil || [array isKindOfClass:[MgFloatArray class]])
+    return (MgFloatArray *)array;
+
+  size_t count = [array count];
+
+  CGFloat *vec = STACK_ALLOC(CGFloat, count);
+  if (count != 0 && vec == NULL)
+    return nil;
+
+  size_t i = 0;
+  for (id obj in array)
+    vec[i++] = [obj doubleValue];
+
+  MgFloatArray *ret = [[self alloc] initWithValues:vec count:count];
+
+  STACK_FREE(CGFloat, count, vec);
+
+  return ret;
+}
+
++ (MgFloatArray *)floatArrayWithValues:(const CGFloat *)values
+    count:(size_t)count
+{
+  return [[self alloc] initWithValues:values count:count];
+}
+
+- (id)initWithValues:(const CGFloat *)values count:(size_t)count
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  if (count <= INLINE_COUNT)
+    _values = _inlineValues;
+  else
+    {
+      _values = malloc(count * sizeof(CGFloat));
+      if (_values == NULL)
+	return nil;
+    }
+
+  if (count != 0 && values != _values)
+    memcpy(_values, values, count * sizeof(CGFloat));
+  _count = count;
+
+  return self;
+}
+
+- (id)init
+{
+  return [self initWithValues:NULL count:0];
+}
+
+- (id)initWithObjects:(const id [])objects count:(NSUInteger)count
+{
+  CGFloat *vec = count <= INLINE_COUNT ? _inlineValues
+		 : malloc(count * sizeof(CGFloat));
+  if (vec == NULL)
+    return nil;
+
+  for (NSUInteger i = 0; i < count; i++)
+    vec[i] = [objects[i] doubleValue];
+
+  self = [self initWithValues:vec count:count];
+
+  if (vec != _inlineValues)
+    free(vec);
+
+  return self;
+}
+
+- (void)dealloc
+{
+  if (_values != _inlineValues)
+    free(_values);
+}
+
+- (const CGFloat *)values
+{
+  return _values;
+}
+
+- (NSUInteger)count
+{
+  return _count;
+}
+
+- (id)objectAtIndex:(NSUInteger)idx
+{
+  if (idx >= _count)
+    {
+      [NSException raise:NSRangeException
+       format:@"MgFloatArray: index %lu beyond bounds [0 .. %lu)",
+       (unsigned long)idx, (unsigned long)_count];
+    }
+
+  return @(_values[idx]);
+}
+
+- (BOOL)isEqual:(id)obj
+{
+  if (obj == self)
+    return YES;
+
+  if (![obj isKindOfClass:[MgFloatArray class]])
+    return [super isEqual:obj];
+
+  MgFloatArray *other = obj;
+  if (other->_count != _count)
+    return NO;
+
+  for (size_t i = 0; i < _count; i++)
+    {
+      if (_values[i] != other->_values[i])
+	return NO;
+    }
+
+  return YES;
+}
+
+- (NSUInteger)hash
+{
+  return _count;
+}
+
+/** NSCopying methods. **/
+
+- (id)copyWithZone:(NSZone *)zone
+{
+  return self;
+}
+
+/** NSCoding methods. **/
+
+/* Archived as a plain array of numbers, so readers needn't know about
+   this class. */
+
+- (Class)classForCoder
+{
+  return [NSArray class];
+}
+
+@end
@@ -26,8 +26,10 @@
 
 #import "MgCoderExtensions.h"
 #import "MgCoreGraphics.h"
+#import "MgDisplayList.h"
 #import "MgGradientCALayer.h"
 #import "MgGradientLayerState.h"
+#import "MgGradientRamp.h"
 #import "MgLayerInternal.h"
 #import "MgNodeInternal.h"
 
@@ -37,8 +39,10 @@
 
 @implementation MgGradientLayer
 {
-  /* Cached. */
-  id _gradient;				/* CGGradientRef */
+  /* Cached. Checked against the current stops before drawing, so
+     needs no invalidation when the state changes, and is reused across
+     transition frames that don't change the colors or locations. */
+  MgGradientRamp *_ramp;
 }
 
 + (Class)stateClass
@@ -59,12 +63,6 @@
   return NO;
 }
 
-- (void)setState:(MgNodeState *)state
-{
-  _gradient = nil;
-  [super setState:state];
-}
-
 - (NSArray *)colors
 {
   return STATE.colors;
@@ -78,7 +76,6 @@
     {
       [self willChangeValueForKey:@"colors"];
       state.colors = [array copy];
-      _gradient = nil;
       [self incrementVersion];
       [self didChangeValueForKey:@"colors"];
     }
@@ -102,7 +99,6 @@
     {
       [self willChangeValueForKey:@"locations"];
       state.locations = [array copy];
-      _gradient = nil;
       [self incrementVersion];
       [self didChangeValueForKey:@"locations"];
     }
@@ -276,16 +272,32 @@
   return YES;
 }
 
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  /* Linear gradients fill an infinite strip, and extended radial
+     gradients fill the whole plane. Otherwise the shading is contained
+     in the convex hull of the two circles. */
+
+  if (!self.radial || self.drawsBeforeStart || self.drawsAfterEnd)
+    return CGRectInfinite;
+
+  CGPoint p0 = self.startPoint, p1 = self.endPoint;
+  CGFloat r0 = self.startRadius, r1 = self.endRadius;
+
+  return CGRectUnion(CGRectMake(p0.x - r0, p0.y - r0, r0 * 2, r0 * 2),
+		     CGRectMake(p1.x - r1, p1.y - r1, r1 * 2, r1 * 2));
+}
+
 - (void)_renderLayerWithState:(MgLayerRenderState *)rs
 {
-  if (_gradient == nil)
-    {
-      CGGradientRef g = MgCreateGradient(self.colors, self.locations);
-      _gradient = CFBridgingRelease(g);
-    }
+  NSArray *colors = self.colors;
+  NSArray *locations = self.locations;
 
-  CGGradientRef grad = (__bridge CGGradientRef)_gradient;
-  if (grad == NULL)
+  if (_ramp == nil || ![_ramp matchesColors:colors locations:locations])
+    _ramp = [[MgGradientRamp alloc] initWithColors:colors locations:locations];
+
+  if (_ramp == nil)
     return;
 
   CGGradientDrawingOptions options = 0;
@@ -294,17 +306,9 @@
   if (self.drawsAfterEnd)
     options |= kCGGradientDrawsAfterEndLocation;
 
-  if (!self.radial)
-    {
-      CGContextDrawLinearGradient(rs->ctx, grad, self.startPoint,
-				  self.endPoint, options);
-    }
-  else
-    {
-      CGContextDrawRadialGradient(rs->ctx, grad, self.startPoint,
-				  self.startRadius, self.endPoint,
-				  self.endRadius, options);
-    }
+  MgRenderDrawGradient(rs, _ramp, self.radial, self.startPoint,
+		       self.startRadius, self.endPoint, self.endRadius,
+		       options);
 }
 
 /* FIXME: implement _renderLayerMaskWithState: */
@@ -27,6 +27,7 @@
 #import "MgActiveTransition.h"
 #import "MgCoderExtensions.h"
 #import "MgCoreGraphics.h"
+#import "MgFloatArray.h"
 #import "MgNodeTransition.h"
 
 #import <Foundation/Foundation.h>
@@ -136,11 +137,14 @@
 {
   MgGradientLayerState *to = (MgGradientLayerState *)to_;
   double t_;
+  MgColorMixMode mode;
 
   [super applyTransition:trans atTime:t to:to];
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"colors"] : t;
-  _colors = MgColorArrayMix(self.colors, to.colors, t_);
+  mode = (trans != nil ? [trans colorMixModeForKey:@"colors"]
+	  : MgColorMixSRGB);
+  _colors = MgColorArrayMixWithMode(self.colors, to.colors, t_, mode);
   _defines.colors = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"locations"] : t;
@@ -203,7 +207,7 @@
 - (void)setLocations:(NSArray *)array
 {
   if (_defines.locations)
-    _locations = [array copy];
+    _locations = [MgFloatArray floatArrayWithArray:array];
   else
     SUPERSTATE.locations = array;
 }
@@ -322,7 +326,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgGradientLayerState *copy = [super graphCopy:map];
 
@@ -388,7 +392,8 @@
 
   if ([c containsValueForKey:@"locations"])
     {
-      _locations = [c decodeObjectOfClass:[NSArray class] forKey:@"locations"];
+      _locations = [MgFloatArray floatArrayWithArray:
+		    [c decodeObjectOfClass:[NSArray class] forKey:@"locations"]];
       _defines.locations = true;
     }
 
@@ -0,0 +1,53 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgBase.h"
+
+/* A gradient's color stops baked into a table of evenly spaced sRGB
+   colors, and drawn as a shading whose function reads from the table.
+   Unlike a CGGradient, a ramp can be checked cheaply against a new set
+   of stops, so callers only need to bake a new one when the colors or
+   locations actually change. */
+
+@interface MgGradientRamp : NSObject
+
+/* Returns nil if `colors' is empty. If `locations' is nil (or doesn't
+   match `colors'), the stops are spaced evenly from zero to one. */
+
+- (id)initWithColors:(NSArray *)colors locations:(NSArray *)locations;
+
+/* True if baking `colors' and `locations' would produce the same ramp
+   as the receiver. */
+
+- (BOOL)matchesColors:(NSArray *)colors locations:(NSArray *)locations;
+
+- (void)drawLinearInContext:(CGContextRef)ctx startPoint:(CGPoint)p0
+    endPoint:(CGPoint)p1 options:(CGGradientDrawingOptions)options;
+
+- (void)drawRadialInContext:(CGContextRef)ctx startCenter:(CGPoint)p0
+    radius:(CGFloat)r0 endCenter:(CGPoint)p1 radius:(CGFloat)r1
+    options:(CGGradientDrawingOptions)options;
+
+@end
@@ -0,0 +1,258 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgGradientRamp.h"
+
+#import "MgCoreGraphics.h"
+#import "MgFloatArray.h"
+
+#import <Foundation/Foundation.h>
+
+#import "MgMacros.h"
+
+/* Number of colors in the baked table. The shading function
+   interpolates between adjacent entries. */
+
+#define RAMP_SIZE 1024
+
+typedef struct ramp_stop ramp_stop;
+
+struct ramp_stop
+{
+  float location;
+  float rgba[4];
+};
+
+/* Fills `stops' with `count' stops, sorted by location. */
+
+static void
+get_stops(NSArray *colors, NSArray *locations, size_t count,
+	  ramp_stop *stops)
+{
+  if (locations != nil && [locations count] != count)
+    locations = nil;
+
+  MgFloatArray *loc = [MgFloatArray floatArrayWithArray:locations];
+
+  size_t i = 0;
+  for (id obj in colors)
+    {
+      ramp_stop s;
+
+      if (loc != nil)
+	s.location = CLAMP(loc.values[i], 0, 1);
+      else
+	s.location = count > 1 ? (float)i / (count - 1) : 0;
+
+      MgRGBA rgba = MgColorGetRGBA((__bridge CGColorRef)obj);
+      for (size_t k = 0; k < 4; k++)
+	s.rgba[k] = rgba[k];
+
+      /* Insertion sort, stable for equal locations. */
+
+      size_t j = i;
+      while (j > 0 && stops[j-1].location > s.location)
+	{
+	  stops[j] = stops[j-1];
+	  j--;
+	}
+      stops[j] = s;
+
+      if (++i == count)
+	break;
+    }
+}
+
+static void
+bake_ramp(const ramp_stop *stops, size_t count, float *ramp)
+{
+  size_t j = 0;
+
+  for (size_t i = 0; i < RAMP_SIZE; i++)
+    {
+      float x = i * (1.f / (RAMP_SIZE - 1));
+      float *out = ramp + i * 4;
+
+      while (j < count && stops[j].location < x)
+	j++;
+
+      if (j == 0 || j == count)
+	{
+	  const float *v = stops[j == 0 ? 0 : count - 1].rgba;
+	  for (size_t k = 0; k < 4; k++)
+	    out[k] = v[k];
+	}
+      else
+	{
+	  const ramp_stop *s0 = &stops[j-1], *s1 = &stops[j];
+	  float d = s1->location - s0->location;
+	  float f = d > 0 ? (x - s0->location) / d : 1;
+	  for (size_t k = 0; k < 4; k++)
+	    out[k] = s0->rgba[k] + (s1->rgba[k] - s0->rgba[k]) * f;
+	}
+    }
+}
+
+static void
+ramp_evaluate(void *info, const CGFloat *in, CGFloat *out)
+{
+  const float *ramp = info;
+
+  CGFloat x = CLAMP(in[0], 0, 1) * (RAMP_SIZE - 1);
+  size_t i = x < RAMP_SIZE - 2 ? (size_t)x : RAMP_SIZE - 2;
+  CGFloat f = x - i;
+
+  const float *a = ramp + i * 4, *b = a + 4;
+  for (size_t k = 0; k < 4; k++)
+    out[k] = a[k] + (b[k] - a[k]) * f;
+}
+
+static void
+ramp_release(void *info)
+{
+  free(info);
+}
+
+@implementation MgGradientRamp
+{
+  ramp_stop *_stops;
+  size_t _count;
+  id _function;				/* CGFunctionRef */
+
+  /* The arrays last matched, so unchanged stops are found without
+     looking at the colors again. */
+
+  NSArray *_colors;
+  NSArray *_locations;
+}
+
+- (id)initWithColors:(NSArray *)colors locations:(NSArray *)locations
+{
+  size_t count = [colors count];
+  if (count == 0)
+    return nil;
+
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _stops = malloc(count * sizeof(ramp_stop));
+  float *ramp = malloc(RAMP_SIZE * 4 * sizeof(float));
+
+  if (_stops == NULL || ramp == NULL)
+    {
+      free(ramp);
+      return nil;
+    }
+
+  _count = count;
+  get_stops(colors, locations, count, _stops);
+  bake_ramp(_stops, count, ramp);
+
+  static const CGFloat domain[2] = {0, 1};
+  static const CGFloat range[8] = {0, 1, 0, 1, 0, 1, 0, 1};
+  static const CGFunctionCallbacks callbacks = {0, ramp_evaluate, ramp_release};
+
+  CGFunctionRef fun = CGFunctionCreate(ramp, 1, domain, 4, range, &callbacks);
+  if (fun == NULL)
+    {
+      free(ramp);
+      return nil;
+    }
+
+  _function = CFBridgingRelease(fun);
+  _colors = colors;
+  _locations = locations;
+
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_stops);
+}
+
+- (BOOL)matchesColors:(NSArray *)colors locations:(NSArray *)locations
+{
+  if (colors == _colors && locations == _locations)
+    return YES;
+
+  size_t count = [colors count];
+  if (count != _count)
+    return NO;
+
+  ramp_stop *stops = STACK_ALLOC(ramp_stop, count);
+  if (stops == NULL)
+    return NO;
+
+  get_stops(colors, locations, count, stops);
+
+  /* Stops contain only floats, so there's no padding to compare. */
+
+  BOOL ret = memcmp(stops, _stops, count * sizeof(ramp_stop)) == 0;
+
+  STACK_FREE(ramp_stop, count, stops);
+
+  if (ret)
+    {
+      _colors = colors;
+      _locations = locations;
+    }
+
+  return ret;
+}
+
+- (void)drawLinearInContext:(CGContextRef)ctx startPoint:(CGPoint)p0
+    endPoint:(CGPoint)p1 options:(CGGradientDrawingOptions)options
+{
+  CGShadingRef sh = CGShadingCreateAxial(MgSRGBColorSpace(), p0, p1,
+    (__bridge CGFunctionRef)_function,
+    (options & kCGGradientDrawsBeforeStartLocation) != 0,
+    (options & kCGGradientDrawsAfterEndLocation) != 0);
+
+  if (sh != NULL)
+    {
+      CGContextDrawShading(ctx, sh);
+      CGShadingRelease(sh);
+    }
+}
+
+- (void)drawRadialInContext:(CGContextRef)ctx startCenter:(CGPoint)p0
+    radius:(CGFloat)r0 endCenter:(CGPoint)p1 radius:(CGFloat)r1
+    options:(CGGradientDrawingOptions)options
+{
+  CGShadingRef sh = CGShadingCreateRadial(MgSRGBColorSpace(), p0, r0, p1, r1,
+    (__bridge CGFunctionRef)_function,
+    (options & kCGGradientDrawsBeforeStartLocation) != 0,
+    (options & kCGGradientDrawsAfterEndLocation) != 0);
+
+  if (sh != NULL)
+    {
+      CGContextDrawShading(ctx, sh);
+      CGShadingRelease(sh);
+    }
+}
+
+@end
@@ -0,0 +1,54 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgBase.h"
+
+/* Maintains a copy of the graph rooted at a node, for use by readers
+   that can't share the live graph, e.g. rendering on a background
+   thread. Each call to -update makes a new copy of only those nodes
+   whose version has changed since the previous update, the copies of
+   unchanged subgraphs (including their states) are reused.
+
+   The copy belongs to the caller, who may modify it, e.g. to apply a
+   module state, but must stop using it before calling -update again,
+   as that may modify the previous copy's reused nodes. Any changes
+   made by the caller persist in reused nodes. */
+
+@interface MgGraphSnapshot : NSObject
+
+- (id)initWithRoot:(MgNode *)root;
+
+@property(nonatomic, strong, readonly) MgNode *root;
+
+/* Returns the updated copy of the root node. */
+
+- (MgNode *)update;
+
+/* Returns the copy made of `obj' (a node or a module state) by the
+   most recent update, or nil if it hasn't been copied. */
+
+- (id)copiedObject:(id)obj;
+
+@end
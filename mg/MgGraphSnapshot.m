@@ -0,0 +1,174 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgGraphSnapshot.h"
+
+#import "MgModuleState.h"
+#import "MgNodeInternal.h"
+
+#import <Foundation/Foundation.h>
+
+@interface MgGraphSnapshotMap : MgGraphCopyMap
+@property(nonatomic, weak) MgGraphSnapshot *snapshot;
+@end
+
+@interface MgGraphSnapshot ()
+- (id)_reusableCopyOfObject:(id)obj;
+- (void)_didCopyObject:(id)obj toObject:(id)copy;
+@end
+
+@implementation MgGraphSnapshot
+{
+  MgNode *_root;
+  MgGraphCopyMap *_map;
+  NSMapTable *_nodes;			/* MgNode -> copy */
+  NSMapTable *_versions;		/* MgNode -> NSNumber */
+  NSMapTable *_moduleStates;		/* MgModuleState -> copy */
+}
+
+- (id)initWithRoot:(MgNode *)root
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _root = root;
+
+  /* Weak keys, so removed nodes don't keep their copies alive. */
+
+  _nodes = [NSMapTable weakToStrongObjectsMapTable];
+  _versions = [NSMapTable weakToStrongObjectsMapTable];
+  _moduleStates = [NSMapTable weakToStrongObjectsMapTable];
+
+  return self;
+}
+
+/* Node states refer to module states, so copies of unchanged nodes are
+   only valid while the copies of the module states they refer to are.
+   Module states aren't versioned, so compare them with their copies
+   directly, and start over if any have changed. */
+
+- (BOOL)_moduleStatesAreValid
+{
+  for (MgModuleState *state in _moduleStates)
+    {
+      MgModuleState *copy = [_moduleStates objectForKey:state];
+      if (copy == nil)
+	continue;
+
+      NSString *name = state.name;
+      if (name != copy.name && ![name isEqualToString:copy.name])
+	return NO;
+
+      MgModuleState *super_state = state.superstate;
+      if (super_state != nil)
+	{
+	  if ([_moduleStates objectForKey:super_state] != copy.superstate)
+	    return NO;
+	}
+      else if (copy.superstate != nil)
+	return NO;
+    }
+
+  return YES;
+}
+
+- (MgNode *)update
+{
+  if (![self _moduleStatesAreValid])
+    {
+      [_nodes removeAllObjects];
+      [_versions removeAllObjects];
+      [_moduleStates removeAllObjects];
+    }
+
+  MgGraphSnapshotMap *map = [MgGraphSnapshotMap map];
+  map.snapshot = self;
+
+  MgNode *copy = [_root mg_graphCopy:map];
+
+  _map = map;
+
+  return copy;
+}
+
+- (id)copiedObject:(id)obj
+{
+  id copy = [_map objectForKey:obj];
+
+  if (copy == nil && [obj isKindOfClass:[MgModuleState class]])
+    copy = [_moduleStates objectForKey:obj];
+
+  if (copy == (__bridge id)kCFNull)
+    copy = nil;
+
+  return copy;
+}
+
+- (id)_reusableCopyOfObject:(id)obj
+{
+  if ([obj isKindOfClass:[MgNode class]])
+    {
+      NSNumber *version = [_versions objectForKey:obj];
+
+      if (version != nil
+	  && [version unsignedIntegerValue] == ((MgNode *)obj).version)
+	{
+	  return [_nodes objectForKey:obj];
+	}
+    }
+  else if ([obj isKindOfClass:[MgModuleState class]])
+    return [_moduleStates objectForKey:obj];
+
+  return nil;
+}
+
+- (void)_didCopyObject:(id)obj toObject:(id)copy
+{
+  if ([obj isKindOfClass:[MgNode class]])
+    {
+      ((MgNode *)copy).profileIdentity = ((MgNode *)obj).profileIdentity;
+      [_nodes setObject:copy forKey:obj];
+      [_versions setObject:@(((MgNode *)obj).version) forKey:obj];
+    }
+  else if ([obj isKindOfClass:[MgModuleState class]])
+    [_moduleStates setObject:copy forKey:obj];
+}
+
+@end
+
+@implementation MgGraphSnapshotMap
+
+- (id)reusableCopyOfObject:(id)obj
+{
+  return [_snapshot _reusableCopyOfObject:obj];
+}
+
+- (void)didCopyObject:(id)obj toObject:(id)copy
+{
+  [_snapshot _didCopyObject:obj toObject:copy];
+}
+
+@end
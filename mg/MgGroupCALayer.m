@@ -50,7 +50,7 @@ layoutSublayers(CALayer *self, MgGroupLayer *layer, MgViewContext *ctx)
 	}];
 
   if (new_sublayers != old_sublayers)
-    self.sublayers = new_sublayers;
+    [ctx setSublayers:new_sublayers ofViewLayer:self];
 
   for (CALayer<MgViewLayer> *layer in new_sublayers)
     [layer update];
@@ -24,6 +24,13 @@
 
 #import "MgLayer.h"
 
+typedef NS_ENUM(NSInteger, MgRasterizationMode)
+{
+  MgRasterizationAutomatic,	/* cache once contents stop changing */
+  MgRasterizationAlways,	/* as above, but never evicted */
+  MgRasterizationNever,
+};
+
 @interface MgGroupLayer : MgLayer
 
 /* When true the layer pre-composites all its content into a buffer,
@@ -44,6 +51,26 @@
 
 @property(nonatomic, copy) NSArray *sublayers;
 
+/* Controls whether the composited contents of the group may be cached
+   as a bitmap when rendering via CoreGraphics, so that redrawing the
+   group when only its own transform, alpha or blend mode have changed
+   does not need to redraw its sublayers. The cache is keyed on the
+   sublayers' versions and the device scale factor, and is only created
+   once the group has been drawn twice with unchanged, non-animating
+   contents. It isn't used while the group is drawn rotated or skewed,
+   as the bitmap would need to be resampled. MgRasterizationAlways pins
+   the cached bitmap in memory. This is not a state property. Defaults
+   to MgRasterizationAutomatic. */
+
+@property(nonatomic, assign) MgRasterizationMode rasterizationMode;
+
+/* The maximum total size in bytes of the bitmaps cached by all
+   groups. When exceeded the least recently used bitmaps that aren't
+   pinned are discarded. Defaults to 64MB. */
+
++ (size_t)rasterizationCacheLimit;
++ (void)setRasterizationCacheLimit:(size_t)size;
+
 - (void)addSublayer:(MgLayer *)node;
 - (void)removeSublayer:(MgLayer *)node;
 
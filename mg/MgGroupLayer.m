@@ -25,6 +25,8 @@
 #import "MgGroupLayer.h"
 
 #import "MgCoderExtensions.h"
+#import "MgCoreGraphics.h"
+#import "MgDisplayList.h"
 #import "MgGroupCALayer.h"
 #import "MgGroupLayerState.h"
 #import "MgLayerInternal.h"
@@ -34,9 +36,67 @@
 
 #define STATE ((MgGroupLayerState *)(self.state))
 
+#define RASTER_MAX_SIZE 4096
+
+/* All groups that have a cached bitmap. The cache ivars of every group
+   are protected by locking this table, as evicting an entry modifies
+   a group other than the one being drawn, possibly while the other
+   group is being drawn on a different thread. */
+
+static NSHashTable *raster_groups;
+
+static size_t raster_cache_size;
+static size_t raster_cache_limit = 64 * 1024 * 1024;
+static uint64_t raster_cache_clock;
+
+static void evict_rasters(MgGroupLayer *keep);
+
 @implementation MgGroupLayer
 {
   NSMutableArray *_sublayers;
+  NSUInteger _sublayersVersion;
+  MgRasterizationMode _rasterizationMode;
+
+  /* Cached bitmap, guarded by raster_groups. */
+
+  id _rasterImage;			/* CGImageRef */
+  CGRect _rasterRect;
+  size_t _rasterBytes;
+  CGFloat _rasterScale;
+  NSUInteger _rasterVersion;
+  uint64_t _rasterLastUse;
+
+  /* Content version and scale of the last static uncached draw. */
+
+  NSUInteger _rasterCandidateVersion;
+  CGFloat _rasterCandidateScale;
+
+  /* Recorded drawing of the sublayers, guarded by self. Pass-through
+     groups draw with their parent's alpha, so it's part of the key. */
+
+  MgDisplayList *_displayList;
+  NSUInteger _displayListVersion;
+  float _displayListAlpha;
+  NSUInteger _displayListCandidateVersion;
+  NSUInteger _displayListFailedVersion;
+}
+
++ (void)initialize
+{
+  static dispatch_once_t once;
+
+  dispatch_once(&once, ^
+    {
+      raster_groups = [NSHashTable weakObjectsHashTable];
+    });
+}
+
+- (void)dealloc
+{
+  @synchronized (raster_groups)
+    {
+      raster_cache_size -= _rasterBytes;
+    }
 }
 
 + (Class)stateClass
@@ -128,10 +188,49 @@
 	[node addReference:self];
 
       [self incrementVersion];
+      _sublayersVersion = self.version;
       [self didChangeValueForKey:@"sublayers"];
     }
 }
 
+- (MgRasterizationMode)rasterizationMode
+{
+  return _rasterizationMode;
+}
+
+- (void)setRasterizationMode:(MgRasterizationMode)mode
+{
+  if (_rasterizationMode != mode)
+    {
+      _rasterizationMode = mode;
+
+      if (mode == MgRasterizationNever)
+	{
+	  @synchronized (raster_groups)
+	    {
+	      [self _discardRaster];
+	    }
+	}
+    }
+}
+
++ (size_t)rasterizationCacheLimit
+{
+  @synchronized (raster_groups)
+    {
+      return raster_cache_limit;
+    }
+}
+
++ (void)setRasterizationCacheLimit:(size_t)size
+{
+  @synchronized (raster_groups)
+    {
+      raster_cache_limit = size;
+      evict_rasters(NULL);
+    }
+}
+
 - (void)addSublayer:(MgLayer *)node
 {
   [self insertSublayer:node atIndex:NSIntegerMax];
@@ -163,6 +262,7 @@
   [node addReference:self];
 
   [self incrementVersion];
+  _sublayersVersion = self.version;
   [self didChangeValueForKey:@"sublayers"];
 }
 
@@ -176,6 +276,7 @@
       [_sublayers removeObjectAtIndex:idx];
 
       [self incrementVersion];
+      _sublayersVersion = self.version;
       [self didChangeValueForKey:@"sublayers"];
     }
 }
@@ -217,6 +318,218 @@
 
 /** Rendering. **/
 
+- (NSUInteger)_contentVersion
+{
+  NSUInteger version = _sublayersVersion;
+
+  for (MgLayer *node in _sublayers)
+    version = MAX(version, node.version);
+
+  return version;
+}
+
+/* Called with raster_groups locked. */
+
+- (void)_discardRaster
+{
+  if (_rasterImage != nil)
+    {
+      _rasterImage = nil;
+      raster_cache_size -= _rasterBytes;
+      _rasterBytes = 0;
+      [raster_groups removeObject:self];
+    }
+}
+
+/* Discards least recently used bitmaps until the cache fits in its
+   limit, never discarding pinned bitmaps or `keep'. Called with
+   raster_groups locked. */
+
+static void
+evict_rasters(MgGroupLayer *keep)
+{
+  while (raster_cache_size > raster_cache_limit)
+    {
+      MgGroupLayer *oldest = nil;
+
+      for (MgGroupLayer *group in raster_groups)
+	{
+	  if (group == keep
+	      || group->_rasterizationMode == MgRasterizationAlways)
+	    continue;
+	  if (oldest == nil || group->_rasterLastUse < oldest->_rasterLastUse)
+	    oldest = group;
+	}
+
+      if (oldest == nil)
+	break;
+
+      [oldest _discardRaster];
+    }
+}
+
+/* Returns the scale factor from user space to device pixels, or zero
+   if user space is rotated, skewed or non-uniformly scaled, when a
+   cached bitmap would have to be resampled to draw it. */
+
+static CGFloat
+context_raster_scale(CGContextRef ctx)
+{
+  CGAffineTransform m = CGContextGetUserSpaceToDeviceSpaceTransform(ctx);
+
+  if (m.b != 0 || m.c != 0 || fabs(m.a) != fabs(m.d))
+    return 0;
+
+  return fabs(m.a);
+}
+
+/* Draws the sublayers into a new bitmap covering their bounds at
+   `scale', caching it if the contents turn out to be static. Returns
+   the image and its rect in the receiver's coordinate space, or NULL
+   if the contents are unsuitable for caching. Merges the sublayers'
+   next presentation time into `rs->next_time'. */
+
+- (CGImageRef)_copyRasterWithState:(MgLayerRenderState *)rs
+    scale:(CGFloat)scale version:(NSUInteger)version rect:(CGRect *)rect
+    CF_RETURNS_RETAINED
+{
+  /* Only the sublayers need to be static, the receiver's own
+     transform, alpha and mask may animate, that's what the cache is
+     for. So skip -_contentBoundsAtTime:, which includes the
+     receiver's own transition. */
+
+  bool animated = false;
+  CGRect bounds = [self _computeContentBoundsAtTime:rs->time
+		   animated:&animated];
+
+  if (animated || CGRectIsNull(bounds) || CGRectIsInfinite(bounds)
+      || CGRectIsEmpty(bounds))
+    return NULL;
+
+  /* Snap the bitmap to whole pixels at `scale' in the receiver's
+     space. The CTM is an unrotated uniform scale (see
+     context_raster_scale()), so these map 1:1 onto device pixels,
+     though they're only aligned with them when the device offset is
+     integral. */
+
+  CGFloat x0 = floor(CGRectGetMinX(bounds) * scale);
+  CGFloat y0 = floor(CGRectGetMinY(bounds) * scale);
+  CGFloat x1 = ceil(CGRectGetMaxX(bounds) * scale);
+  CGFloat y1 = ceil(CGRectGetMaxY(bounds) * scale);
+
+  if (!(x1 - x0 <= RASTER_MAX_SIZE && y1 - y0 <= RASTER_MAX_SIZE))
+    return NULL;
+
+  size_t w = x1 - x0, h = y1 - y0;
+  size_t bytes = w * h * 4;
+
+  MgRasterizationMode mode = _rasterizationMode;
+
+  if (mode != MgRasterizationAlways && bytes > [MgGroupLayer
+					      rasterizationCacheLimit] / 4)
+    return NULL;
+
+  __block MgLayerRenderState r = *rs;
+  r.alpha = 1;
+  r.outermost = false;
+  r.next_time = HUGE_VAL;
+
+  CGImageRef im = MgImageCreateByDrawing(w, h, false, ^(CGContextRef ctx)
+    {
+      CGContextTranslateCTM(ctx, -x0, -y0);
+      CGContextScaleCTM(ctx, scale, scale);
+
+      r.ctx = ctx;
+      r.list = nil;
+
+      for (MgLayer *node in _sublayers)
+	{
+	  [node withPresentationTime:r.time handler:^
+	   {
+	     [node _renderWithState:&r];
+	   }];
+
+	  r.next_time = fmin(r.next_time, [node markPresentationTime:r.time]);
+	}
+    });
+
+  rs->next_time = fmin(rs->next_time, r.next_time);
+
+  if (im == NULL)
+    return NULL;
+
+  MG_RENDER_COUNT(rs, bytes_rasterized, bytes);
+
+  *rect = CGRectMake(x0 / scale, y0 / scale, w / scale, h / scale);
+
+  if (r.next_time == HUGE_VAL)
+    {
+      @synchronized (raster_groups)
+	{
+	  [self _discardRaster];
+
+	  _rasterImage = (__bridge id)im;
+	  _rasterRect = *rect;
+	  _rasterBytes = bytes;
+	  _rasterScale = scale;
+	  _rasterVersion = version;
+	  _rasterLastUse = ++raster_cache_clock;
+
+	  [raster_groups addObject:self];
+	  raster_cache_size += bytes;
+
+	  evict_rasters(self);
+	}
+    }
+
+  return im;
+}
+
+/* Composites the sublayers from the cached bitmap if possible,
+   creating it if the contents were static when last drawn. Returns
+   false if the caller should draw the sublayers itself. */
+
+- (BOOL)_renderRasterWithState:(MgLayerRenderState *)rs
+    scale:(CGFloat)scale
+{
+  NSUInteger version = [self _contentVersion];
+
+  CGImageRef im = NULL;
+  CGRect rect;
+
+  @synchronized (raster_groups)
+    {
+      if (_rasterImage != nil && _rasterVersion == version
+	  && _rasterScale == scale)
+	{
+	  im = CGImageRetain((__bridge CGImageRef)_rasterImage);
+	  rect = _rasterRect;
+	  _rasterLastUse = ++raster_cache_clock;
+	}
+    }
+
+  if (im == NULL)
+    {
+      if (_rasterCandidateVersion != version
+	  || _rasterCandidateScale != scale)
+	return NO;
+
+      im = [self _copyRasterWithState:rs scale:scale version:version
+	    rect:&rect];
+      if (im == NULL)
+	return NO;
+    }
+
+  /* The context's alpha and blend mode have already been set by
+     -_renderWithState:, so this composites the same way as ending the
+     transparency layer would have done. */
+
+  MgRenderDrawImage(rs, rect, im);
+  CGImageRelease(im);
+
+  return YES;
+}
+
 - (void)_renderLayerWithState:(MgLayerRenderState *)rs
 {
   if ([self.sublayers count] == 0)
@@ -224,33 +537,177 @@
 
   BOOL passThrough = self.passThrough;
 
+  CGFloat scale = 0;
+
+  /* Only cache when drawing into a bitmap, caching vector output
+     (e.g. PDF) would lose resolution. Nor while recording a display
+     list, which would keep the bitmap and could replay it at a
+     different scale, or into a vector context. */
+
+  if (!passThrough && !rs->outermost && rs->list == nil
+      && _rasterizationMode != MgRasterizationNever
+      && CGBitmapContextGetBitsPerPixel(rs->ctx) != 0)
+    {
+      scale = context_raster_scale(rs->ctx);
+
+      if (scale != 0 && [self _renderRasterWithState:rs scale:scale])
+	return;
+    }
+
+  /* `r.next_time' only covers the sublayers, so that animations drawn
+     before the receiver don't make its contents look dynamic. */
+
   __block MgLayerRenderState r = *rs;
   r.alpha = !passThrough ? 1 : rs->alpha;
   r.outermost = false;
+  r.next_time = HUGE_VAL;
+
+  /* Otherwise replay the sublayers' recorded drawing if they haven't
+     changed, or record it if they were static when last drawn. Only
+     one list records at a time, groups inside one being recorded
+     become part of it. */
+
+  NSUInteger version = [self _contentVersion];
+  MgDisplayList *list = nil, *recording = nil;
+
+  @synchronized (self)
+    {
+      if (_displayList != nil && _displayListVersion == version
+	  && _displayListAlpha == r.alpha)
+	{
+	  list = _displayList;
+	}
+      else if (rs->list == nil && _displayListCandidateVersion == version
+	       && _displayListFailedVersion != version)
+	{
+	  recording = [[MgDisplayList alloc] init];
+	}
+    }
 
   if (!passThrough && !rs->outermost)
     {
-      CGContextSaveGState(r.ctx);
-      CGContextBeginTransparencyLayer(r.ctx, NULL);
+      MgRenderSaveGState(rs);
+      MgRenderBeginTransparencyLayer(rs);
+
+      MG_RENDER_COUNT(rs, transparency_layers, 1);
     }
 
-  for (MgLayer *node in self.sublayers)
+  if (list != nil)
     {
-      [node withPresentationTime:r.time handler:^
-       {
-	 [node _renderWithState:&r];
-       }];
+      MgRenderDisplayList(&r, list);
 
-      r.next_time = fmin(r.next_time, [node markPresentationTime:r.time]);
+      MG_RENDER_COUNT(rs, lists_replayed, 1);
+    }
+  else
+    {
+      if (recording != nil)
+	r.list = recording;
+
+      for (MgLayer *node in self.sublayers)
+	{
+	  [node withPresentationTime:r.time handler:^
+	   {
+	     [node _renderWithState:&r];
+	   }];
+
+	  r.next_time = fmin(r.next_time,
+			     [node markPresentationTime:r.time]);
+	}
+
+      bool is_static = r.next_time == HUGE_VAL;
+
+      @synchronized (self)
+	{
+	  if (recording != nil && is_static && recording.valid)
+	    {
+	      _displayList = recording;
+	      _displayListVersion = version;
+	      _displayListAlpha = r.alpha;
+	    }
+	  else if (recording != nil && is_static)
+	    _displayListFailedVersion = version;
+
+	  _displayListCandidateVersion = is_static ? version : 0;
+	}
     }
 
   if (!passThrough && !rs->outermost)
     {
-      CGContextEndTransparencyLayer(r.ctx);
-      CGContextRestoreGState(r.ctx);
+      MgRenderEndTransparencyLayer(rs);
+      MgRenderRestoreGState(rs);
+    }
+
+  /* Remember if the contents were static, if the next draw sees the
+     same contents at the same scale it will cache them. */
+
+  if (scale != 0)
+    {
+      bool is_static = r.next_time == HUGE_VAL;
+      _rasterCandidateVersion = is_static ? [self _contentVersion] : 0;
+      _rasterCandidateScale = scale;
+    }
+
+  rs->next_time = fmin(rs->next_time, r.next_time);
+}
+
+- (CFTimeInterval)_markContentPresentationTime:(CFTimeInterval)t
+{
+  CFTimeInterval next = [super _markContentPresentationTime:t];
+
+  for (MgLayer *node in _sublayers)
+    {
+      next = fmin(next, [node _markContentPresentationTime:t]);
+      next = fmin(next, [node markPresentationTime:t]);
+    }
+
+  return next;
+}
+
+- (CGRect)_contentDamageAtTime:(CFTimeInterval)t
+{
+  __block CGRect r = CGRectNull;
+
+  for (MgLayer *node in _sublayers)
+    {
+      [node withPresentationTime:t handler:^
+	{
+	  r = CGRectUnion(r, [node _damageInParentAtTime:t]);
+	}];
+
+      if (CGRectIsInfinite(r))
+	break;
+    }
+
+  return r;
+}
+
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  __block CGRect r = CGRectNull;
+
+  for (MgLayer *node in _sublayers)
+    {
+      [node withPresentationTime:t handler:^
+	{
+	  CGRect b = [node _contentBoundsAtTime:t animated:animated];
+	  if (!CGRectIsInfinite(r) && !CGRectIsNull(b))
+	    {
+	      if (CGRectIsInfinite(b))
+		r = CGRectInfinite;
+	      else
+		{
+		  b = CGRectApplyAffineTransform(b, node.parentTransform);
+		  r = CGRectUnion(r, b);
+		}
+	    }
+	}];
+
+      if (CGRectIsInfinite(r))
+	break;
     }
 
-  rs->next_time = r.next_time;
+  return r;
 }
 
 - (BOOL)_isPassThroughGroup
@@ -260,10 +717,12 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgGroupLayer *copy = [super graphCopy:map];
 
+  copy->_rasterizationMode = _rasterizationMode;
+
   if ([_sublayers count] != 0)
     {
       NSMutableArray *array = [NSMutableArray array];
@@ -289,6 +748,9 @@
 
   if ([_sublayers count] != 0)
     [c encodeObject:_sublayers forKey:@"sublayers"];
+
+  if (_rasterizationMode != MgRasterizationAutomatic)
+    [c encodeInteger:_rasterizationMode forKey:@"rasterizationMode"];
 }
 
 - (id)initWithCoder:(NSCoder *)c
@@ -321,6 +783,9 @@
 	}
     }
 
+  if ([c containsValueForKey:@"rasterizationMode"])
+    _rasterizationMode = [c decodeIntegerForKey:@"rasterizationMode"];
+
   return self;
 }
 
@@ -125,7 +125,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgGroupLayerState *copy = [super graphCopy:map];
 
@@ -36,6 +36,14 @@
   __weak MgViewContext *_viewContext;
 
   NSInteger _lastVersion;
+
+  id<MgImageProvider> _requestProvider;
+  id _imageRequest;
+
+  /* The provider whose last request finished. If it still has no
+     image, decoding failed and isn't requested again. */
+
+  id<MgImageProvider> _finishedProvider;
 }
 
 + (BOOL)supportsLayer:(MgImageLayer *)layer
@@ -60,6 +68,11 @@
   return self;
 }
 
+- (void)dealloc
+{
+  [self _cancelImageRequest];
+}
+
 - (id)initWithLayer:(MgImageCALayer *)layer
 {
   self = [super init];
@@ -94,11 +107,85 @@
     }
 }
 
+- (void)_cancelImageRequest
+{
+  if (_imageRequest != nil)
+    {
+      [_requestProvider mg_cancelImageRequest:_imageRequest];
+      _imageRequest = nil;
+      _requestProvider = nil;
+    }
+}
+
+/* True if any of `layer' lies within the bounds of the root of its
+   layer tree, i.e. (roughly) the visible area of the hosting view. */
+
+static bool
+layer_is_visible(CALayer *layer)
+{
+  CALayer *root = layer;
+  while (root.superlayer != nil)
+    root = root.superlayer;
+
+  CGRect r = [layer convertRect:layer.bounds toLayer:root];
+
+  return CGRectIntersectsRect(r, root.bounds);
+}
+
+- (CGImageRef)_imageFromProvider:(id<MgImageProvider>)provider
+{
+  if (provider != _requestProvider)
+    [self _cancelImageRequest];
+
+  MgViewContext *ctx = _viewContext;
+
+  if (!ctx.loadsImagesAsynchronously
+      || ![provider respondsToSelector:
+	   @selector(mg_requestImageWithPriority:handler:)])
+    return [provider mg_providedImage];
+
+  CGImageRef image = [provider mg_loadedImage];
+
+  if (image == NULL && _imageRequest == nil && provider != _finishedProvider)
+    {
+      __weak MgImageCALayer *weak_self = self;
+
+      /* Layers outside the visible area load after those inside it. */
+
+      MgImageLoadPriority pri = ctx.imageLoadPriority;
+      if (!layer_is_visible(self))
+	pri = MIN(pri, MgImageLoadPriorityNormal);
+
+      _requestProvider = provider;
+      _imageRequest = [provider mg_requestImageWithPriority:pri handler:^
+	{
+	  MgImageCALayer *layer = weak_self;
+	  if (layer != nil)
+	    {
+	      layer->_imageRequest = nil;
+	      layer->_requestProvider = nil;
+	      layer->_finishedProvider = provider;
+	      [layer setNeedsLayout];
+	    }
+	}];
+    }
+
+  return image;
+}
+
 - (void)layoutSublayers
 {
   [_viewContext updateViewLayer:self];
 
-  CGImageRef image = [_layer.imageProvider mg_providedImage];
+  id<MgImageProvider> provider = _layer.imageProvider;
+
+  CGImageRef image = [self _imageFromProvider:provider];
+
+  /* Placeholder policy: while the image is being decoded keep showing
+     whatever we displayed previously, else show nothing. */
+
+  if (image == NULL && _imageRequest != nil)
+    return;
 
   if (image != NULL)
     {
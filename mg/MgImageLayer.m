@@ -25,6 +25,7 @@
 #import "MgImageLayer.h"
 
 #import "MgCoderExtensions.h"
+#import "MgDisplayList.h"
 #import "MgImageCALayer.h"
 #import "MgImageLayerState.h"
 #import "MgImageProvider.h"
@@ -183,9 +184,36 @@ static NSMutableSet *image_provider_classes;
     }
 }
 
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  return self.bounds;
+}
+
 - (void)_renderLayerWithState:(MgLayerRenderState *)rs
 {
-  CGImageRef im = [self.imageProvider mg_providedImage];
+  id<MgImageProvider> provider = self.imageProvider;
+
+  /* If the image isn't loaded, asking for it decodes it now. */
+
+  if ((rs->stats != NULL || rs->class_stats != NULL)
+      && [provider respondsToSelector:@selector(mg_loadedImage)]
+      && [provider mg_loadedImage] == NULL)
+    {
+      MG_RENDER_COUNT(rs, images_decoded, 1);
+    }
+
+  /* Drawing on the main thread is for display, so can't wait. Other
+     threads are making thumbnails or exports, their decodes wait in
+     the provider's queue behind those of visible layers. */
+
+  CGImageRef im;
+  if (![NSThread isMainThread] && [provider respondsToSelector:
+				   @selector(mg_providedImageWithPriority:)])
+    im = [provider mg_providedImageWithPriority:MgImageLoadPriorityBackground];
+  else
+    im = [provider mg_providedImage];
+
   bool release_im = false;
 
   CGRect crop = self.cropRect;
@@ -200,9 +228,9 @@ static NSMutableSet *image_provider_classes;
       /* We're assuming top-left geometry, so flip images to keep them
 	 oriented the right way vertically. */
 
-      CGContextSaveGState(rs->ctx);
-      CGContextTranslateCTM(rs->ctx, 0, self.bounds.size.height);
-      CGContextScaleCTM(rs->ctx, 1, -1);
+      MgRenderSaveGState(rs);
+      MgRenderConcatCTM(rs, CGAffineTransformMake(1, 0, 0, -1, 0,
+						  self.bounds.size.height));
 
       /* FIXME: implement 9-part and tiling.
 	 FIXME: is interpolationQuality part of the gstate? */
@@ -210,13 +238,15 @@ static NSMutableSet *image_provider_classes;
       CGInterpolationQuality old_quality
         = CGContextGetInterpolationQuality(rs->ctx);
 
-      CGContextSetInterpolationQuality(rs->ctx, self.interpolationQuality);
+      MgRenderSetInterpolationQuality(rs, self.interpolationQuality);
+
+      MgRenderDrawImage(rs, self.bounds, im);
 
-      CGContextDrawImage(rs->ctx, self.bounds, im);
+      MG_RENDER_COUNT(rs, images_drawn, 1);
 
-      CGContextSetInterpolationQuality(rs->ctx, old_quality);
+      MgRenderSetInterpolationQuality(rs, old_quality);
 
-      CGContextRestoreGState(rs->ctx);
+      MgRenderRestoreGState(rs);
 
       if (release_im)
 	CGImageRelease(im);
@@ -236,7 +266,7 @@ static NSMutableSet *image_provider_classes;
   /* FIXME: incorrect, assumes image is opaque. Could just call
      CGContextClipToMask() and hope it does the right thing? */
 
-  CGContextClipToRect(rs->ctx, self.bounds);
+  MgRenderClipToRect(rs, self.bounds);
 }
 
 @end
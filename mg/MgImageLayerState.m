@@ -212,7 +212,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgImageLayerState *copy = [super graphCopy:map];
 
@@ -24,6 +24,17 @@
 
 #import "MgBase.h"
 
+/* Priorities for asynchronous image loads. Requests made for layers
+   that are on-screen are decoded before thumbnails and anything else
+   that isn't immediately visible. */
+
+typedef NS_ENUM(NSInteger, MgImageLoadPriority)
+{
+  MgImageLoadPriorityBackground,
+  MgImageLoadPriorityNormal,
+  MgImageLoadPriorityVisible,
+};
+
 /* Note: this object will be encoded along with any MgImageLayer
    instances that refer to it, but only if it conforms to the
    NSSecureCoding protocol. We don't force this as many applications
@@ -35,6 +46,31 @@
 
 - (CGImageRef)mg_providedImage;
 
+@optional
+
+/* Asynchronous loading. -mg_loadedImage should return the image iff it
+   can be returned without blocking, else NULL. In which case
+   -mg_requestImageWithPriority:handler: may be used to have the image
+   loaded in the background, `block' is called on the main thread when
+   loading finishes, whether or not it succeeded (if -mg_loadedImage
+   still returns NULL, it failed). The returned object identifies the
+   request, pass it to -mg_cancelImageRequest: when it's no longer
+   needed. */
+
+- (CGImageRef)mg_loadedImage;
+
+- (id)mg_requestImageWithPriority:(MgImageLoadPriority)pri
+    handler:(void (^)(void))block;
+
+- (void)mg_cancelImageRequest:(id)req;
+
+/* Like -mg_providedImage, but if the image has to be decoded, waits
+   for it to be decoded in the background at priority `pri', so that
+   it doesn't delay more urgent loads. Must not be called on the main
+   thread. */
+
+- (CGImageRef)mg_providedImageWithPriority:(MgImageLoadPriority)pri;
+
 @end
 
 @interface MgImageProvider : NSObject <MgImageProvider, NSSecureCoding>
@@ -49,4 +85,17 @@
 @property(nonatomic, copy, readonly) NSData *data;
 @property(nonatomic, copy, readonly) NSURL *URL;
 
+/* The bounded queue used to decode images in the background. */
+
++ (NSOperationQueue *)decodeQueue;
+
+/* Providers are archived as encoded image data -- the original file
+   if there is one, else PNG -- and its SHA-256 hash. The data is only
+   computed once per provider, and providers with identical data share
+   a single data object, so archives store it once. This method
+   computes the data of `providers' concurrently, so archiving them
+   doesn't have to do it serially. */
+
++ (void)prepareProvidersForArchiving:(id<NSFastEnumeration>)providers;
+
 @end
@@ -24,15 +24,57 @@
 
 #import "MgImageProvider.h"
 
+#import "MgCoreGraphics.h"
+
+#import <CommonCrypto/CommonDigest.h>
 #import <Foundation/Foundation.h>
 #import <ImageIO/ImageIO.h>
 
+#import "MgMacros.h"
+
+@interface MgImageRequest : NSObject
+{
+@public
+  MgImageLoadPriority _priority;
+  void (^_handler)(void);
+  BOOL _cancelled;
+}
+@end
+
 @implementation MgImageProvider
 {
   id _image;				/* CGImageRef */
   NSData *_data;
   NSURL *_url;
+
+  /* Created lazily, protected by @synchronized(self). */
+
   id _imageSource;			/* CGImageSourceRef */
+  id _decodedImage;			/* CGImageRef */
+  NSOperation *_decodeOp;
+  NSMutableArray *_requests;
+
+  /* The encoded image data and its SHA-256 hash, computed the first
+     time the provider is archived. */
+
+  NSData *_archiveData;
+  NSData *_archiveHash;
+}
+
++ (NSOperationQueue *)decodeQueue
+{
+  static NSOperationQueue *queue;
+  static dispatch_once_t once;
+
+  dispatch_once(&once, ^
+    {
+      queue = [[NSOperationQueue alloc] init];
+      [queue setName:@"MgImageProvider.decodeQueue"];
+      [queue setMaxConcurrentOperationCount:
+       [[NSProcessInfo processInfo] activeProcessorCount]];
+    });
+
+  return queue;
 }
 
 + (instancetype)imageProviderWithImage:(CGImageRef)image
@@ -69,36 +111,275 @@
   if (url == nil)
     return nil;
 
-  CGImageSourceRef src
-    = CGImageSourceCreateWithURL((__bridge CFURLRef)url, NULL);
+  /* The image source is created on first use, opening the file here
+     would serialize loading documents with many linked images. */
 
-  if (src == NULL)
+  if ([url isFileURL] && ![url checkResourceIsReachableAndReturnError:nil])
     return nil;
 
   MgImageProvider *p = [[self alloc] init];
   p->_url = [url copy];
-  p->_imageSource = CFBridgingRelease(src);
 
   return p;
 }
 
+/* Must be called with the receiver locked. */
+
+- (CGImageSourceRef)_imageSource
+{
+  if (_imageSource == nil)
+    {
+      CGImageSourceRef src = NULL;
+
+      if (_data != nil)
+	src = CGImageSourceCreateWithData((__bridge CFDataRef)_data, NULL);
+      else if (_url != nil)
+	src = CGImageSourceCreateWithURL((__bridge CFURLRef)_url, NULL);
+
+      _imageSource = CFBridgingRelease(src);
+    }
+
+  return (__bridge CGImageSourceRef)_imageSource;
+}
+
+- (CGImageRef)_copyDecodedImage CF_RETURNS_RETAINED
+{
+  CGImageSourceRef src = NULL;
+
+  @synchronized (self)
+    {
+      src = [self _imageSource];
+      if (src != NULL)
+	CFRetain(src);
+    }
+
+  if (src == NULL)
+    return NULL;
+
+  /* Force the pixels to be decoded now, on the calling thread, rather
+     than the first time the image is drawn. */
+
+  NSDictionary *opts = @{
+    (__bridge id)kCGImageSourceShouldCache : @YES,
+    (__bridge id)kCGImageSourceShouldCacheImmediately : @YES,
+  };
+
+  CGImageRef im = CGImageSourceCreateImageAtIndex(src, 0,
+				(__bridge CFDictionaryRef)opts);
+  CFRelease(src);
+
+  return im;
+}
+
+/* Stores `im' as the decoded image unless one was already stored by
+   another thread, returns the stored image. Consumes `im'. */
+
+- (CGImageRef)_setDecodedImage:(CGImageRef)im
+{
+  @synchronized (self)
+    {
+      if (_decodedImage == nil)
+	_decodedImage = CFBridgingRelease(im);
+      else if (im != NULL)
+	CGImageRelease(im);
+
+      return (__bridge CGImageRef)_decodedImage;
+    }
+}
+
 - (CGImageRef)mg_providedImage
+{
+  CGImageRef im = [self mg_loadedImage];
+  if (im != NULL)
+    return im;
+
+  return [self _setDecodedImage:[self _copyDecodedImage]];
+}
+
+- (CGImageRef)mg_loadedImage
 {
   if (_image != nil)
+    return (__bridge CGImageRef)_image;
+
+  @synchronized (self)
+    {
+      return (__bridge CGImageRef)_decodedImage;
+    }
+}
+
+static NSOperationQueuePriority
+queue_priority(MgImageLoadPriority pri)
+{
+  switch (pri)
+    {
+    case MgImageLoadPriorityBackground:
+      return NSOperationQueuePriorityVeryLow;
+    case MgImageLoadPriorityNormal:
+      return NSOperationQueuePriorityNormal;
+    case MgImageLoadPriorityVisible:
+      return NSOperationQueuePriorityVeryHigh;
+    }
+
+  return NSOperationQueuePriorityNormal;
+}
+
+/* Must be called with the receiver locked. */
+
+- (void)_updateDecodePriority
+{
+  MgImageLoadPriority pri = MgImageLoadPriorityBackground;
+
+  for (MgImageRequest *req in _requests)
+    pri = MAX(pri, req->_priority);
+
+  [_decodeOp setQueuePriority:queue_priority(pri)];
+}
+
+- (void)_decodeOperation:(NSOperation *)op
+{
+  CGImageRef im = [self mg_loadedImage];
+  if (im == NULL)
+    [self _setDecodedImage:[self _copyDecodedImage]];
+
+  NSArray *requests = nil;
+
+  /* If every request was cancelled while we were running, a newer
+     operation may have been queued, the requests are its to finish. */
+
+  @synchronized (self)
+    {
+      if (_decodeOp == op)
+	{
+	  requests = _requests;
+	  _requests = nil;
+	  _decodeOp = nil;
+	}
+    }
+
+  /* Handlers are called even if decoding failed, so that requesters
+     don't wait for it forever. */
+
+  if ([requests count] == 0)
+    return;
+
+  dispatch_async(dispatch_get_main_queue(), ^
+    {
+      for (MgImageRequest *req in requests)
+	{
+	  if (!req->_cancelled)
+	    req->_handler();
+	}
+    });
+}
+
+- (id)mg_requestImageWithPriority:(MgImageLoadPriority)pri
+    handler:(void (^)(void))block
+{
+  MgImageRequest *req = [[MgImageRequest alloc] init];
+  req->_priority = pri;
+  req->_handler = [block copy];
+
+  NSOperation *op = nil;
+  BOOL loaded = NO;
+
+  @synchronized (self)
+    {
+      if (_image != nil || _decodedImage != nil)
+	loaded = YES;
+      else
+	{
+	  if (_requests == nil)
+	    _requests = [[NSMutableArray alloc] init];
+
+	  [_requests addObject:req];
+
+	  if (_decodeOp == nil)
+	    {
+	      /* The operation only holds a weak reference, if every
+		 layer displaying the image goes away there's no reason
+		 to decode it. */
+
+	      __weak MgImageProvider *weak_self = self;
+	      NSBlockOperation *block_op = [[NSBlockOperation alloc] init];
+	      __weak NSBlockOperation *weak_op = block_op;
+
+	      [block_op addExecutionBlock:^
+		{
+		  [weak_self _decodeOperation:weak_op];
+		}];
+
+	      op = block_op;
+
+	      _decodeOp = op;
+	    }
+
+	  [self _updateDecodePriority];
+	}
+    }
+
+  if (loaded)
     {
-      return (__bridge CGImageRef)_image;
+      dispatch_async(dispatch_get_main_queue(), ^
+	{
+	  if (!req->_cancelled)
+	    req->_handler();
+	});
     }
-  else if (_imageSource != nil)
+
+  if (op != nil)
+    [[[self class] decodeQueue] addOperation:op];
+
+  return req;
+}
+
+- (void)mg_cancelImageRequest:(id)req_
+{
+  MgImageRequest *req = req_;
+  if (req == nil)
+    return;
+
+  req->_cancelled = YES;
+
+  @synchronized (self)
     {
-      CGImageRef im = CGImageSourceCreateImageAtIndex(
-			(__bridge CGImageSourceRef)_imageSource, 0, NULL);
-      if (im != NULL)
-	return (CGImageRef)CFAutorelease(im);
+      [_requests removeObjectIdenticalTo:req];
+
+      if ([_requests count] == 0)
+	{
+	  [_decodeOp cancel];
+	  _decodeOp = nil;
+	  _requests = nil;
+	}
       else
-	return NULL;
+	[self _updateDecodePriority];
+    }
+}
+
+- (CGImageRef)mg_providedImageWithPriority:(MgImageLoadPriority)pri
+{
+  CGImageRef im = [self mg_loadedImage];
+  if (im != NULL)
+    return im;
+
+  /* Join (or start) the queued decode, holding a request so it can't
+     be cancelled from under us. */
+
+  id req = [self mg_requestImageWithPriority:pri handler:^{}];
+
+  NSOperation *op = nil;
+  @synchronized (self)
+    {
+      op = _decodeOp;
     }
 
-  return NULL;
+  [op waitUntilFinished];
+
+  [self mg_cancelImageRequest:req];
+
+  /* Fall back to decoding synchronously, e.g. if the operation was
+     cancelled before it could start. */
+
+  return [self mg_providedImage];
 }
 
 - (CGImageRef)image
@@ -119,15 +400,79 @@
     return nil;
 }
 
-/** NSSecureCoding methods. **/
+/** Archived data. **/
 
-+ (BOOL)supportsSecureCoding
+static NSData *
+data_hash(NSData *data)
 {
-  return YES;
+  CC_SHA256_CTX ctx;
+  CC_SHA256_Init(&ctx);
+
+  const uint8_t *ptr = [data bytes];
+  size_t len = [data length];
+
+  /* CC_LONG is only 32 bits. */
+
+  while (len != 0)
+    {
+      size_t n = MIN(len, (size_t)1 << 30);
+      CC_SHA256_Update(&ctx, ptr, (CC_LONG)n);
+      ptr += n;
+      len -= n;
+    }
+
+  uint8_t md[CC_SHA256_DIGEST_LENGTH];
+  CC_SHA256_Final(md, &ctx);
+
+  return [NSData dataWithBytes:md length:sizeof(md)];
 }
 
-- (void)encodeWithCoder:(NSCoder *)c
+/* Returns the data object previously stored with `hash', else stores
+   and returns `data'. Providers with identical contents therefore
+   share the same data object, which archivers only write once. Hashes
+   read from archives aren't verified, so the contents are compared
+   before sharing when two objects claim the same hash. */
+
+static NSData *
+intern_data(NSData *data, NSData *hash)
 {
+  static NSMapTable *table;
+  static dispatch_once_t once;
+
+  dispatch_once(&once, ^
+    {
+      table = [NSMapTable strongToWeakObjectsMapTable];
+    });
+
+  @synchronized (table)
+    {
+      NSData *existing = [table objectForKey:hash];
+
+      if (existing == nil)
+	[table setObject:data forKey:hash];
+      else if ([existing isEqualToData:data])
+	return existing;
+
+      return data;
+    }
+}
+
+/* Returns the data to archive, and its hash via `hashp'. The original
+   file data is used if there is any, else the image is encoded as PNG.
+   Either way this only happens once, linked files are embedded as
+   they were when first archived. */
+
+- (NSData *)_archiveDataAndHash:(NSData **)hashp
+{
+  @synchronized (self)
+    {
+      if (_archiveHash != nil)
+	{
+	  *hashp = _archiveHash;
+	  return _archiveData;
+	}
+    }
+
   NSData *data = nil;
 
   if (_data != nil)
@@ -136,21 +481,65 @@
     data = [NSData dataWithContentsOfURL:_url];
   else if (_image != nil)
     {
-      CFStringRef type = CFSTR("public.png");
-      NSMutableData *mdata = [NSMutableData data];
-      CGImageDestinationRef dest = CGImageDestinationCreateWithData(
-			(__bridge CFMutableDataRef)mdata, type, 1, NULL);
-      if (dest != NULL)
+      data = CFBridgingRelease(MgImageCreateData((__bridge CGImageRef)_image,
+						 CFSTR("public.png")));
+    }
+
+  if (data == nil)
+    return nil;
+
+  NSData *hash = data_hash(data);
+  data = intern_data(data, hash);
+
+  @synchronized (self)
+    {
+      if (_archiveHash == nil)
 	{
-	  CGImageDestinationAddImage(dest, (__bridge CGImageRef)_image, NULL);
-	  CGImageDestinationFinalize(dest);
-	  CFRelease(dest);
-	  data = mdata;
+	  _archiveData = data;
+	  _archiveHash = hash;
 	}
+
+      *hashp = _archiveHash;
+      return _archiveData;
+    }
+}
+
++ (void)prepareProvidersForArchiving:(id<NSFastEnumeration>)providers
+{
+  NSMutableArray *array = [NSMutableArray array];
+
+  for (id p in providers)
+    {
+      if ([p isKindOfClass:[MgImageProvider class]])
+	[array addObject:p];
     }
 
+  dispatch_apply([array count],
+		 dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+		 ^(size_t i)
+    {
+      NSData *hash;
+      [array[i] _archiveDataAndHash:&hash];
+    });
+}
+
+/** NSSecureCoding methods. **/
+
++ (BOOL)supportsSecureCoding
+{
+  return YES;
+}
+
+- (void)encodeWithCoder:(NSCoder *)c
+{
+  NSData *hash = nil;
+  NSData *data = [self _archiveDataAndHash:&hash];
+
   if (data != nil)
-    [c encodeObject:data forKey:@"data"];
+    {
+      [c encodeObject:data forKey:@"data"];
+      [c encodeObject:hash forKey:@"sha256"];
+    }
 }
 
 - (id)initWithCoder:(NSCoder *)c
@@ -163,19 +552,30 @@
   if (data == nil)
     return nil;
 
-  CGImageSourceRef src
-    = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+  /* Stash the data away -- prevents us recompressing the image when it's
+     next serialized. The image source is created lazily, so that
+     opening a document doesn't have to touch every image in it. */
 
-  if (src == NULL)
-    return nil;
+  NSData *hash = nil;
+  if ([c containsValueForKey:@"sha256"])
+    hash = [c decodeObjectOfClass:[NSData class] forKey:@"sha256"];
 
-  /* Stash the data away -- prevents us recompressing the image when it's
-     next serialized. */
+  /* Keeping the archived hash means saving the document again doesn't
+     have to read and hash every image in it. */
+
+  if ([hash length] == CC_SHA256_DIGEST_LENGTH)
+    {
+      data = intern_data(data, hash);
+      _archiveData = data;
+      _archiveHash = hash;
+    }
 
   _data = data;
-  _imageSource = CFBridgingRelease(src);
 
   return self;
 }
 
 @end
+
+@implementation MgImageRequest
+@end
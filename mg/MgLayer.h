@@ -24,6 +24,23 @@
 
 #import "MgNode.h"
 
+/* Per-frame statistics gathered by -renderInContext:...stats:. */
+
+typedef struct MgLayerRenderStats MgLayerRenderStats;
+
+struct MgLayerRenderStats
+{
+  NSUInteger visited;		/* layers considered for drawing */
+  NSUInteger culled;		/* transparent or outside the clip */
+  NSUInteger drawn;		/* layers whose content was drawn */
+  NSUInteger transparency_layers; /* groups composited offscreen */
+  NSUInteger masks;		/* masks applied */
+  NSUInteger images_drawn;	/* images drawn by image layers */
+  NSUInteger images_decoded;	/* images decoded while drawing */
+  NSUInteger bytes_rasterized;	/* size of group bitmaps created */
+  NSUInteger lists_replayed;	/* groups drawn from display lists */
+};
+
 @interface MgLayer : MgNode
 
 /** Geometry properties. **/
@@ -76,8 +93,41 @@
 - (CFTimeInterval)renderInContext:(CGContextRef)ctx
     scale:(CGFloat)scale presentationTime:(CFTimeInterval)t;
 
+/* Layers whose bounds lie entirely outside the context's clip are not
+   drawn. If `stats' is non-null the counts of layers processed are
+   added to it. */
+
+- (CFTimeInterval)renderInContext:(CGContextRef)ctx
+    scale:(CGFloat)scale presentationTime:(CFTimeInterval)t
+    stats:(MgLayerRenderStats *)stats;
+
+/* As above, but adding the counts to `trace', per layer class, and
+   timing the layers drawn. See MgRenderTrace.h. */
+
+- (CFTimeInterval)renderInContext:(CGContextRef)ctx
+    scale:(CGFloat)scale presentationTime:(CFTimeInterval)t
+    trace:(MgRenderTrace *)trace;
+
 - (CGImageRef)copyImage CF_RETURNS_RETAINED;
 - (CGImageRef)copyImageWithScale:(CGFloat)s CF_RETURNS_RETAINED;
+- (CGImageRef)copyImageWithScale:(CGFloat)s
+    presentationTime:(CFTimeInterval)t CF_RETURNS_RETAINED;
+
+/* Renders on the calling thread only, recording into `trace'. */
+
+- (CGImageRef)copyImageWithScale:(CGFloat)s
+    presentationTime:(CFTimeInterval)t trace:(MgRenderTrace *)trace
+    CF_RETURNS_RETAINED;
+
+/* Renders `count' frames, frame `i' at time `t + i / rate', on several
+   threads at once, each with its own copy of the graph (the receiver
+   isn't modified). `block' is called once per frame, from any thread
+   and in no particular order. Returns when all frames have been
+   delivered, or immediately if `rate' isn't positive. */
+
+- (void)renderFramesWithScale:(CGFloat)s presentationTime:(CFTimeInterval)t
+    rate:(double)rate count:(size_t)count
+    handler:(void (^)(size_t frame, CGImageRef im))block;
 
 /** Methods for subclasses to override. **/
 
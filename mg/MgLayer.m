@@ -24,19 +24,35 @@
 
 #import "MgLayerInternal.h"
 
+#import "MgActiveTransition.h"
 #import "MgCoderExtensions.h"
 #import "MgCoreGraphics.h"
+#import "MgDisplayList.h"
 #import "MgFlatteningCALayer.h"
 #import "MgLayerState.h"
 #import "MgNodeInternal.h"
+#import "MgRenderTraceInternal.h"
+#import "MgTransitionProfilerInternal.h"
 
 #import <Foundation/Foundation.h>
+#import <QuartzCore/QuartzCore.h>
 
 #define STATE ((MgLayerState *)(self.state))
 
+static CGRect
+transform_bounds(CGRect r, CGAffineTransform m)
+{
+  if (CGRectIsNull(r) || CGRectIsInfinite(r))
+    return r;
+  else
+    return CGRectApplyAffineTransform(r, m);
+}
+
 @implementation MgLayer
 {
   MgLayer *_mask;
+  NSUInteger _contentBoundsVersion;
+  CGRect _contentBounds;
 }
 
 + (Class)stateClass
@@ -463,6 +479,14 @@
 
 - (CFTimeInterval)renderInContext:(CGContextRef)ctx scale:(CGFloat)scale
     presentationTime:(CFTimeInterval)t;
+{
+  return [self renderInContext:ctx scale:scale presentationTime:t
+	  stats:NULL];
+}
+
+- (CFTimeInterval)_renderInContext:(CGContextRef)ctx scale:(CGFloat)scale
+    presentationTime:(CFTimeInterval)t stats:(MgLayerRenderStats *)stats
+    trace:(MgRenderTrace *)trace
 {
   __block MgLayerRenderState rs;
   rs.time = t;
@@ -471,6 +495,13 @@
   rs.scale = scale;
   rs.alpha = 1;
   rs.outermost = true;
+  rs.stats = stats;
+  rs.trace = trace;
+  rs.class_stats = NULL;
+  rs.list = nil;
+
+  if (trace != nil)
+    rs.stats = [trace _beginFrameAtTime:t];
 
   [self withPresentationTime:rs.time handler:^
     {
@@ -479,31 +510,98 @@
 
   rs.next_time = fmin(rs.next_time, [self markPresentationTime:rs.time]);
 
+  if (trace != nil)
+    [trace _endFrame];
+
+  if (mg_profiling)
+    MgProfileFrame();
+
   return rs.next_time;
 }
 
+- (CFTimeInterval)renderInContext:(CGContextRef)ctx scale:(CGFloat)scale
+    presentationTime:(CFTimeInterval)t stats:(MgLayerRenderStats *)stats
+{
+  return [self _renderInContext:ctx scale:scale presentationTime:t
+	  stats:stats trace:nil];
+}
+
+- (CFTimeInterval)renderInContext:(CGContextRef)ctx scale:(CGFloat)scale
+    presentationTime:(CFTimeInterval)t trace:(MgRenderTrace *)trace
+{
+  return [self _renderInContext:ctx scale:scale presentationTime:t
+	  stats:NULL trace:trace];
+}
+
+/* Called instead of drawing the receiver. Transitions in its subtree
+   must still be advanced, or they would never complete while it's
+   hidden. */
+
+- (void)_cullWithState:(MgLayerRenderState *)rs animated:(bool)animated
+{
+  MG_RENDER_COUNT(rs, culled, 1);
+
+  if (animated)
+    {
+      rs->next_time = fmin(rs->next_time,
+			   [self _markContentPresentationTime:rs->time]);
+    }
+}
+
 - (void)_renderWithState:(MgLayerRenderState *)rs
 {
-  float alpha = rs->alpha;
-  if (!rs->outermost)
+  __block MgLayerRenderState r = *rs;
+
+  if (r.trace != nil)
+    r.class_stats = [r.trace _statsForClass:[self class]];
+
+  MG_RENDER_COUNT(&r, visited, 1);
+
+  bool animated = false;
+  CGRect bounds = [self _contentBoundsAtTime:r.time animated:&animated];
+
+  float alpha = r.alpha;
+  if (!r.outermost)
     alpha = alpha * fmin(self.alpha, 1);
   if (!(alpha > 0))
-    return;
+    {
+      [self _cullWithState:&r animated:animated];
+      rs->next_time = r.next_time;
+      return;
+    }
 
-  __block MgLayerRenderState r = *rs;
   r.alpha = alpha;
 
-  CGContextSaveGState(r.ctx);
+  MgRenderSaveGState(&r);
 
   if (!rs->outermost)
+    MgRenderConcatCTM(&r, [self parentTransform]);
+
+  /* Bounds are conservative so this can't cull anything visible. A
+     display list being recorded may be replayed with a different
+     clip, so it makes the test itself each time it's replayed. */
+
+  size_t bounds_idx = SIZE_MAX;
+
+  if (r.list != nil)
+    bounds_idx = MgRenderBeginBounds(&r, bounds);
+  else if (!CGRectIntersectsRect(bounds, CGContextGetClipBoundingBox(r.ctx)))
     {
-      CGContextConcatCTM(r.ctx, [self parentTransform]);
+      MgRenderRestoreGState(&r);
+      [self _cullWithState:&r animated:animated];
+      rs->next_time = r.next_time;
+      return;
+    }
 
+  if (!rs->outermost)
+    {
       if (![self _isPassThroughGroup])
 	{
 	  MgLayer *mask = self.mask;
 	  if (mask != nil)
 	    {
+	      MG_RENDER_COUNT(&r, masks, 1);
+
 	      [mask withPresentationTime:r.time handler:^
 		{ 
 		  MgLayerRenderState rm = r;
@@ -513,17 +611,39 @@
 		  r.next_time = fmin(rm.next_time,
 				     [mask markPresentationTime:rm.time]);
 		}];
+
+	      /* The mask can only have shrunk the clip. */
+
+	      if (r.list == nil
+		  && !CGRectIntersectsRect(bounds,
+					   CGContextGetClipBoundingBox(r.ctx)))
+		{
+		  MgRenderRestoreGState(&r);
+		  [self _cullWithState:&r animated:animated];
+		  rs->next_time = r.next_time;
+		  return;
+		}
 	    }
 
-	  CGContextSetBlendMode(rs->ctx, self.blendMode);
+	  MgRenderSetBlendMode(&r, self.blendMode);
 	}
 
-      CGContextSetAlpha(rs->ctx, r.alpha);
+      MgRenderSetAlpha(&r, r.alpha);
     }
 
-  [self _renderLayerWithState:&r];
+  MG_RENDER_COUNT(&r, drawn, 1);
 
-  CGContextRestoreGState(r.ctx);
+  if (r.trace != nil)
+    {
+      [r.trace _beginLayer:self stats:r.class_stats];
+      [self _renderLayerWithState:&r];
+      [r.trace _endLayer];
+    }
+  else
+    [self _renderLayerWithState:&r];
+
+  MgRenderEndBounds(&r, bounds_idx);
+  MgRenderRestoreGState(&r);
 
   rs->next_time = r.next_time;
 }
@@ -537,7 +657,7 @@
   float alpha = rs->alpha * fmin(self.alpha, 1);
   if (!(alpha > 0))
     {
-      CGContextClipToRect(rs->ctx, CGRectNull);
+      MgRenderClipToRect(rs, CGRectNull);
       return;
     }
 
@@ -545,11 +665,11 @@
   r.alpha = alpha;
 
   CGAffineTransform m = [self parentTransform];
-  CGContextConcatCTM(r.ctx, m);
+  MgRenderConcatCTM(&r, m);
 
   [self _renderLayerMaskWithState:&r];
 
-  CGContextConcatCTM(r.ctx, CGAffineTransformInvert(m));
+  MgRenderConcatCTM(&r, CGAffineTransformInvert(m));
 
   rs->next_time = r.next_time;
 }
@@ -564,32 +684,237 @@
   return NO;
 }
 
+- (CFTimeInterval)_markContentPresentationTime:(CFTimeInterval)t
+{
+  MgLayer *mask = self.mask;
+  if (mask == nil)
+    return HUGE_VAL;
+
+  return fmin([mask _markContentPresentationTime:t],
+	      [mask markPresentationTime:t]);
+}
+
+- (CGRect)_contentDamageAtTime:(CFTimeInterval)t
+{
+  bool animated = false;
+  CGRect bounds = [self _contentBoundsAtTime:t animated:&animated];
+
+  return animated ? bounds : CGRectNull;
+}
+
+- (CGRect)_damageInParentAtTime:(CFTimeInterval)t
+{
+  bool animated = false;
+  CGRect bounds = [self _contentBoundsAtTime:t animated:&animated];
+
+  if (!animated)
+    return CGRectNull;
+
+  /* If the layer itself or its mask is changing, everything it draws
+     may change, else only the changing parts of its content. */
+
+  __block bool mask_animated = false;
+
+  MgLayer *mask = self.mask;
+  if (mask != nil)
+    {
+      [mask withPresentationTime:t handler:^
+	{
+	  [mask _contentBoundsAtTime:t animated:&mask_animated];
+	}];
+    }
+
+  CGRect r;
+  if (self.activeTransition != nil || mask_animated)
+    r = bounds;
+  else
+    r = [self _contentDamageAtTime:t];
+
+  return transform_bounds(r, [self parentTransform]);
+}
+
+- (CGRect)_contentBoundsAtTime:(CFTimeInterval)t animated:(bool *)animated
+{
+  /* Starting or finishing a transition anywhere in the subtree bumps
+     our version, so a cached value can only be reused while nothing
+     below us is animating. */
+
+  NSUInteger version = self.version;
+
+  if (_contentBoundsVersion == version)
+    return _contentBounds;
+
+  bool anim = self.activeTransition != nil;
+
+  CGRect r = [self _computeContentBoundsAtTime:t animated:&anim];
+
+  if (!anim)
+    {
+      _contentBoundsVersion = version;
+      _contentBounds = r;
+    }
+  else
+    *animated = true;
+
+  return r;
+}
+
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  return CGRectNull;
+}
+
 - (CGImageRef)copyImage
 {
   return [self copyImageWithScale:1];
 }
 
-- (CGImageRef)copyImageWithScale:(CGFloat)s CF_RETURNS_RETAINED;
+/* Images with fewer pixels than this are rendered serially, for
+   anything larger it's worth copying the graph once per thread. */
+
+#define TILED_MIN_PIXELS (2048 * 2048)
+
+/* Returns a copy of the graph rooted at `layer' that can be rendered
+   on a different thread to the original (rendering mutates the
+   presentation state of each node). Active transitions are shared, so
+   the copy renders the same frame as the original would, and so are
+   profiling identities, so the copy's costs go to the original. */
+
+static MgLayer *
+copy_for_rendering(MgLayer *layer)
 {
-  CGPoint origin = self.origin;
-  CGSize size = self.size;
+  MgGraphCopyMap *map = [MgGraphCopyMap map];
 
-  return MgImageCreateByDrawing(ceil(size.width*s), ceil(size.height*s), false,
-    ^(CGContextRef ctx)
+  MgLayer *copy = [layer mg_graphCopy:map];
+
+  [map enumerateKeysAndObjectsUsingBlock:^(id obj, id obj_copy, BOOL *stop)
+    {
+      if ([obj isKindOfClass:[MgNode class]])
+	{
+	  MgNode *node = obj, *node_copy = obj_copy;
+	  MgActiveTransition *trans = node.activeTransition;
+	  if (trans != nil)
+	    node_copy.activeTransition = trans;
+	  node_copy.profileIdentity = node.profileIdentity;
+	}
+    }];
+
+  return copy;
+}
+
+/* Renders `layer' at time `t', splitting large images into tiles
+   rendered on up to `nthreads' threads. Tracing is only possible on a
+   single thread. */
+
+static CGImageRef
+copy_image(MgLayer *layer, CGFloat s, CFTimeInterval t, size_t nthreads,
+	   MgRenderTrace *trace)
+{
+  CGPoint origin = layer.origin;
+  CGSize size = layer.size;
+  CGAffineTransform m = [layer parentTransform];
+
+  size_t w = ceil(size.width * s);
+  size_t h = ceil(size.height * s);
+
+  void (^render)(MgLayer *layer, CGContextRef ctx)
+    = ^(MgLayer *layer, CGContextRef ctx)
     {
       CGContextScaleCTM(ctx, s, s);
       CGContextTranslateCTM(ctx, 0, size.height);
       CGContextScaleCTM(ctx, 1, -1);
       CGContextTranslateCTM(ctx, origin.x, origin.y);
-      CGAffineTransform m = [self parentTransform];
       CGContextConcatCTM(ctx, CGAffineTransformInvert(m));
-      [self renderInContext:ctx scale:s];
+      [layer renderInContext:ctx scale:s presentationTime:t trace:trace];
+    };
+
+  if (nthreads <= 1 || w * h < TILED_MIN_PIXELS || trace != nil)
+    {
+      return MgImageCreateByDrawing(w, h, false, ^(CGContextRef ctx)
+	{
+	  render(layer, ctx);
+	});
+    }
+
+  /* Large image, e.g. exporting at a high scale factor. Render tiles
+     in parallel, each thread using its own copy of the graph. (The
+     calling thread's copy is the layer itself.) */
+
+  NSMutableArray *layers = [NSMutableArray arrayWithObject:layer];
+  for (size_t i = 1; i < nthreads; i++)
+    [layers addObject:copy_for_rendering(layer)];
+
+  return MgImageCreateByDrawingTiles(w, h, false, nthreads,
+    ^(CGContextRef ctx, size_t thread)
+    {
+      render(layers[thread], ctx);
+    });
+}
+
+- (CGImageRef)copyImageWithScale:(CGFloat)s CF_RETURNS_RETAINED;
+{
+  return [self copyImageWithScale:s presentationTime:CACurrentMediaTime()];
+}
+
+- (CGImageRef)copyImageWithScale:(CGFloat)s
+    presentationTime:(CFTimeInterval)t CF_RETURNS_RETAINED;
+{
+  size_t nthreads = [[NSProcessInfo processInfo] activeProcessorCount];
+
+  return copy_image(self, s, t, nthreads, nil);
+}
+
+- (CGImageRef)copyImageWithScale:(CGFloat)s
+    presentationTime:(CFTimeInterval)t trace:(MgRenderTrace *)trace
+    CF_RETURNS_RETAINED;
+{
+  return copy_image(self, s, t, 1, trace);
+}
+
+- (void)renderFramesWithScale:(CGFloat)s presentationTime:(CFTimeInterval)t
+    rate:(double)rate count:(size_t)count
+    handler:(void (^)(size_t frame, CGImageRef im))block
+{
+  if (!(rate > 0))
+    return;
+
+  size_t nthreads = [[NSProcessInfo processInfo] activeProcessorCount];
+  if (nthreads > count)
+    nthreads = count;
+  if (nthreads == 0)
+    return;
+
+  /* One copy of the graph per thread, all made before anything is
+     rendered, since rendering retires finished transitions. The
+     receiver itself isn't rendered, it may be in use on the main
+     thread. Frames are interleaved across threads so that each copy
+     still sees its frame times in increasing order. */
+
+  NSMutableArray *layers = [NSMutableArray array];
+  for (size_t i = 0; i < nthreads; i++)
+    [layers addObject:copy_for_rendering(self)];
+
+  dispatch_apply(nthreads, dispatch_get_global_queue(
+		  DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread)
+    {
+      MgLayer *layer = layers[thread];
+
+      for (size_t i = thread; i < count; i += nthreads)
+	{
+	  @autoreleasepool
+	    {
+	      CGImageRef im = copy_image(layer, s, t + i / rate, 1, nil);
+	      block(i, im);
+	      CGImageRelease(im);
+	    }
+	}
     });
 }
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgLayer *copy = [super graphCopy:map];
 
@@ -24,6 +24,8 @@
 
 #import "MgLayer.h"
 
+@class MgDisplayList;
+
 typedef struct MgLayerRenderState MgLayerRenderState;
 
 struct MgLayerRenderState
@@ -34,8 +36,30 @@ struct MgLayerRenderState
   CGFloat scale;
   float alpha;
   bool outermost;
+  MgLayerRenderStats *stats;
+
+  /* When rendering with an MgRenderTrace, the trace and its stats for
+     the class of the layer being drawn. */
+
+  __unsafe_unretained MgRenderTrace *trace;
+  MgLayerRenderStats *class_stats;
+
+  /* The display list being recorded, if any. See MgDisplayList.h. */
+
+  __unsafe_unretained MgDisplayList *list;
 };
 
+/* Adds `n' to counter `field' of the frame's stats, if any, and of the
+   current class in the trace, if any. */
+
+#define MG_RENDER_COUNT(rs, field, n)				\
+  do {								\
+    if ((rs)->stats != NULL)					\
+      (rs)->stats->field += (n);				\
+    if ((rs)->class_stats != NULL)				\
+      (rs)->class_stats->field += (n);				\
+  } while (0)
+
 @interface MgLayer ()
 
 - (Class)viewLayerClass;
@@ -50,4 +74,39 @@ struct MgLayerRenderState
 
 - (BOOL)_isPassThroughGroup;
 
+/* Calls -markPresentationTime: on every node in the receiver's subtree
+   (not including the receiver itself), returning the earliest of the
+   times they return. Used when content is not rendered, so that its
+   transitions still complete. */
+
+- (CFTimeInterval)_markContentPresentationTime:(CFTimeInterval)t;
+
+/* Returns the union of the bounds of each layer in the receiver's
+   subtree that has an active transition, as presented at time `t', in
+   the receiver's coordinate space. Together with the value returned
+   for the previous frame this is the area that must be redrawn.
+   Must be called with the receiver's presentation state in effect. */
+
+- (CGRect)_contentDamageAtTime:(CFTimeInterval)t;
+
+/* As above, but for the receiver itself as seen by its parent. */
+
+- (CGRect)_damageInParentAtTime:(CFTimeInterval)t;
+
+/* Returns a conservative bounding box of everything drawn by
+   -_renderLayerWithState:, in the receiver's coordinate space (i.e.
+   excluding its parent transform and mask). CGRectInfinite means
+   unbounded. Must be called with the receiver's presentation state in
+   effect. Sets `*animated' to true if the result depends on the
+   presentation time, otherwise it is cached until the next change in
+   version. */
+
+- (CGRect)_contentBoundsAtTime:(CFTimeInterval)t animated:(bool *)animated;
+
+/* Uncached implementation of the above, for subclasses to override.
+   The default implementation returns CGRectNull. */
+
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated;
+
 @end
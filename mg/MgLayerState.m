@@ -350,7 +350,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgLayerState *copy = [super graphCopy:map];
 
@@ -40,6 +40,11 @@
 
 - (MgModuleState *)moduleStateWithName:(NSString *)name;
 
+/* Must be called after modifying one of the receiver's module states,
+   e.g. renaming it, so its version changes. */
+
+- (void)didModifyModuleState:(MgModuleState *)state;
+
 /* The current state of this module. */
 
 @property(nonatomic, strong) MgModuleState *moduleState;
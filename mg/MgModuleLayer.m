@@ -115,6 +115,11 @@
   return nil;
 }
 
+- (void)didModifyModuleState:(MgModuleState *)state
+{
+  [self incrementVersion];
+}
+
 + (BOOL)automaticallyNotifiesObserversOfModuleState
 {
   return NO;
@@ -155,7 +160,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   /* Copy our states before calling super, this is so any conditional
      calls to copy the states from our sublayers (which will happen
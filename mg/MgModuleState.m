@@ -91,7 +91,7 @@ state_depth(MgModuleState *s)
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgModuleState *copy = [[[self class] alloc] init];
 
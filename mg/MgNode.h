@@ -79,6 +79,11 @@ extern NSString *const MgArchiveType;	/* UTI: org.unfactored.mg-archive */
 
 @property(nonatomic, readonly) NSUInteger version;
 
+/* Must be called after modifying one of the receiver's states other
+   than via the receiver's own properties, so its version changes. */
+
+- (void)didModifyState:(MgNodeState *)state;
+
 /* Calls `block(node)' for each node referred to by the receiver. (Note
    that this includes all kinds of nodes, e.g. including animations.)  */
 
@@ -109,7 +114,9 @@ extern NSString *const MgArchiveType;	/* UTI: org.unfactored.mg-archive */
 
 /* Tells the runtime that time 't' will not be seen again, i.e. that
    any temporal events strictly before that time may be discarded.
-   Returns the time at which the receiver's next temporal event occurs. */
+   Returns the time at which the receiver's next temporal event occurs,
+   `t' itself if its presentation is changing continuously, or
+   HUGE_VAL if nothing is pending. */
 
 - (CFTimeInterval)markPresentationTime:(CFTimeInterval)t;
 
@@ -122,3 +129,4 @@ extern NSString *const MgNodeTransitionSpeed;
 extern NSString *const MgNodeTransitionBegin;
 extern NSString *const MgNodeTransitionDuration;
 extern NSString *const MgNodeTransitionFunction;
+extern NSString *const MgNodeTransitionColorMixMode;
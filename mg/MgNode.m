@@ -30,6 +30,7 @@
 #import "MgNodeTransition.h"
 #import "MgSpringFunction.h"
 #import "MgTimingFunction.h"
+#import "MgTransitionProfilerInternal.h"
 #import "MgTransitionTiming.h"
 
 #import <Foundation/Foundation.h>
@@ -50,8 +51,20 @@ NSString *const MgNodeTransitionSpeed = @"speed";
 NSString *const MgNodeTransitionBegin = @"begin";
 NSString *const MgNodeTransitionDuration = @"duration";
 NSString *const MgNodeTransitionFunction = @"function";
+NSString *const MgNodeTransitionColorMixMode = @"colorMixMode";
 
 static NSUInteger version_counter;
+static NSUInteger identity_counter;
+
+static NSUInteger
+atomic_increment(NSUInteger *counter)
+{
+#if NSUIntegerMax == UINT64_MAX
+  return OSAtomicIncrement64((int64_t *)counter);
+#else
+  return OSAtomicIncrement32((int32_t *)counter);
+#endif
+}
 
 @implementation MgNode
 {
@@ -62,7 +75,9 @@ static NSUInteger version_counter;
   NSString *_name;
   NSPointerArray *_references;
   NSUInteger _version;
+  NSUInteger _profileIdentity;
   uint32_t _mark;			/* for graph traversal */
+  MgGraphCopySlot _copySlot;
 }
 
 + (instancetype)node
@@ -91,6 +106,7 @@ static NSUInteger version_counter;
     return nil;
 
   _version = 1;
+  _profileIdentity = atomic_increment(&identity_counter);
 
   Class state_class = [[self class] stateClass];
 
@@ -217,6 +233,7 @@ static NSUInteger version_counter;
 
   MgNodeState *state = [[[self class] stateClass] state];
 
+  state.moduleState = moduleState;
   state.superstate = [self addModuleState:moduleState.superstate];
 
   [self addState:state];
@@ -231,8 +248,13 @@ static NSUInteger version_counter;
      recursion, so we apply the state to the root object here to avoid
      that. */
 
+  uint64_t t0 = mg_profiling ? MgProfileTime() : 0;
+
   [self _setModuleState:moduleState options:dict];
 
+  if (t0 != 0)
+    MgProfileNodeApplied(self, t0);
+
   uint32_t mark = [MgNode nextMark];
 
   [self foreachNode:^(MgNode *child)
@@ -245,8 +267,13 @@ static NSUInteger version_counter;
 - (void)applyModuleState:(MgModuleState *)moduleState
     options:(NSDictionary *)dict mark:(uint32_t)mark
 {
+  uint64_t t0 = mg_profiling ? MgProfileTime() : 0;
+
   [self _setModuleState:moduleState options:dict];
 
+  if (t0 != 0)
+    MgProfileNodeApplied(self, t0);
+
   [self foreachNode:^(MgNode *child)
     {
       [child applyModuleState:moduleState options:dict mark:mark];
@@ -336,6 +363,8 @@ static NSUInteger version_counter;
       MgTransitionTiming *default_timing = [[MgTransitionTiming alloc] init];
       default_timing.duration = duration;
       default_timing.function = function;
+      default_timing.colorMixMode
+	= [dict[MgNodeTransitionColorMixMode] integerValue];
 
       MgNodeState *trans_from = old_state;
 
@@ -476,11 +505,12 @@ static NSUInteger version_counter;
 
 - (void)incrementVersion
 {
-#if NSUIntegerMax == UINT64_MAX
-  self.version = OSAtomicIncrement64((int64_t *)&version_counter);
-#else
-  self.version = OSAtomicIncrement32((int32_t *)&version_counter);
-#endif
+  self.version = atomic_increment(&version_counter);
+}
+
+- (void)didModifyState:(MgNodeState *)state
+{
+  [self incrementVersion];
 }
 
 + (BOOL)automaticallyNotifiesObserversOfReferences
@@ -568,9 +598,14 @@ static NSUInteger version_counter;
     {
       MgNodeState *old_state = _state;
 
+      uint64_t t0 = mg_profiling ? MgProfileTime() : 0;
+
       double tt = (t - trans.begin) * trans.speed;
       _state = [old_state evaluateTransition:trans atTime:tt];
 
+      if (t0 != 0)
+	MgProfileNodeEvaluated(self, t0);
+
       thunk();
 
       _state = old_state;
@@ -580,24 +615,32 @@ static NSUInteger version_counter;
 - (CFTimeInterval)markPresentationTime:(CFTimeInterval)t
 {
   MgActiveTransition *trans = self.activeTransition;
+  if (trans == nil)
+    return HUGE_VAL;
 
-  if (trans != nil)
-    {
-      double tt = (t - trans.begin) * trans.speed;
+  double speed = trans.speed;
+  double tt = (t - trans.begin) * speed;
 
-      if (!(tt < trans.duration))
-	{
-	  self.activeTransition = nil;
-	  trans = nil;
-	}
+  if (!(tt < trans.duration))
+    {
+      self.activeTransition = nil;
+      return HUGE_VAL;
     }
 
-  return trans == nil ? HUGE_VAL : t;
+  /* Nothing may change until the next property's delay expires, or
+     the transition is removed. */
+
+  double next = [trans nextChangeAfterTime:tt];
+
+  if (next == tt || !(speed > 0))
+    return t;
+  else
+    return trans.begin + next / speed;
 }
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgNode *copy = [[[self class] alloc] init];
 
@@ -618,6 +661,11 @@ static NSUInteger version_counter;
   return copy;
 }
 
+- (MgGraphCopySlot *)mg_graphCopySlot
+{
+  return &_copySlot;
+}
+
 /** NSSecureCoding methods. **/
 
 + (BOOL)supportsSecureCoding
@@ -35,6 +35,12 @@
 
 - (void)incrementVersion;
 
+/* Identifies the node to the transition profiler. Copies made only
+   for rendering take the identity of the node they were copied from,
+   so that their costs are charged to it. */
+
+@property(nonatomic) NSUInteger profileIdentity;
+
 /* Array of MgNode objects referring to this one. */
 
 @property(nonatomic, readonly) NSPointerArray *references;
@@ -28,11 +28,15 @@
 #import "MgCoreGraphics.h"
 #import "MgModuleState.h"
 #import "MgNodeTransition.h"
+#import "MgTransitionProfilerInternal.h"
 
 #import <Foundation/Foundation.h>
 #import <objc/runtime.h>
 
 @implementation MgNodeState
+{
+  MgGraphCopySlot _copySlot;
+}
 
 + (instancetype)state
 {
@@ -214,7 +218,14 @@ state_depth(MgNodeState *s)
 
   dest.superstate = trans.fromState;
 
-  [dest applyTransition:trans atTime:t to:self];
+  if (!mg_profiling)
+    [dest applyTransition:trans atTime:t to:self];
+  else
+    {
+      MgProfileBeginProperties(dest);
+      [dest applyTransition:trans atTime:t to:self];
+      MgProfileEndProperties();
+    }
 
   return dest;
 }
@@ -226,7 +237,7 @@ state_depth(MgNodeState *s)
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgNodeState *copy = [[[self class] alloc] init];
 
@@ -236,6 +247,11 @@ state_depth(MgNodeState *s)
   return copy;
 }
 
+- (MgGraphCopySlot *)mg_graphCopySlot
+{
+  return &_copySlot;
+}
+
 /** NSSecureCoding methods. **/
 
 + (BOOL)supportsSecureCoding
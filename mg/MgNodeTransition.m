@@ -129,7 +129,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgNodeTransition *copy = [[[self class] alloc] init];
 
@@ -26,6 +26,9 @@
 
 #import "MgCoderExtensions.h"
 #import "MgCoreGraphics.h"
+#import "MgDisplayList.h"
+#import "MgFlattenedPath.h"
+#import "MgFloatArray.h"
 #import "MgLayerInternal.h"
 #import "MgNodeInternal.h"
 #import "MgPathCALayer.h"
@@ -35,7 +38,45 @@
 
 #define STATE ((MgPathLayerState *)(self.state))
 
+/* Maximum distance between curves and their approximations used for
+   hit testing, in layer coordinates. */
+
+#define HIT_TOLERANCE ((CGFloat).05)
+
+typedef struct stroke_params stroke_params;
+
+struct stroke_params
+{
+  CGFloat lineWidth;
+  CGFloat miterLimit;
+  CGLineCap lineCap;
+  CGLineJoin lineJoin;
+  CGFloat lineDashPhase;
+};
+
+static bool
+stroke_params_equal(const stroke_params *a, const stroke_params *b)
+{
+  return (a->lineWidth == b->lineWidth
+	  && a->miterLimit == b->miterLimit
+	  && a->lineCap == b->lineCap
+	  && a->lineJoin == b->lineJoin
+	  && a->lineDashPhase == b->lineDashPhase);
+}
+
 @implementation MgPathLayer
+{
+  /* Shapes derived from _cachedPath, built on demand. Paths are
+     immutable, so these are valid until the path object changes (or
+     the stroke parameters do, for the stroke outline). */
+
+  id _cachedPath;			/* CGPathRef */
+  MgFlattenedPath *_fillShape;
+  id _strokePath;			/* CGPathRef */
+  MgFlattenedPath *_strokeShape;
+  stroke_params _strokeParams;
+  NSArray *_strokeDashPattern;
+}
 
 + (Class)stateClass
 {
@@ -44,8 +85,8 @@
 
 - (Class)viewLayerClass
 {
-  /* FIXME: this always uses CAShapeLayer. May be better to flatten
-     to a bitmap in some cases? */
+  /* The view context may still flatten complex paths to a bitmap,
+     see -[MgViewContext viewLayerClassForLayer:]. */
 
   return [MgPathCALayer class];
 }
@@ -280,6 +321,121 @@
     }
 }
 
+- (void)_validateCachesForPath:(CGPathRef)path
+{
+  if ((__bridge id)path != _cachedPath)
+    {
+      _cachedPath = (__bridge id)path;
+      _fillShape = nil;
+      _strokePath = nil;
+      _strokeShape = nil;
+    }
+}
+
+/* Returns the outline of the receiver's stroke, including any dash
+   pattern, as a path to be filled with the non-zero winding rule. */
+
+- (CGPathRef)_strokePath
+{
+  CGPathRef path = self.path;
+  if (path == NULL)
+    return NULL;
+
+  [self _validateCachesForPath:path];
+
+  stroke_params params;
+  params.lineWidth = self.lineWidth;
+  params.miterLimit = self.miterLimit;
+  params.lineCap = self.lineCap;
+  params.lineJoin = self.lineJoin;
+  params.lineDashPhase = self.lineDashPhase;
+
+  NSArray *pattern = self.lineDashPattern;
+
+  if (_strokePath != nil
+      && stroke_params_equal(&params, &_strokeParams)
+      && (pattern == _strokeDashPattern
+	  || [pattern isEqual:_strokeDashPattern]))
+    return (__bridge CGPathRef)_strokePath;
+
+  CGPathRef dashed = NULL;
+
+  MgFloatArray *lengths = [MgFloatArray floatArrayWithArray:pattern];
+  size_t count = [lengths count];
+  if (count != 0)
+    {
+      dashed = CGPathCreateCopyByDashingPath(path, NULL,
+				params.lineDashPhase, lengths.values, count);
+    }
+
+  CGPathRef sp = CGPathCreateCopyByStrokingPath(dashed != NULL ? dashed
+				: path, NULL, params.lineWidth,
+				params.lineCap, params.lineJoin,
+				params.miterLimit);
+  CGPathRelease(dashed);
+
+  _strokeParams = params;
+  _strokeDashPattern = lengths;
+  _strokePath = CFBridgingRelease(sp);
+  _strokeShape = nil;
+
+  return sp;
+}
+
+- (MgFlattenedPath *)_fillShape
+{
+  CGPathRef path = self.path;
+  if (path == NULL)
+    return nil;
+
+  [self _validateCachesForPath:path];
+
+  if (_fillShape == nil)
+    {
+      _fillShape = [[MgFlattenedPath alloc] initWithPath:path
+		    tolerance:HIT_TOLERANCE];
+    }
+
+  return _fillShape;
+}
+
+- (MgFlattenedPath *)_strokeShape
+{
+  CGPathRef sp = [self _strokePath];
+  if (sp == NULL)
+    return nil;
+
+  if (_strokeShape == nil)
+    {
+      _strokeShape = [[MgFlattenedPath alloc] initWithPath:sp
+		      tolerance:HIT_TOLERANCE];
+    }
+
+  return _strokeShape;
+}
+
+- (BOOL)_fillContainsPoint:(CGPoint)lp evenOdd:(BOOL)eo
+{
+  MgFlattenedPath *shape = [self _fillShape];
+
+  if (shape != nil)
+    return [shape containsPoint:lp evenOdd:eo];
+  else
+    return CGPathContainsPoint(self.path, NULL, lp, eo);
+}
+
+- (BOOL)_strokeContainsPoint:(CGPoint)lp
+{
+  MgFlattenedPath *shape = [self _strokeShape];
+
+  if (shape != nil)
+    return [shape containsPoint:lp evenOdd:NO];
+
+  CGPathRef sp = [self _strokePath];
+
+  return sp != NULL && CGPathContainsPoint(sp, NULL, lp, false);
+}
+
 - (BOOL)contentContainsPoint:(CGPoint)lp
 {
   CGPathRef path = self.path;
@@ -291,52 +447,82 @@
   switch (mode)
     {
     case kCGPathFill:
-    case kCGPathFillStroke:
-    case kCGPathStroke:			/* FIXME: incorrect */
-      return CGPathContainsPoint(path, NULL, lp, false);
+      return [self _fillContainsPoint:lp evenOdd:NO];
 
     case kCGPathEOFill:
+      return [self _fillContainsPoint:lp evenOdd:YES];
+
+    case kCGPathStroke:
+      return [self _strokeContainsPoint:lp];
+
+    case kCGPathFillStroke:
+      return ([self _fillContainsPoint:lp evenOdd:NO]
+	      || [self _strokeContainsPoint:lp]);
+
     case kCGPathEOFillStroke:
-      return CGPathContainsPoint(path, NULL, lp, true);
+      return ([self _fillContainsPoint:lp evenOdd:YES]
+	      || [self _strokeContainsPoint:lp]);
 
     default:
       return NO;
     }
 }
 
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  CGPathRef path = self.path;
+  if (path == NULL)
+    return CGRectNull;
+
+  CGRect r = CGPathGetPathBoundingBox(path);
+
+  CGPathDrawingMode mode = self.drawingMode;
+  if (mode == kCGPathFill || mode == kCGPathEOFill)
+    return r;
+
+  /* Half the line width, scaled up to cover miter joins and the
+     corners of square caps. */
+
+  CGFloat outset = self.lineWidth * (CGFloat).5;
+
+  if (self.lineJoin == kCGLineJoinMiter)
+    outset *= fmax(self.miterLimit, M_SQRT2);
+  else
+    outset *= M_SQRT2;
+
+  return CGRectInset(r, -outset, -outset);
+}
+
 - (void)_renderLayerWithState:(MgLayerRenderState *)rs
 {
   CGPathRef path = self.path;
   if (path == NULL)
     return;
 
-  CGContextSaveGState(rs->ctx);
+  MgRenderSaveGState(rs);
 
   switch (self.drawingMode)
     {
     case kCGPathFill:
     case kCGPathEOFill:
-      CGContextSetFillColorWithColor(rs->ctx, self.fillColor);
-      CGContextBeginPath(rs->ctx);
-      CGContextAddPath(rs->ctx, self.path);
-      CGContextFillPath(rs->ctx);
+      MgRenderSetFillColor(rs, self.fillColor);
+      MgRenderDrawPath(rs, path, kCGPathFill);
       break;
 
     default:
-      CGContextSetFillColorWithColor(rs->ctx, self.fillColor);
-      CGContextSetStrokeColorWithColor(rs->ctx, self.strokeColor);
-      CGContextSetLineWidth(rs->ctx, self.lineWidth);
-      CGContextSetMiterLimit(rs->ctx, self.miterLimit);
-      CGContextSetLineJoin(rs->ctx, self.lineJoin);
-      CGContextSetLineCap(rs->ctx, self.lineCap);
-      MgContextSetLineDash(rs->ctx, self.lineDashPattern, self.lineDashPhase);
-      CGContextBeginPath(rs->ctx);
-      CGContextAddPath(rs->ctx, self.path);
-      CGContextDrawPath(rs->ctx, self.drawingMode);
+      MgRenderSetFillColor(rs, self.fillColor);
+      MgRenderSetStrokeColor(rs, self.strokeColor);
+      MgRenderSetLineWidth(rs, self.lineWidth);
+      MgRenderSetMiterLimit(rs, self.miterLimit);
+      MgRenderSetLineJoin(rs, self.lineJoin);
+      MgRenderSetLineCap(rs, self.lineCap);
+      MgRenderSetLineDash(rs, self.lineDashPattern, self.lineDashPhase);
+      MgRenderDrawPath(rs, path, self.drawingMode);
       break;
     }
 
-  CGContextRestoreGState(rs->ctx);
+  MgRenderRestoreGState(rs);
 }
 
 - (void)_renderLayerMaskWithState:(MgLayerRenderState *)rs
@@ -357,18 +543,9 @@
 
   CGPathRef sp = NULL;
   if (mode != kCGPathFill && mode != kCGPathEOFill)
-    {
-      sp = CGPathCreateCopyByStrokingPath(p, NULL, self.lineWidth,
-				self.lineCap, self.lineJoin, self.miterLimit);
-    }
-
-  CGContextBeginPath(rs->ctx);
-  CGContextAddPath(rs->ctx, p);
-  if (sp != NULL)
-    CGContextAddPath(rs->ctx, sp);
-  CGContextClip(rs->ctx);
+    sp = [self _strokePath];
 
-  CGPathRelease(sp);
+  MgRenderClipToPaths(rs, p, sp);
 }
 
 /** NSKeyValueCoding methods. **/
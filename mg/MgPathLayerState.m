@@ -27,12 +27,37 @@
 #import "MgActiveTransition.h"
 #import "MgCoderExtensions.h"
 #import "MgCoreGraphics.h"
+#import "MgFloatArray.h"
 #import "MgNodeTransition.h"
+#import "MgPathMorph.h"
 
 #import <Foundation/Foundation.h>
 
 #define SUPERSTATE ((MgPathLayerState *)(self.superstate))
 
+/* Returns the path `t' of the way from `a' to `b'. The correspondence
+   between the two paths is computed once and kept by `trans'. */
+
+static CGPathRef
+path_mix(CGPathRef a, CGPathRef b, double t, MgActiveTransition *trans)
+{
+  if (a == b || a == NULL || b == NULL || t == 0 || t == 1)
+    return CGPathRetain(t < .5 ? a : b);
+
+  MgPathMorph *morph = [trans cachedObjectForKey:@"path"];
+
+  if (morph == nil || morph.fromPath != a || morph.toPath != b)
+    {
+      morph = [[MgPathMorph alloc] initWithFromPath:a toPath:b];
+      if (morph == nil)
+	return CGPathRetain(t < .5 ? a : b);
+
+      [trans setCachedObject:morph forKey:@"path"];
+    }
+
+  return [morph copyPathAtTime:t];
+}
+
 @implementation MgPathLayerState
 {
   id _path;				/* CGPathRef */
@@ -144,19 +169,30 @@
 {
   MgPathLayerState *to = (MgPathLayerState *)to_;
   double t_;
+  MgColorMixMode mode;
 
   [super applyTransition:trans atTime:t to:to];
 
+  t_ = trans != nil ? [trans evaluateTime:t forKey:@"path"] : t;
+  _path = CFBridgingRelease(path_mix(self.path, to.path, t_, trans));
+  _defines.path = true;
+
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"drawingMode"] : t;
   _drawingMode = t_ < .5 ? self.drawingMode : to.drawingMode;
   _defines.drawingMode = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"fillColor"] : t;
-  _fillColor = CFBridgingRelease(MgColorMix(self.fillColor, to.fillColor, t_));
+  mode = (trans != nil ? [trans colorMixModeForKey:@"fillColor"]
+	  : MgColorMixSRGB);
+  _fillColor = CFBridgingRelease(MgColorMixWithMode(self.fillColor,
+						    to.fillColor, t_, mode));
   _defines.fillColor = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"strokeColor"] : t;
-  _strokeColor = CFBridgingRelease(MgColorMix(self.strokeColor, to.strokeColor, t_));
+  mode = (trans != nil ? [trans colorMixModeForKey:@"strokeColor"]
+	  : MgColorMixSRGB);
+  _strokeColor = CFBridgingRelease(MgColorMixWithMode(self.strokeColor,
+						      to.strokeColor, t_, mode));
   _defines.strokeColor = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"lineWidth"] : t;
@@ -339,14 +375,14 @@
 - (void)setLineDashPattern:(NSArray *)array
 {
   if (_defines.lineDashPattern)
-    _lineDashPattern = [array copy];
+    _lineDashPattern = [MgFloatArray floatArrayWithArray:array];
   else
     SUPERSTATE.lineDashPattern = array;
 }
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgPathLayerState *copy = [super graphCopy:map];
 
@@ -464,7 +500,9 @@
 
   if ([c containsValueForKey:@"lineDashPattern"])
     {
-      _lineDashPattern = [c decodeObjectOfClass:[NSArray class] forKey:@"lineDashPattern"];
+      _lineDashPattern = [MgFloatArray floatArrayWithArray:
+			  [c decodeObjectOfClass:[NSArray class]
+			   forKey:@"lineDashPattern"]];
       _defines.lineDashPattern = true;
     }
 
@@ -0,0 +1,47 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgBase.h"
+
+/* Interpolates between two paths. When created, both paths are
+   converted to cubic segments, their contours are paired up (adding
+   degenerate contours to the path with fewer), contours with fewer
+   segments are subdivided until each pair has the same number, and
+   closed contours are rotated to minimize the distance their points
+   move. After that each intermediate path is a linear mix of the two
+   sets of control points. */
+
+@interface MgPathMorph : NSObject
+
+- (id)initWithFromPath:(CGPathRef)from toPath:(CGPathRef)to;
+
+@property(nonatomic, readonly) CGPathRef fromPath;
+@property(nonatomic, readonly) CGPathRef toPath;
+
+/* Safe to call from multiple threads. */
+
+- (CGPathRef)copyPathAtTime:(double)t CF_RETURNS_RETAINED;
+
+@end
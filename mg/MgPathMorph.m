@@ -0,0 +1,614 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgPathMorph.h"
+
+#import "MgCoreGraphics.h"
+
+#import <Foundation/Foundation.h>
+
+#import "MgMacros.h"
+
+/* Closed contours with more segments than this aren't rotated, as
+   finding the best rotation is quadratic. */
+
+#define MAX_ROTATION_SEGMENTS 512
+
+/* A contour is its start point followed by three points per cubic
+   segment. Closed contours end at their start point. */
+
+typedef struct morph_contour morph_contour;
+
+struct morph_contour
+{
+  CGPoint *points;
+  size_t count, size;
+  bool closed;
+};
+
+typedef struct morph_path morph_path;
+
+struct morph_path
+{
+  morph_contour *contours;
+  size_t count, size;
+  CGPoint current;
+  bool failed;
+};
+
+typedef struct morph_pair morph_pair;
+
+struct morph_pair
+{
+  uint32_t segments;
+  bool from_closed;
+  bool to_closed;
+};
+
+static bool
+reserve(void **ptr, size_t *size, size_t needed, size_t elt)
+{
+  if (needed <= *size)
+    return true;
+
+  size_t new_size = *size != 0 ? *size : 16;
+  while (new_size < needed)
+    new_size *= 2;
+
+  void *new_ptr = realloc(*ptr, new_size * elt);
+  if (new_ptr == NULL)
+    return false;
+
+  *ptr = new_ptr;
+  *size = new_size;
+  return true;
+}
+
+static size_t
+contour_segments(const morph_contour *c)
+{
+  return (c->count - 1) / 3;
+}
+
+static bool
+contour_add_points(morph_contour *c, const CGPoint *p, size_t n)
+{
+  if (!reserve((void **)&c->points, &c->size, c->count + n, sizeof(CGPoint)))
+    return false;
+
+  memcpy(c->points + c->count, p, n * sizeof(CGPoint));
+  c->count += n;
+  return true;
+}
+
+static void
+path_free(morph_path *mp)
+{
+  for (size_t i = 0; i < mp->count; i++)
+    free(mp->contours[i].points);
+
+  free(mp->contours);
+}
+
+static void
+path_move_to(morph_path *mp, CGPoint p)
+{
+  if (!reserve((void **)&mp->contours, &mp->size, mp->count + 1,
+	       sizeof(morph_contour)))
+    {
+      mp->failed = true;
+      return;
+    }
+
+  morph_contour *c = &mp->contours[mp->count++];
+  memset(c, 0, sizeof(*c));
+
+  if (!contour_add_points(c, &p, 1))
+    mp->failed = true;
+
+  mp->current = p;
+}
+
+static void
+path_curve_to(morph_path *mp, CGPoint c1, CGPoint c2, CGPoint p)
+{
+  /* Drawing after a close continues from the start of the closed
+     contour, in a new contour. */
+
+  if (mp->count == 0 || mp->contours[mp->count - 1].closed)
+    {
+      path_move_to(mp, mp->current);
+      if (mp->failed)
+	return;
+    }
+
+  CGPoint pts[3] = {c1, c2, p};
+
+  if (!contour_add_points(&mp->contours[mp->count - 1], pts, 3))
+    mp->failed = true;
+
+  mp->current = p;
+}
+
+static void
+path_line_to(morph_path *mp, CGPoint p)
+{
+  CGPoint a = mp->current;
+
+  path_curve_to(mp, CGPointMake(a.x + (p.x - a.x) * (CGFloat)(1./3),
+				a.y + (p.y - a.y) * (CGFloat)(1./3)),
+		CGPointMake(a.x + (p.x - a.x) * (CGFloat)(2./3),
+			    a.y + (p.y - a.y) * (CGFloat)(2./3)), p);
+}
+
+static void
+path_close(morph_path *mp)
+{
+  if (mp->count == 0)
+    return;
+
+  morph_contour *c = &mp->contours[mp->count - 1];
+  if (c->closed)
+    return;
+
+  CGPoint start = c->points[0];
+  CGPoint last = c->points[c->count - 1];
+
+  if (c->count > 1 && (last.x != start.x || last.y != start.y))
+    {
+      path_line_to(mp, start);
+      if (mp->failed)
+	return;
+      c = &mp->contours[mp->count - 1];
+    }
+
+  c->closed = true;
+  mp->current = start;
+}
+
+static void
+path_apply(void *info, const CGPathElement *e)
+{
+  morph_path *mp = info;
+
+  if (mp->failed)
+    return;
+
+  const CGPoint *p = e->points;
+  CGPoint a = mp->current;
+
+  switch (e->type)
+    {
+    case kCGPathElementMoveToPoint:
+      path_move_to(mp, p[0]);
+      break;
+
+    case kCGPathElementAddLineToPoint:
+      path_line_to(mp, p[0]);
+      break;
+
+    case kCGPathElementAddQuadCurveToPoint:
+      /* Degree elevation. */
+      path_curve_to(mp, CGPointMake(a.x + (p[0].x - a.x) * (CGFloat)(2./3),
+				    a.y + (p[0].y - a.y) * (CGFloat)(2./3)),
+		    CGPointMake(p[1].x + (p[0].x - p[1].x) * (CGFloat)(2./3),
+				p[1].y + (p[0].y - p[1].y) * (CGFloat)(2./3)),
+		    p[1]);
+      break;
+
+    case kCGPathElementAddCurveToPoint:
+      path_curve_to(mp, p[0], p[1], p[2]);
+      break;
+
+    case kCGPathElementCloseSubpath:
+      path_close(mp);
+      break;
+    }
+}
+
+static bool
+path_init(morph_path *mp, CGPathRef path)
+{
+  memset(mp, 0, sizeof(*mp));
+
+  CGPathApply(path, mp, path_apply);
+
+  /* Drop contours without any segments. */
+
+  size_t j = 0;
+  for (size_t i = 0; i < mp->count; i++)
+    {
+      if (mp->contours[i].count < 4)
+	free(mp->contours[i].points);
+      else
+	mp->contours[j++] = mp->contours[i];
+    }
+  mp->count = j;
+
+  if (mp->failed)
+    {
+      path_free(mp);
+      return false;
+    }
+
+  return true;
+}
+
+/* Makes `c' a contour of `n' segments with all points at the centroid
+   of `other's on-curve points. */
+
+static bool
+contour_init_degenerate(morph_contour *c, const morph_contour *other,
+			size_t n)
+{
+  memset(c, 0, sizeof(*c));
+
+  CGFloat x = 0, y = 0;
+  size_t m = contour_segments(other);
+
+  for (size_t i = 0; i < m; i++)
+    {
+      x += other->points[3*i + 3].x;
+      y += other->points[3*i + 3].y;
+    }
+
+  CGPoint p = CGPointMake(x / m, y / m);
+
+  if (!reserve((void **)&c->points, &c->size, 3*n + 1, sizeof(CGPoint)))
+    return false;
+
+  for (size_t i = 0; i < 3*n + 1; i++)
+    c->points[i] = p;
+
+  c->count = 3*n + 1;
+  c->closed = other->closed;
+  return true;
+}
+
+static CGFloat
+segment_length(const CGPoint *p)
+{
+  return (hypot(p[1].x - p[0].x, p[1].y - p[0].y)
+	  + hypot(p[2].x - p[1].x, p[2].y - p[1].y)
+	  + hypot(p[3].x - p[2].x, p[3].y - p[2].y));
+}
+
+/* Splits the cubic at `p[0..3]' at parameter `t', writing the first
+   part to `l[0..3]' and the second to `r[0..3]'. */
+
+static void
+segment_split(const CGPoint *p, CGFloat t, CGPoint *l, CGPoint *r)
+{
+  CGPoint p01 = MgPointMix(p[0], p[1], t);
+  CGPoint p12 = MgPointMix(p[1], p[2], t);
+  CGPoint p23 = MgPointMix(p[2], p[3], t);
+  CGPoint p012 = MgPointMix(p01, p12, t);
+  CGPoint p123 = MgPointMix(p12, p23, t);
+  CGPoint m = MgPointMix(p012, p123, t);
+
+  l[0] = p[0], l[1] = p01, l[2] = p012, l[3] = m;
+  r[0] = m, r[1] = p123, r[2] = p23, r[3] = p[3];
+}
+
+/* Subdivides the segments of `c' until it has `n' of them, giving
+   each new piece to whichever segment has the longest pieces. */
+
+static bool
+contour_subdivide(morph_contour *c, size_t n)
+{
+  size_t m = contour_segments(c);
+  if (m >= n)
+    return true;
+
+  CGFloat *lengths = malloc(m * sizeof(CGFloat));
+  size_t *pieces = malloc(m * sizeof(size_t));
+  CGPoint *points = malloc((3*n + 1) * sizeof(CGPoint));
+
+  if (lengths == NULL || pieces == NULL || points == NULL)
+    {
+      free(lengths);
+      free(pieces);
+      free(points);
+      return false;
+    }
+
+  for (size_t i = 0; i < m; i++)
+    {
+      lengths[i] = segment_length(c->points + 3*i);
+      pieces[i] = 1;
+    }
+
+  for (size_t k = m; k < n; k++)
+    {
+      size_t best = 0;
+      for (size_t i = 1; i < m; i++)
+	{
+	  if (lengths[i] * pieces[best] > lengths[best] * pieces[i])
+	    best = i;
+	}
+      pieces[best]++;
+    }
+
+  CGPoint *out = points;
+  *out = c->points[0];
+
+  for (size_t i = 0; i < m; i++)
+    {
+      CGPoint seg[4], l[4];
+      memcpy(seg, c->points + 3*i, sizeof(seg));
+
+      /* Cut off equal-parameter pieces from the front. */
+
+      for (size_t j = pieces[i]; j > 1; j--)
+	{
+	  segment_split(seg, (CGFloat)1 / j, l, seg);
+	  memcpy(out + 1, l + 1, 3 * sizeof(CGPoint));
+	  out += 3;
+	}
+
+      memcpy(out + 1, seg + 1, 3 * sizeof(CGPoint));
+      out += 3;
+    }
+
+  free(lengths);
+  free(pieces);
+  free(c->points);
+
+  c->points = points;
+  c->count = c->size = 3*n + 1;
+  return true;
+}
+
+/* Rotates closed contour `c' so that its on-curve points are as close
+   as possible to those of `other' (which has the same number of
+   segments). */
+
+static bool
+contour_align(morph_contour *c, const morph_contour *other)
+{
+  size_t n = contour_segments(c);
+
+  if (!c->closed || !other->closed || n < 2 || n > MAX_ROTATION_SEGMENTS)
+    return true;
+
+  size_t best_k = 0;
+  CGFloat best_d = HUGE_VAL;
+
+  for (size_t k = 0; k < n; k++)
+    {
+      CGFloat d = 0;
+      for (size_t i = 0; i < n && d < best_d; i++)
+	{
+	  CGPoint a = other->points[3*i + 3];
+	  CGPoint b = c->points[3*((i + k) % n) + 3];
+	  d += (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+	}
+      if (d < best_d)
+	best_d = d, best_k = k;
+    }
+
+  if (best_k == 0)
+    return true;
+
+  CGPoint *points = malloc(c->count * sizeof(CGPoint));
+  if (points == NULL)
+    return false;
+
+  /* Segment `i' of the result is segment `i + k' of the original, so
+     the new start point is the end of segment `k - 1'. */
+
+  points[0] = c->points[3*(best_k - 1) + 3];
+
+  for (size_t i = 0; i < n; i++)
+    {
+      memcpy(points + 3*i + 1, c->points + 3*((i + best_k) % n) + 1,
+	     3 * sizeof(CGPoint));
+    }
+
+  free(c->points);
+  c->points = points;
+  c->size = c->count;
+  return true;
+}
+
+@implementation MgPathMorph
+{
+  id _fromPath;				/* CGPathRef */
+  id _toPath;				/* CGPathRef */
+  morph_pair *_pairs;
+  size_t _pairCount;
+  CGFloat *_coords;			/* from, then to */
+  size_t _coordCount;			/* of each */
+}
+
+- (BOOL)_initPairs:(morph_path *)from to:(morph_path *)to
+{
+  size_t count = from->count > to->count ? from->count : to->count;
+
+  _pairs = calloc(count, sizeof(morph_pair));
+  if (count != 0 && _pairs == NULL)
+    return NO;
+
+  /* Pad the path with fewer contours, then match segment counts and
+     starting points. */
+
+  for (size_t i = 0; i < count; i++)
+    {
+      morph_path *short_path = NULL, *long_path = NULL;
+
+      if (i >= from->count)
+	short_path = from, long_path = to;
+      else if (i >= to->count)
+	short_path = to, long_path = from;
+
+      if (short_path != NULL)
+	{
+	  morph_contour *other = &long_path->contours[i];
+
+	  if (!reserve((void **)&short_path->contours, &short_path->size,
+		       i + 1, sizeof(morph_contour)))
+	    return NO;
+
+	  if (!contour_init_degenerate(&short_path->contours[i], other,
+				       contour_segments(other)))
+	    return NO;
+
+	  short_path->count = i + 1;
+	}
+
+      morph_contour *a = &from->contours[i];
+      morph_contour *b = &to->contours[i];
+
+      size_t na = contour_segments(a), nb = contour_segments(b);
+      size_t n = na > nb ? na : nb;
+
+      if (n > UINT32_MAX
+	  || !contour_subdivide(a, n)
+	  || !contour_subdivide(b, n)
+	  || !contour_align(b, a))
+	return NO;
+
+      _pairs[i].segments = (uint32_t)n;
+      _pairs[i].from_closed = a->closed;
+      _pairs[i].to_closed = b->closed;
+      _coordCount += (3*n + 1) * 2;
+    }
+
+  _pairCount = count;
+
+  _coords = malloc(_coordCount * 2 * sizeof(CGFloat));
+  if (_coordCount != 0 && _coords == NULL)
+    return NO;
+
+  CGFloat *p = _coords, *q = _coords + _coordCount;
+
+  for (size_t i = 0; i < count; i++)
+    {
+      const morph_contour *a = &from->contours[i];
+      const morph_contour *b = &to->contours[i];
+
+      memcpy(p, a->points, a->count * sizeof(CGPoint));
+      memcpy(q, b->points, b->count * sizeof(CGPoint));
+      p += a->count * 2;
+      q += b->count * 2;
+    }
+
+  return YES;
+}
+
+- (id)initWithFromPath:(CGPathRef)from toPath:(CGPathRef)to
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  if (from == NULL || to == NULL)
+    return nil;
+
+  _fromPath = (__bridge id)from;
+  _toPath = (__bridge id)to;
+
+  morph_path from_mp, to_mp;
+
+  if (!path_init(&from_mp, from))
+    return nil;
+
+  if (!path_init(&to_mp, to))
+    {
+      path_free(&from_mp);
+      return nil;
+    }
+
+  BOOL ok = [self _initPairs:&from_mp to:&to_mp];
+
+  path_free(&from_mp);
+  path_free(&to_mp);
+
+  return ok ? self : nil;
+}
+
+- (void)dealloc
+{
+  free(_pairs);
+  free(_coords);
+}
+
+- (CGPathRef)fromPath
+{
+  return (__bridge CGPathRef)_fromPath;
+}
+
+- (CGPathRef)toPath
+{
+  return (__bridge CGPathRef)_toPath;
+}
+
+- (CGPathRef)copyPathAtTime:(double)t
+{
+  if (t == 0)
+    return CGPathRetain((__bridge CGPathRef)_fromPath);
+  else if (t == 1)
+    return CGPathRetain((__bridge CGPathRef)_toPath);
+
+  CGFloat *coords = STACK_ALLOC(CGFloat, _coordCount);
+  if (coords == NULL && _coordCount != 0)
+    return NULL;
+
+  /* A straight loop over both arrays, which the compiler vectorizes. */
+
+  const CGFloat *a = _coords, *b = _coords + _coordCount;
+  CGFloat u = (CGFloat)t;
+
+  for (size_t i = 0; i < _coordCount; i++)
+    coords[i] = a[i] + (b[i] - a[i]) * u;
+
+  CGMutablePathRef path = CGPathCreateMutable();
+
+  const CGPoint *p = (const CGPoint *)coords;
+
+  for (size_t i = 0; i < _pairCount; i++)
+    {
+      const morph_pair *pair = &_pairs[i];
+
+      CGPathMoveToPoint(path, NULL, p[0].x, p[0].y);
+      p += 1;
+
+      for (uint32_t j = 0; j < pair->segments; j++)
+	{
+	  CGPathAddCurveToPoint(path, NULL, p[0].x, p[0].y,
+				p[1].x, p[1].y, p[2].x, p[2].y);
+	  p += 3;
+	}
+
+      if (t < .5 ? pair->from_closed : pair->to_closed)
+	CGPathCloseSubpath(path);
+    }
+
+  STACK_FREE(CGFloat, _coordCount, coords);
+
+  return path;
+}
+
+@end
@@ -26,6 +26,7 @@
 
 #import "MgCoderExtensions.h"
 #import "MgCoreGraphics.h"
+#import "MgDisplayList.h"
 #import "MgLayerInternal.h"
 #import "MgNodeInternal.h"
 #import "MgRectCALayer.h"
@@ -170,7 +171,7 @@
 }
 
 static void
-draw_rect(CGContextRef ctx, bool stroke,
+draw_rect(MgLayerRenderState *rs, bool stroke,
 	  CGRect r, CGFloat radius, CGFloat width)
 {
   if (stroke)
@@ -179,25 +180,31 @@ draw_rect(CGContextRef ctx, bool stroke,
   if (radius == 0)
     {
       if (!stroke)
-	CGContextFillRect(ctx, r);
+	MgRenderFillRect(rs, r);
       else
-	CGContextStrokeRectWithWidth(ctx, r, width);
+	MgRenderStrokeRect(rs, r, width);
     }
   else
     {
       if (stroke)
-	CGContextSetLineWidth(ctx, width);
-      CGContextBeginPath(ctx);
+	MgRenderSetLineWidth(rs, width);
       CGPathRef p = MgPathCreateWithRoundRect(r, radius);
-      CGContextAddPath(ctx, p);
+      MgRenderDrawPath(rs, p, stroke ? kCGPathStroke : kCGPathFill);
       CGPathRelease(p);
-      CGContextDrawPath(ctx, stroke ? kCGPathStroke : kCGPathFill);
     }
 }
 
+- (CGRect)_computeContentBoundsAtTime:(CFTimeInterval)t
+    animated:(bool *)animated
+{
+  /* Strokes are inset, so never extend outside the bounds. */
+
+  return self.bounds;
+}
+
 - (void)_renderLayerWithState:(MgLayerRenderState *)rs
 {
-  CGContextSaveGState(rs->ctx);
+  MgRenderSaveGState(rs);
 
   CGFloat radius = self.cornerRadius;
   CGPathDrawingMode mode = self.drawingMode;
@@ -208,8 +215,8 @@ draw_rect(CGContextRef ctx, bool stroke,
     case kCGPathEOFill:
     case kCGPathFillStroke:
     case kCGPathEOFillStroke:
-      CGContextSetFillColorWithColor(rs->ctx, self.fillColor);
-      draw_rect(rs->ctx, false, self.bounds, radius, 0);
+      MgRenderSetFillColor(rs, self.fillColor);
+      draw_rect(rs, false, self.bounds, radius, 0);
       break;
     default:
       break;
@@ -220,14 +227,14 @@ draw_rect(CGContextRef ctx, bool stroke,
     case kCGPathStroke:
     case kCGPathFillStroke:
     case kCGPathEOFillStroke:
-      CGContextSetStrokeColorWithColor(rs->ctx, self.strokeColor);
-      draw_rect(rs->ctx, true, self.bounds, radius, self.lineWidth);
+      MgRenderSetStrokeColor(rs, self.strokeColor);
+      draw_rect(rs, true, self.bounds, radius, self.lineWidth);
       break;
     default:
       break;
     }
 
-  CGContextRestoreGState(rs->ctx);
+  MgRenderRestoreGState(rs);
 }
 
 - (void)_renderLayerMaskWithState:(MgLayerRenderState *)rs
@@ -250,7 +257,7 @@ draw_rect(CGContextRef ctx, bool stroke,
 
   if (radius == 0 && (mode == kCGPathFill || mode == kCGPathEOFill))
     {
-      CGContextClipToRect(rs->ctx, self.bounds);
+      MgRenderClipToRect(rs, self.bounds);
       return;
     }
 
@@ -262,11 +269,7 @@ draw_rect(CGContextRef ctx, bool stroke,
 					kCGLineCapButt, kCGLineJoinMiter, 10);
     }
 
-  CGContextBeginPath(rs->ctx);
-  CGContextAddPath(rs->ctx, p);
-  if (sp != NULL)
-    CGContextAddPath(rs->ctx, sp);
-  CGContextClip(rs->ctx);
+  MgRenderClipToPaths(rs, p, sp);
 
   CGPathRelease(sp);
   CGPathRelease(p);
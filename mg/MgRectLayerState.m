@@ -104,6 +104,7 @@
 {
   MgRectLayerState *to = (MgRectLayerState *)to_;
   double t_;
+  MgColorMixMode mode;
 
   [super applyTransition:trans atTime:t to:to];
 
@@ -116,11 +117,17 @@
   _defines.drawingMode = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"fillColor"] : t;
-  _fillColor = CFBridgingRelease(MgColorMix(self.fillColor, to.fillColor, t_));
+  mode = (trans != nil ? [trans colorMixModeForKey:@"fillColor"]
+	  : MgColorMixSRGB);
+  _fillColor = CFBridgingRelease(MgColorMixWithMode(self.fillColor,
+						    to.fillColor, t_, mode));
   _defines.fillColor = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"strokeColor"] : t;
-  _strokeColor = CFBridgingRelease(MgColorMix(self.strokeColor, to.strokeColor, t_));
+  mode = (trans != nil ? [trans colorMixModeForKey:@"strokeColor"]
+	  : MgColorMixSRGB);
+  _strokeColor = CFBridgingRelease(MgColorMixWithMode(self.strokeColor,
+						      to.strokeColor, t_, mode));
   _defines.strokeColor = true;
 
   t_ = trans != nil ? [trans evaluateTime:t forKey:@"lineWidth"] : t;
@@ -210,7 +217,7 @@
 
 /** MgGraphCopying methods. **/
 
-- (id)graphCopy:(NSMapTable *)map
+- (id)graphCopy:(MgGraphCopyMap *)map
 {
   MgRectLayerState *copy = [super graphCopy:map];
 
@@ -0,0 +1,73 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgLayer.h"
+
+/* Instrumentation for -[MgLayer renderInContext:...trace:]. A trace
+   accumulates counters and drawing time per layer class over any
+   number of frames and, if `recordsEvents' is set, a timeline of every
+   layer drawn, which can be written in the Chrome trace-event format
+   (for chrome://tracing or Perfetto) to find the nodes responsible for
+   slow frames.
+
+   A trace must only be passed to one rendering call at a time. */
+
+@interface MgRenderTrace : NSObject
+
++ (instancetype)trace;
+
+/* If true, each frame and each layer drawn adds an event to the
+   timeline. Defaults to false. */
+
+@property(nonatomic, assign) BOOL recordsEvents;
+
+/* The number of frames rendered with the trace. */
+
+@property(nonatomic, readonly) NSUInteger frameCount;
+
+/* The counters summed over all classes and frames. */
+
+@property(nonatomic, readonly) MgLayerRenderStats totals;
+
+/* Maps class names to dictionaries of the MgLayerRenderStats counters
+   for layers of that class (keys `visited', `culled', `drawn',
+   `transparencyLayers', `masks', `imagesDrawn', `imagesDecoded',
+   `bytesRasterized' and `listsReplayed'), plus `time', the seconds
+   spent drawing those layers excluding the time spent in their
+   sublayers. */
+
+@property(nonatomic, readonly) NSDictionary *statistics;
+
+/* The recorded timeline as Chrome trace-event JSON. */
+
+- (NSData *)traceEventData;
+
+- (BOOL)writeTraceEventsToURL:(NSURL *)url error:(NSError **)err;
+
+/* Discards everything collected so far. */
+
+- (void)reset;
+
+@end
@@ -0,0 +1,452 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgRenderTraceInternal.h"
+
+#import <Foundation/Foundation.h>
+#import <mach/mach_time.h>
+
+/* Events and frames past these many are dropped, so that a trace left
+   recording can't grow without bound. */
+
+#define MAX_EVENTS 1000000
+#define MAX_FRAMES 100000
+
+typedef struct trace_class trace_class;
+typedef struct trace_span trace_span;
+typedef struct trace_event trace_event;
+typedef struct trace_frame trace_frame;
+
+/* Stats must be the first member, -_statsForClass: returns a pointer
+   to it that -_beginLayer:stats: casts back. */
+
+struct trace_class
+{
+  MgLayerRenderStats stats;
+  uint64_t time;			/* excluding sublayers */
+  __unsafe_unretained Class cls;
+};
+
+/* A layer whose contents are being drawn. */
+
+struct trace_span
+{
+  uint64_t begin;
+  uint64_t children;			/* time in nested spans */
+  trace_class *c;
+  NSInteger name;			/* index in _names, or -1 */
+};
+
+struct trace_event
+{
+  uint64_t begin;
+  uint64_t duration;
+  trace_class *c;
+  NSInteger name;
+};
+
+struct trace_frame
+{
+  uint64_t begin;
+  uint64_t duration;
+  CFTimeInterval time;
+  MgLayerRenderStats stats;
+};
+
+static double ticks_per_us;
+
+static double
+ticks_to_us(uint64_t t)
+{
+  return t / ticks_per_us;
+}
+
+@implementation MgRenderTrace
+{
+  BOOL _recordsEvents;
+  NSUInteger _frameCount;
+  MgLayerRenderStats _totals;
+
+  trace_class **_classes;
+  size_t _classCount;
+
+  trace_span *_spans;
+  size_t _spanCount;
+  size_t _spanCapacity;
+
+  trace_event *_events;
+  size_t _eventCount;
+  size_t _eventCapacity;
+
+  trace_frame *_frames;
+  size_t _frameEventCount;
+  size_t _frameEventCapacity;
+
+  NSUInteger _droppedEvents;
+
+  BOOL _recordingFrame;
+  MgLayerRenderStats _frameTotals;
+
+  NSMutableArray *_names;
+  NSMutableDictionary *_nameIndex;
+}
+
+@synthesize recordsEvents = _recordsEvents;
+@synthesize frameCount = _frameCount;
+@synthesize totals = _totals;
+
++ (void)initialize
+{
+  if (self == [MgRenderTrace class])
+    {
+      mach_timebase_info_data_t info;
+      mach_timebase_info(&info);
+      ticks_per_us = 1e3 * info.denom / info.numer;
+    }
+}
+
++ (instancetype)trace
+{
+  return [[self alloc] init];
+}
+
+- (id)init
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _names = [[NSMutableArray alloc] init];
+  _nameIndex = [[NSMutableDictionary alloc] init];
+
+  return self;
+}
+
+- (void)dealloc
+{
+  for (size_t i = 0; i < _classCount; i++)
+    free(_classes[i]);
+
+  free(_classes);
+  free(_spans);
+  free(_events);
+  free(_frames);
+}
+
+- (void)reset
+{
+  /* Class entries may be referenced by a frame in progress, so only
+     their contents are cleared. */
+
+  for (size_t i = 0; i < _classCount; i++)
+    {
+      memset(&_classes[i]->stats, 0, sizeof(MgLayerRenderStats));
+      _classes[i]->time = 0;
+    }
+
+  memset(&_totals, 0, sizeof(_totals));
+  _frameCount = 0;
+  _eventCount = 0;
+  _frameEventCount = 0;
+  _droppedEvents = 0;
+
+  [_names removeAllObjects];
+  [_nameIndex removeAllObjects];
+}
+
+/** Statistics. **/
+
+static NSDictionary *
+stats_dictionary(const MgLayerRenderStats *s)
+{
+  return @{
+    @"visited": @(s->visited),
+    @"culled": @(s->culled),
+    @"drawn": @(s->drawn),
+    @"transparencyLayers": @(s->transparency_layers),
+    @"masks": @(s->masks),
+    @"imagesDrawn": @(s->images_drawn),
+    @"imagesDecoded": @(s->images_decoded),
+    @"bytesRasterized": @(s->bytes_rasterized),
+    @"listsReplayed": @(s->lists_replayed),
+  };
+}
+
+- (NSDictionary *)statistics
+{
+  NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+
+  for (size_t i = 0; i < _classCount; i++)
+    {
+      trace_class *c = _classes[i];
+
+      NSMutableDictionary *sub
+        = [stats_dictionary(&c->stats) mutableCopy];
+      sub[@"time"] = @(ticks_to_us(c->time) * 1e-6);
+
+      dict[NSStringFromClass(c->cls)] = sub;
+    }
+
+  return dict;
+}
+
+/** Recording. **/
+
+- (MgLayerRenderStats *)_beginFrameAtTime:(CFTimeInterval)t
+{
+  _frameTotals = _totals;
+  _recordingFrame = _recordsEvents;
+
+  if (_recordingFrame && _frameEventCount == MAX_FRAMES)
+    _recordingFrame = NO;
+
+  if (_recordingFrame && _frameEventCount == _frameEventCapacity)
+    {
+      size_t capacity = MAX(_frameEventCapacity * 2, 64);
+      trace_frame *frames = realloc(_frames, capacity * sizeof(trace_frame));
+
+      if (frames != NULL)
+	{
+	  _frames = frames;
+	  _frameEventCapacity = capacity;
+	}
+      else
+	_recordingFrame = NO;
+    }
+
+  if (!_recordingFrame && _recordsEvents)
+    _droppedEvents++;
+
+  if (_recordingFrame)
+    {
+      trace_frame *f = &_frames[_frameEventCount];
+      f->begin = mach_absolute_time();
+      f->duration = 0;
+      f->time = t;
+    }
+
+  return &_totals;
+}
+
+- (void)_endFrame
+{
+  _frameCount++;
+
+  if (_recordingFrame)
+    {
+      trace_frame *f = &_frames[_frameEventCount++];
+      f->duration = mach_absolute_time() - f->begin;
+
+      f->stats.visited = _totals.visited - _frameTotals.visited;
+      f->stats.culled = _totals.culled - _frameTotals.culled;
+      f->stats.drawn = _totals.drawn - _frameTotals.drawn;
+      f->stats.transparency_layers
+        = _totals.transparency_layers - _frameTotals.transparency_layers;
+      f->stats.masks = _totals.masks - _frameTotals.masks;
+      f->stats.images_drawn
+        = _totals.images_drawn - _frameTotals.images_drawn;
+      f->stats.images_decoded
+        = _totals.images_decoded - _frameTotals.images_decoded;
+      f->stats.bytes_rasterized
+        = _totals.bytes_rasterized - _frameTotals.bytes_rasterized;
+      f->stats.lists_replayed
+        = _totals.lists_replayed - _frameTotals.lists_replayed;
+    }
+}
+
+- (MgLayerRenderStats *)_statsForClass:(Class)cls
+{
+  /* There are only a handful of layer classes, and the most recently
+     added is the most likely to be seen again. */
+
+  for (size_t i = _classCount; i > 0; i--)
+    {
+      if (_classes[i-1]->cls == cls)
+	return &_classes[i-1]->stats;
+    }
+
+  _classes = realloc(_classes, (_classCount + 1) * sizeof(trace_class *));
+
+  trace_class *c = calloc(1, sizeof(trace_class));
+  c->cls = cls;
+  _classes[_classCount++] = c;
+
+  return &c->stats;
+}
+
+- (NSInteger)_nameIndex:(NSString *)name
+{
+  if (name == nil)
+    return -1;
+
+  NSNumber *idx = _nameIndex[name];
+
+  if (idx == nil)
+    {
+      idx = @([_names count]);
+      [_names addObject:name];
+      _nameIndex[name] = idx;
+    }
+
+  return [idx integerValue];
+}
+
+- (void)_beginLayer:(MgLayer *)layer stats:(MgLayerRenderStats *)stats
+{
+  if (_spanCount == _spanCapacity)
+    {
+      _spanCapacity = MAX(_spanCapacity * 2, 32);
+      _spans = realloc(_spans, _spanCapacity * sizeof(trace_span));
+    }
+
+  trace_span *s = &_spans[_spanCount++];
+  s->c = (trace_class *)stats;
+  s->name = _recordsEvents ? [self _nameIndex:layer.name] : -1;
+  s->children = 0;
+  s->begin = mach_absolute_time();
+}
+
+- (void)_endLayer
+{
+  uint64_t end = mach_absolute_time();
+
+  trace_span *s = &_spans[--_spanCount];
+  uint64_t duration = end - s->begin;
+
+  s->c->time += duration - s->children;
+
+  if (_spanCount != 0)
+    _spans[_spanCount-1].children += duration;
+
+  if (_recordsEvents)
+    {
+      if (_eventCount == MAX_EVENTS)
+	{
+	  _droppedEvents++;
+	  return;
+	}
+
+      if (_eventCount == _eventCapacity)
+	{
+	  size_t capacity = MAX(_eventCapacity * 2, 1024);
+	  trace_event *events = realloc(_events,
+					capacity * sizeof(trace_event));
+	  if (events == NULL)
+	    {
+	      _droppedEvents++;
+	      return;
+	    }
+
+	  _events = events;
+	  _eventCapacity = capacity;
+	}
+
+      trace_event *e = &_events[_eventCount++];
+      e->begin = s->begin;
+      e->duration = duration;
+      e->c = s->c;
+      e->name = s->name;
+    }
+}
+
+/** Trace events. **/
+
+/* Complete ("X") events. All are given the same thread, the trace is
+   only used by one rendering call at a time. */
+
+static NSMutableDictionary *
+complete_event(NSString *name, NSString *cat, uint64_t begin,
+	       uint64_t duration, uint64_t origin)
+{
+  return [@{
+    @"name": name,
+    @"cat": cat,
+    @"ph": @"X",
+    @"ts": @(ticks_to_us(begin - origin)),
+    @"dur": @(ticks_to_us(duration)),
+    @"pid": @1,
+    @"tid": @1,
+  } mutableCopy];
+}
+
+- (NSData *)traceEventData
+{
+  NSMutableArray *events = [NSMutableArray array];
+
+  uint64_t origin = UINT64_MAX;
+  if (_frameEventCount != 0)
+    origin = _frames[0].begin;
+  if (_eventCount != 0 && _events[0].begin < origin)
+    origin = _events[0].begin;
+
+  for (size_t i = 0; i < _frameEventCount; i++)
+    {
+      const trace_frame *f = &_frames[i];
+
+      NSMutableDictionary *args = [stats_dictionary(&f->stats)
+				   mutableCopy];
+      args[@"time"] = @(f->time);
+
+      NSMutableDictionary *e = complete_event(@"frame", @"frame",
+					      f->begin, f->duration, origin);
+      e[@"args"] = args;
+
+      [events addObject:e];
+    }
+
+  for (size_t i = 0; i < _eventCount; i++)
+    {
+      const trace_event *ev = &_events[i];
+
+      NSString *cls = NSStringFromClass(ev->c->cls);
+      NSString *name = ev->name >= 0 ? _names[ev->name] : cls;
+
+      NSMutableDictionary *e = complete_event(name, @"layer", ev->begin,
+					      ev->duration, origin);
+      e[@"args"] = @{@"class": cls};
+
+      [events addObject:e];
+    }
+
+  NSMutableDictionary *root = [NSMutableDictionary dictionary];
+  root[@"traceEvents"] = events;
+  root[@"displayTimeUnit"] = @"ms";
+
+  if (_droppedEvents != 0)
+    root[@"otherData"] = @{@"droppedEvents": @(_droppedEvents)};
+
+  return [NSJSONSerialization dataWithJSONObject:root options:0 error:nil];
+}
+
+- (BOOL)writeTraceEventsToURL:(NSURL *)url error:(NSError **)err
+{
+  NSData *data = [self traceEventData];
+  if (data == nil)
+    return NO;
+
+  return [data writeToURL:url options:NSDataWritingAtomic error:err];
+}
+
+@end
@@ -0,0 +1,88 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgBase.h"
+
+/* Measures where the time goes when module states change: in applying
+   the new state to each node (-[MgModuleLayer setModuleState:...]),
+   and in evaluating each node's active transition when it's presented.
+   Costs are gathered per node and per state class and property. A
+   property's cost runs from the request for its transition time, i.e.
+   solving its timing function, up to the request for the next
+   property's, so includes interpolating its value. Drawing is measured
+   separately, by MgRenderTrace.
+
+   One profiler at most is active at a time, collecting from all
+   threads. When none is, each instrumented call costs a test of a
+   global flag, so the hooks can stay in place in normal builds.
+
+   Nodes are identified by address, their names and classes are
+   recorded when first seen. */
+
+@interface MgTransitionProfiler : NSObject
+
++ (instancetype)profiler;
+
+/* The profiler currently collecting, or nil. */
+
++ (MgTransitionProfiler *)activeProfiler;
+
+/* -start replaces any other active profiler with the receiver. */
+
+- (void)start;
+- (void)stop;
+
+@property(nonatomic, readonly, getter=isActive) BOOL active;
+
+/* If non-zero, the profiler stops itself after collecting over this
+   many frames. Zero by default. */
+
+@property(nonatomic, assign) NSUInteger frameLimit;
+
+/* Frames are counted by -[MgLayer renderInContext:...], other
+   presentation loops should call -markFrame after each frame. */
+
+- (void)markFrame;
+
+@property(nonatomic, readonly) NSUInteger frameCount;
+
+/* Return the `n' most expensive nodes or properties, as arrays of
+   dictionaries. Node keys: `name', `class', `applyTime', `applyCount',
+   `evaluateTime', `evaluateCount' and `time', the sum of the two
+   times. Property keys: `class', `property', `time' and `count'. Times
+   are in seconds. */
+
+- (NSArray *)topNodes:(NSUInteger)n;
+- (NSArray *)topProperties:(NSUInteger)n;
+
+/* The same as a printable table. */
+
+- (NSString *)reportWithCount:(NSUInteger)n;
+
+/* Discards everything collected so far. */
+
+- (void)reset;
+
+@end
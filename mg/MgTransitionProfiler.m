@@ -0,0 +1,706 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgTransitionProfilerInternal.h"
+
+#import "MgNodeInternal.h"
+#import "MgNodeState.h"
+
+#import <Foundation/Foundation.h>
+#import <mach/mach_time.h>
+
+/* Properties timed by one thread during one transition evaluation,
+   before they're added to the profiler. More than any state class has,
+   extra properties are dropped. */
+
+#define MAX_LAPS 64
+
+/* Slots in each thread's tables of costs not yet added to the
+   profiler, a power of two. The tables are added when the thread
+   finishes a frame, or when either is half full. */
+
+#define MAX_PENDING 128
+
+typedef struct profile_node profile_node;
+typedef struct profile_property profile_property;
+typedef struct profile_laps profile_laps;
+typedef struct profile_pending profile_pending;
+
+struct profile_node
+{
+  CFStringRef name;			/* may be null */
+  __unsafe_unretained Class cls;
+  uint64_t apply_time;
+  uint64_t evaluate_time;
+  NSUInteger apply_count;
+  NSUInteger evaluate_count;
+};
+
+struct profile_property
+{
+  __unsafe_unretained Class cls;
+  CFStringRef key;
+  uint64_t time;
+  NSUInteger count;
+};
+
+struct profile_laps
+{
+  const void *cls;			/* null outside an evaluation */
+  const void *key;			/* property being timed */
+  uint64_t begin;
+  size_t count;
+  struct
+    {
+      const void *key;
+      uint64_t time;
+    } laps[MAX_LAPS];
+};
+
+struct profile_pending
+{
+  unsigned int generation;		/* of the profiler being added to */
+  size_t node_count;
+  size_t property_count;
+  struct
+    {
+      NSUInteger identity;		/* zero if unused */
+      const void *cls;
+      CFStringRef name;			/* retained, may be null */
+      uint64_t time;
+      NSUInteger count;
+    } nodes[MAX_PENDING];
+  struct
+    {
+      const void *cls;			/* null if unused */
+      CFStringRef key;			/* retained */
+      uint64_t time;
+      NSUInteger count;
+    } properties[MAX_PENDING];
+};
+
+volatile bool mg_profiling;
+
+/* Protects `active_profiler' and its tables. */
+
+static id
+profile_lock(void)
+{
+  static id lock;
+  static dispatch_once_t once;
+
+  dispatch_once(&once, ^
+    {
+      lock = [[NSObject alloc] init];
+    });
+
+  return lock;
+}
+
+static MgTransitionProfiler *active_profiler;
+
+/* Changed whenever the active profiler is, or is reset, so that costs
+   pending from before then are dropped. */
+
+static volatile unsigned int profile_generation;
+
+static __thread profile_laps thread_laps;
+static __thread profile_pending thread_pending;
+
+static double seconds_per_tick;
+
+static double
+ticks_to_seconds(uint64_t t)
+{
+  return t * seconds_per_tick;
+}
+
+static NSMapTable *
+new_pointer_table(void)
+{
+  NSPointerFunctionsOptions opts = (NSPointerFunctionsOpaqueMemory
+				    | NSPointerFunctionsOpaquePersonality);
+
+  return [[NSMapTable alloc] initWithKeyOptions:opts valueOptions:opts
+	  capacity:0];
+}
+
+@implementation MgTransitionProfiler
+{
+  NSUInteger _frameLimit;
+  NSUInteger _frameCount;
+
+  NSMapTable *_nodes;			/* identity -> profile_node * */
+  NSMapTable *_properties;		/* NSString * -> NSMapTable * of
+					   Class -> profile_property * */
+  NSMutableArray *_propertyTables;	/* retains _properties' values */
+}
+
+@synthesize frameLimit = _frameLimit;
+
++ (void)initialize
+{
+  if (self == [MgTransitionProfiler class])
+    {
+      mach_timebase_info_data_t info;
+      mach_timebase_info(&info);
+      seconds_per_tick = 1e-9 * info.numer / info.denom;
+    }
+}
+
++ (instancetype)profiler
+{
+  return [[self alloc] init];
+}
+
++ (MgTransitionProfiler *)activeProfiler
+{
+  @synchronized (profile_lock())
+    {
+      return active_profiler;
+    }
+}
+
+- (id)init
+{
+  self = [super init];
+  if (self == nil)
+    return nil;
+
+  _nodes = new_pointer_table();
+  _properties = new_pointer_table();
+  _propertyTables = [[NSMutableArray alloc] init];
+
+  return self;
+}
+
+- (void)dealloc
+{
+  [self _freeEntries];
+}
+
+/* The tables hold raw pointers, so are only accessed through the
+   NSMapTable functions taking void pointers. */
+
+- (void)_freeEntries
+{
+  NSMapEnumerator e;
+  void *key, *value;
+
+  e = NSEnumerateMapTable(_nodes);
+  while (NSNextMapEnumeratorPair(&e, &key, &value))
+    {
+      profile_node *n = value;
+      if (n->name != NULL)
+	CFRelease(n->name);
+      free(n);
+    }
+  NSEndMapTableEnumeration(&e);
+
+  for (NSMapTable *table in _propertyTables)
+    {
+      e = NSEnumerateMapTable(table);
+      while (NSNextMapEnumeratorPair(&e, &key, &value))
+	{
+	  profile_property *p = value;
+	  CFRelease(p->key);
+	  free(p);
+	}
+      NSEndMapTableEnumeration(&e);
+    }
+}
+
+/** Collection. **/
+
+- (void)start
+{
+  @synchronized (profile_lock())
+    {
+      active_profiler = self;
+      profile_generation++;
+      mg_profiling = true;
+    }
+}
+
+- (void)stop
+{
+  @synchronized (profile_lock())
+    {
+      if (active_profiler == self)
+	{
+	  active_profiler = nil;
+	  mg_profiling = false;
+	}
+    }
+}
+
+- (BOOL)isActive
+{
+  return [[self class] activeProfiler] == self;
+}
+
+- (NSUInteger)frameCount
+{
+  @synchronized (profile_lock())
+    {
+      return _frameCount;
+    }
+}
+
+- (void)markFrame
+{
+  @synchronized (profile_lock())
+    {
+      _frameCount++;
+      if (_frameLimit != 0 && _frameCount >= _frameLimit
+	  && active_profiler == self)
+	{
+	  active_profiler = nil;
+	  mg_profiling = false;
+	}
+    }
+}
+
+- (void)reset
+{
+  @synchronized (profile_lock())
+    {
+      [self _freeEntries];
+
+      NSResetMapTable(_nodes);
+      NSResetMapTable(_properties);
+      [_propertyTables removeAllObjects];
+      _frameCount = 0;
+      profile_generation++;
+    }
+}
+
+/* Called with the lock held. */
+
+static profile_node *
+node_entry(MgTransitionProfiler *self, NSUInteger identity,
+	   const void *cls, CFStringRef name)
+{
+  profile_node *n = NSMapGet(self->_nodes, (void *)identity);
+
+  if (n == NULL)
+    {
+      n = calloc(1, sizeof(*n));
+      n->cls = (__bridge Class)cls;
+      if (name != NULL)
+	n->name = CFStringCreateCopy(NULL, name);
+
+      NSMapInsert(self->_nodes, (void *)identity, n);
+    }
+
+  return n;
+}
+
+/* Called with the lock held. */
+
+static profile_property *
+property_entry(MgTransitionProfiler *self, const void *cls, const void *key)
+{
+  NSMapTable *table = (__bridge NSMapTable *)NSMapGet(self->_properties,
+						     key);
+  if (table == nil)
+    {
+      table = new_pointer_table();
+      [self->_propertyTables addObject:table];
+      NSMapInsert(self->_properties, key, (__bridge void *)table);
+    }
+
+  profile_property *p = NSMapGet(table, cls);
+
+  if (p == NULL)
+    {
+      p = calloc(1, sizeof(*p));
+      p->cls = (__bridge Class)cls;
+      p->key = CFStringCreateCopy(NULL, (CFStringRef)key);
+
+      NSMapInsert(table, cls, p);
+    }
+
+  return p;
+}
+
+uint64_t
+MgProfileTime(void)
+{
+  return mach_absolute_time();
+}
+
+/* Adds the calling thread's pending costs to the active profiler, or
+   drops them if it has changed since they were collected. Called with
+   the lock held. */
+
+static void
+flush_pending(profile_pending *p)
+{
+  MgTransitionProfiler *self = active_profiler;
+
+  if (self != nil && p->generation != profile_generation)
+    self = nil;
+
+  for (size_t i = 0; p->node_count != 0 && i < MAX_PENDING; i++)
+    {
+      if (p->nodes[i].identity == 0)
+	continue;
+
+      if (self != nil)
+	{
+	  profile_node *n = node_entry(self, p->nodes[i].identity,
+				       p->nodes[i].cls, p->nodes[i].name);
+	  n->evaluate_time += p->nodes[i].time;
+	  n->evaluate_count += p->nodes[i].count;
+	}
+
+      if (p->nodes[i].name != NULL)
+	CFRelease(p->nodes[i].name);
+
+      memset(&p->nodes[i], 0, sizeof(p->nodes[i]));
+      p->node_count--;
+    }
+
+  for (size_t i = 0; p->property_count != 0 && i < MAX_PENDING; i++)
+    {
+      if (p->properties[i].cls == NULL)
+	continue;
+
+      if (self != nil)
+	{
+	  profile_property *e = property_entry(self, p->properties[i].cls,
+					       p->properties[i].key);
+	  e->time += p->properties[i].time;
+	  e->count += p->properties[i].count;
+	}
+
+      CFRelease(p->properties[i].key);
+
+      memset(&p->properties[i], 0, sizeof(p->properties[i]));
+      p->property_count--;
+    }
+}
+
+static void
+flush_pending_if_full(profile_pending *p)
+{
+  if (p->node_count < MAX_PENDING / 2
+      && p->property_count < MAX_PENDING / 2)
+    return;
+
+  @synchronized (profile_lock())
+    {
+      flush_pending(p);
+    }
+}
+
+static void
+begin_pending(profile_pending *p)
+{
+  if (p->node_count == 0 && p->property_count == 0)
+    p->generation = profile_generation;
+}
+
+static void
+add_pending_node(profile_pending *p, MgNode *node, uint64_t time)
+{
+  flush_pending_if_full(p);
+  begin_pending(p);
+
+  NSUInteger identity = node.profileIdentity;
+  size_t i = (size_t)(identity * 2654435761u) & (MAX_PENDING - 1);
+
+  while (p->nodes[i].identity != identity)
+    {
+      if (p->nodes[i].identity == 0)
+	{
+	  NSString *name = node.name;
+	  p->nodes[i].identity = identity;
+	  p->nodes[i].cls = (__bridge const void *)[node class];
+	  p->nodes[i].name = (name != nil
+			     ? (CFStringRef)CFBridgingRetain(name) : NULL);
+	  p->node_count++;
+	  break;
+	}
+      i = (i + 1) & (MAX_PENDING - 1);
+    }
+
+  p->nodes[i].time += time;
+  p->nodes[i].count++;
+}
+
+static void
+add_pending_property(profile_pending *p, const void *cls, const void *key,
+		     uint64_t time)
+{
+  flush_pending_if_full(p);
+  begin_pending(p);
+
+  size_t i = (((uintptr_t)cls ^ (uintptr_t)key * 31) >> 4) & (MAX_PENDING - 1);
+
+  while (p->properties[i].cls != cls || p->properties[i].key != key)
+    {
+      if (p->properties[i].cls == NULL)
+	{
+	  p->properties[i].cls = cls;
+	  p->properties[i].key = (CFStringRef)CFRetain(key);
+	  p->property_count++;
+	  break;
+	}
+      i = (i + 1) & (MAX_PENDING - 1);
+    }
+
+  p->properties[i].time += time;
+  p->properties[i].count++;
+}
+
+/* Module state changes are rare and made on the main thread, so are
+   added directly. */
+
+void
+MgProfileNodeApplied(MgNode *node, uint64_t begin)
+{
+  uint64_t time = mach_absolute_time() - begin;
+
+  @synchronized (profile_lock())
+    {
+      if (active_profiler != nil)
+	{
+	  NSString *name = node.name;
+	  profile_node *n = node_entry(active_profiler, node.profileIdentity,
+				       (__bridge const void *)[node class],
+				       (__bridge CFStringRef)name);
+	  n->apply_time += time;
+	  n->apply_count++;
+	}
+    }
+}
+
+/* Transitions are evaluated by every renderer for every node in every
+   frame, so to avoid serializing the renderers on the lock the costs
+   are kept per thread until the frame ends. */
+
+void
+MgProfileNodeEvaluated(MgNode *node, uint64_t begin)
+{
+  add_pending_node(&thread_pending, node, mach_absolute_time() - begin);
+}
+
+void
+MgProfileBeginProperties(MgNodeState *state)
+{
+  profile_laps *l = &thread_laps;
+
+  l->cls = (__bridge const void *)[state class];
+  l->key = NULL;
+  l->count = 0;
+}
+
+static void
+end_lap(profile_laps *l, uint64_t now)
+{
+  if (l->key != NULL && l->count < MAX_LAPS)
+    {
+      l->laps[l->count].key = l->key;
+      l->laps[l->count].time = now - l->begin;
+      l->count++;
+    }
+}
+
+void
+MgProfilePropertyLap(NSString *key)
+{
+  profile_laps *l = &thread_laps;
+
+  if (l->cls == NULL)
+    return;
+
+  uint64_t now = mach_absolute_time();
+
+  end_lap(l, now);
+
+  l->key = (__bridge const void *)key;
+  l->begin = now;
+}
+
+void
+MgProfileEndProperties(void)
+{
+  profile_laps *l = &thread_laps;
+
+  if (l->cls == NULL)
+    return;
+
+  end_lap(l, mach_absolute_time());
+
+  for (size_t i = 0; i < l->count; i++)
+    {
+      add_pending_property(&thread_pending, l->cls, l->laps[i].key,
+			   l->laps[i].time);
+    }
+
+  l->cls = NULL;
+}
+
+void
+MgProfileFrame(void)
+{
+  @synchronized (profile_lock())
+    {
+      flush_pending(&thread_pending);
+      [active_profiler markFrame];
+    }
+}
+
+/** Reports. **/
+
+static NSArray *
+top_entries(NSArray *array, NSUInteger n)
+{
+  array = [array sortedArrayUsingComparator:^(id a, id b)
+    {
+      return [b[@"time"] compare:a[@"time"]];
+    }];
+
+  if ([array count] > n)
+    array = [array subarrayWithRange:NSMakeRange(0, n)];
+
+  return array;
+}
+
+- (NSArray *)topNodes:(NSUInteger)n
+{
+  NSMutableArray *array = [NSMutableArray array];
+
+  @synchronized (profile_lock())
+    {
+      NSMapEnumerator it = NSEnumerateMapTable(_nodes);
+      void *key, *value;
+
+      while (NSNextMapEnumeratorPair(&it, &key, &value))
+	{
+	  profile_node *e = value;
+
+	  NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+	  if (e->name != NULL)
+	    dict[@"name"] = (__bridge NSString *)e->name;
+	  dict[@"class"] = NSStringFromClass(e->cls);
+	  dict[@"applyTime"] = @(ticks_to_seconds(e->apply_time));
+	  dict[@"applyCount"] = @(e->apply_count);
+	  dict[@"evaluateTime"] = @(ticks_to_seconds(e->evaluate_time));
+	  dict[@"evaluateCount"] = @(e->evaluate_count);
+	  dict[@"time"] = @(ticks_to_seconds(e->apply_time
+					     + e->evaluate_time));
+
+	  [array addObject:dict];
+	}
+
+      NSEndMapTableEnumeration(&it);
+    }
+
+  return top_entries(array, n);
+}
+
+- (NSArray *)topProperties:(NSUInteger)n
+{
+  /* Entries are keyed by string identity, merge any equal keys. */
+
+  NSMutableDictionary *merged = [NSMutableDictionary dictionary];
+
+  @synchronized (profile_lock())
+    {
+      for (NSMapTable *table in _propertyTables)
+	{
+	  NSMapEnumerator it = NSEnumerateMapTable(table);
+	  void *cls, *value;
+
+	  while (NSNextMapEnumeratorPair(&it, &cls, &value))
+	    {
+	      profile_property *p = value;
+
+	      NSString *cls_name = NSStringFromClass(p->cls);
+	      NSString *key = (__bridge NSString *)p->key;
+	      NSArray *merge_key = @[cls_name, key];
+
+	      uint64_t time = p->time;
+	      NSUInteger count = p->count;
+
+	      NSDictionary *old = merged[merge_key];
+	      if (old != nil)
+		count += [old[@"count"] unsignedIntegerValue];
+
+	      merged[merge_key] = @{
+		@"class": cls_name,
+		@"property": key,
+		@"time": @(ticks_to_seconds(time)
+			   + [old[@"time"] doubleValue]),
+		@"count": @(count),
+	      };
+	    }
+
+	  NSEndMapTableEnumeration(&it);
+	}
+    }
+
+  return top_entries([merged allValues], n);
+}
+
+- (NSString *)reportWithCount:(NSUInteger)n
+{
+  NSMutableString *str = [NSMutableString string];
+
+  [str appendFormat:@"%lu frames\n\n", (unsigned long)self.frameCount];
+
+  [str appendFormat:@"%-32s %-18s %10s %7s %10s %7s\n", "node", "class",
+   "apply ms", "count", "eval ms", "count"];
+
+  for (NSDictionary *dict in [self topNodes:n])
+    {
+      NSString *name = dict[@"name"];
+      [str appendFormat:@"%-32s %-18s %10.3f %7lu %10.3f %7lu\n",
+       name != nil ? [name UTF8String] : "-",
+       [dict[@"class"] UTF8String],
+       [dict[@"applyTime"] doubleValue] * 1e3,
+       [dict[@"applyCount"] unsignedLongValue],
+       [dict[@"evaluateTime"] doubleValue] * 1e3,
+       [dict[@"evaluateCount"] unsignedLongValue]];
+    }
+
+  [str appendFormat:@"\n%-24s %-26s %10s %7s\n", "state class",
+   "property", "ms", "count"];
+
+  for (NSDictionary *dict in [self topProperties:n])
+    {
+      [str appendFormat:@"%-24s %-26s %10.3f %7lu\n",
+       [dict[@"class"] UTF8String], [dict[@"property"] UTF8String],
+       [dict[@"time"] doubleValue] * 1e3,
+       [dict[@"count"] unsignedLongValue]];
+    }
+
+  return str;
+}
+
+@end
@@ -0,0 +1,55 @@
+/* -*- c-style: gnu -*-
+
+   Copyright (c) 2014 John Harper <jsh@unfactored.org>
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation files
+   (the "Software"), to deal in the Software without restriction,
+   including without limitation the rights to use, copy, modify, merge,
+   publish, distribute, sublicense, and/or sell copies of the Software,
+   and to permit persons to whom the Software is furnished to do so,
+   subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE. */
+
+
+#import "MgTransitionProfiler.h"
+
+/* Hooks called by the instrumented code, only while `mg_profiling' is
+   set (which may change at any time, so a hook that measures from an
+   earlier time has to be given it). */
+
+MG_EXTERN volatile bool mg_profiling;
+
+MG_EXTERN uint64_t MgProfileTime(void);
+
+/* -[MgNode _setModuleState:options:] and the transition evaluation in
+   -[MgNode withPresentationTime:handler:] of `node', started at
+   `begin'. */
+
+MG_EXTERN void MgProfileNodeApplied(MgNode *node, uint64_t begin);
+MG_EXTERN void MgProfileNodeEvaluated(MgNode *node, uint64_t begin);
+
+/* Bracket -[MgNodeState applyTransition:atTime:to:] of `state'. Each
+   call to -[MgActiveTransition evaluateTime:forKey:] in between starts
+   timing property `key', ending the previous property. */
+
+MG_EXTERN void MgProfileBeginProperties(MgNodeState *state);
+MG_EXTERN void MgProfilePropertyLap(NSString *key);
+MG_EXTERN void MgProfileEndProperties(void);
+
+/* Called by each renderer at the end of a frame: adds the costs the
+   calling thread has collected to the active profiler and counts the
+   frame. */
+
+MG_EXTERN void MgProfileFrame(void);
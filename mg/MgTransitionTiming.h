@@ -23,6 +23,7 @@
    SOFTWARE. */
 
 #import "MgBase.h"
+#import "MgCoreGraphics.h"
 
 @interface MgTransitionTiming : NSObject <NSCopying, NSSecureCoding>
 
@@ -33,6 +34,10 @@
 
 @property(nonatomic, copy) MgFunction *function;
 
+/* How colors are interpolated, by default MgColorMixSRGB. */
+
+@property(nonatomic, assign) MgColorMixMode colorMixMode;
+
 - (double)evaluate:(double)t;
 
 @end
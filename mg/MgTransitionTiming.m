@@ -66,6 +66,7 @@
   copy->_begin = _begin;
   copy->_duration = _duration;
   copy->_function = _function;
+  copy->_colorMixMode = _colorMixMode;
 
   return copy;
 }
@@ -87,6 +88,8 @@
     [c encodeDouble:_duration forKey:@"duration"];
   if (_function != nil)
     [c encodeObject:_function forKey:@"function"];
+  if (_colorMixMode != MgColorMixSRGB)
+    [c encodeInt:(int)_colorMixMode forKey:@"colorMixMode"];
 }
 
 - (id)initWithCoder:(NSCoder *)c
@@ -107,6 +110,13 @@
   if ([c containsValueForKey:@"function"])
     _function = [c decodeObjectOfClass:[MgFunction class] forKey:@"function"];
 
+  if ([c containsValueForKey:@"colorMixMode"])
+    {
+      int mode = [c decodeIntForKey:@"colorMixMode"];
+      if (mode >= MgColorMixSRGB && mode <= MgColorMixOKLab)
+	_colorMixMode = mode;
+    }
+
   return self;
 }
 
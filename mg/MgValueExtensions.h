@@ -23,9 +23,14 @@
    SOFTWARE. */
 
 #import "MgBase.h"
+#import "MgCoreGraphics.h"
 
 @interface NSObject (MgValueExtensions)
 
 - (id)mg_mixWith:(id)toValue at:(double)t;
 
+/* As above, but mixing colors in `mode'. */
+
+- (id)mg_mixWith:(id)toValue at:(double)t mode:(MgColorMixMode)mode;
+
 @end
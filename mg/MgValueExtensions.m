@@ -43,6 +43,20 @@
     return t < .5 ? self : toValue;
 }
 
+- (id)mg_mixWith:(id)toValue at:(double)t mode:(MgColorMixMode)mode
+{
+  CFTypeID type = CFGetTypeID((__bridge CFTypeRef)self);
+
+  if (type == CGColorGetTypeID())
+    {
+      return CFBridgingRelease(MgColorMixWithMode((__bridge CGColorRef)self,
+						  (__bridge CGColorRef)toValue,
+						  t, mode));
+    }
+  else
+    return [self mg_mixWith:toValue at:t];
+}
+
 @end
 
 @implementation NSNumber (MgValueExtensions)
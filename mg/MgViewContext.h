@@ -22,7 +22,7 @@
    CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
    SOFTWARE. */
 
-#import "MgBase.h"
+#import "MgImageProvider.h"
 
 @protocol MgViewLayer;
 
@@ -34,6 +34,24 @@
 
 @property(nonatomic, assign) CGFloat contentsScale;
 
+/* If true, compositing groups that don't set `flattensSublayers' and
+   path layers are drawn into a single bitmap layer whenever that is
+   estimated to be cheaper than giving each of their layers its own
+   CALayer. The estimate weighs the number of layers and path
+   elements in the subtree against the measured cost of redrawing it,
+   and never flattens animating subtrees or content that extends
+   outside the layer's bounds. Defaults to false. */
+
+@property(nonatomic, assign) BOOL automaticallyFlattensLayers;
+
+/* If true (the default), image layers don't block waiting for their
+   images to be decoded, they request them in the background at
+   `imageLoadPriority' and display their previous contents (or nothing
+   at all) until the decoded image is available. */
+
+@property(nonatomic, assign) BOOL loadsImagesAsynchronously;
+@property(nonatomic, assign) MgImageLoadPriority imageLoadPriority;
+
 @property(nonatomic, strong, readonly) MgLayer *layer;
 
 @property(nonatomic, strong, readonly) CALayer *viewLayer;
@@ -42,12 +60,24 @@
 
 - (void)updateViewLayer:(CALayer<MgViewLayer> *)layer;
 
+- (Class)viewLayerClassForLayer:(MgLayer *)src;
+
+/* Called by flattening layers after drawing their contents. */
+
+- (void)viewLayer:(CALayer<MgViewLayer> *)layer
+    didDrawWithDuration:(CFTimeInterval)duration;
+
 - (CALayer<MgViewLayer> *)makeViewLayerForLayer:(MgLayer *)src
     candidate:(CALayer *)layer;
 
 - (NSArray *)makeViewLayersForLayers:(NSArray *)array
     candidates:(NSArray *)layers culler:(BOOL (^)(MgLayer *src))pred;
 
+/* Makes `array' the sublayers of `layer', removing, inserting and
+   moving as few layers as possible. */
+
+- (void)setSublayers:(NSArray *)array ofViewLayer:(CALayer *)layer;
+
 + (NSDictionary *)animationMap;
 
 - (NSMutableArray *)makeAnimationsForTransition:(MgActiveTransition *)trans
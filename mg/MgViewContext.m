@@ -27,8 +27,12 @@
 #import "MgActiveTransition.h"
 #import "MgBezierTimingFunction.h"
 #import "MgFlatteningCALayer.h"
+#import "MgGroupCALayer.h"
+#import "MgGroupLayer.h"
 #import "MgLayerInternal.h"
 #import "MgNodeState.h"
+#import "MgPathCALayer.h"
+#import "MgPathLayer.h"
 #import "MgTransitionTiming.h"
 #import "MgValueExtensions.h"
 
@@ -49,12 +53,59 @@
 
 #define ANIMATION_KEY "org.unfactored.MgTransition"
 
+/* Automatic flattening. Hosting a layer in the render tree costs
+   roughly the same whatever it draws, so the cost of hosting a subtree
+   is estimated as the number of layers it contains, with every
+   PATH_ELEMENTS_PER_LAYER path elements CAShapeLayer has to rasterize
+   counting as another layer. Subtrees costing at least
+   FLATTEN_MIN_COST are flattened (or FLATTEN_KEEP_COST if they already
+   are, so small edits don't flip them back and forth), until the
+   measured fraction of time spent redrawing them exceeds
+   FLATTEN_MAX_LOAD, when they're hosted again for FLATTEN_BACKOFF
+   seconds. */
+
+#define PATH_ELEMENTS_PER_LAYER 32
+#define FLATTEN_MIN_COST 24
+#define FLATTEN_KEEP_COST 16
+#define FLATTEN_MAX_LOAD .1
+#define FLATTEN_BACKOFF 5
+#define FLATTEN_DECAY .25
+
+typedef struct subtree_cost subtree_cost;
+
+struct subtree_cost
+{
+  double layers;
+  bool animating;
+  bool blending;
+};
+
+@interface MgFlatteningRecord : NSObject
+{
+@public
+  NSUInteger _costVersion;		/* zero if _cost is unset */
+  subtree_cost _cost;
+  BOOL _flattened;
+  CFTimeInterval _drawDuration;		/* moving averages */
+  CFTimeInterval _drawInterval;
+  CFTimeInterval _lastDraw;
+  CFTimeInterval _hostedUntil;
+}
+@end
+
 @implementation MgViewContext
 {
   MgLayer *_layer;
   CGFloat _contentsScale;
+  BOOL _loadsImagesAsynchronously;
+  MgImageLoadPriority _imageLoadPriority;
+  BOOL _automaticallyFlattensLayers;
 
   CALayer<MgViewLayer> *_viewLayer;
+
+  /* Maps layers to their MgFlatteningRecord, main thread only. */
+
+  NSMapTable *_flatteningRecords;
 }
 
 + (MgViewContext *)contextWithLayer:(MgLayer *)layer
@@ -70,6 +121,8 @@
 
   _layer = layer;
   _contentsScale = 1;
+  _loadsImagesAsynchronously = YES;
+  _imageLoadPriority = MgImageLoadPriorityVisible;
 
   [_layer addObserver:self forKeyPath:@"version" options:0 context:nil];
 
@@ -95,6 +148,38 @@
   return _contentsScale;
 }
 
+@synthesize loadsImagesAsynchronously = _loadsImagesAsynchronously;
+@synthesize imageLoadPriority = _imageLoadPriority;
+
+static void
+set_needs_layout(CALayer *layer)
+{
+  [layer setNeedsLayout];
+
+  for (CALayer *sublayer in layer.sublayers)
+    set_needs_layout(sublayer);
+}
+
+- (BOOL)automaticallyFlattensLayers
+{
+  return _automaticallyFlattensLayers;
+}
+
+- (void)setAutomaticallyFlattensLayers:(BOOL)flag
+{
+  if (_automaticallyFlattensLayers != flag)
+    {
+      _automaticallyFlattensLayers = flag;
+
+      if (!flag)
+	_flatteningRecords = nil;
+
+      /* Let every group choose its sublayers' classes again. */
+
+      set_needs_layout(_viewLayer);
+    }
+}
+
 - (CALayer *)viewLayer
 {
   if (_viewLayer == nil)
@@ -248,28 +333,52 @@ blendModeFilter(CGBlendMode blend_mode)
       m22 = m22_;
     }
 
-  layer.bounds = src.bounds;
-  layer.anchorPoint = src.anchor;
-  layer.position = src.position;
-  layer.affineTransform = CGAffineTransformMake(m11, m12, m21, m22, 0, 0);
-  layer.opacity = src.alpha;
+  /* Only push properties that changed, setting a CALayer property
+     dirties it for the next commit even if the value is the same. */
+
+  CGRect bounds = src.bounds;
+  if (!CGRectEqualToRect(layer.bounds, bounds))
+    layer.bounds = bounds;
+
+  CGPoint anchor = src.anchor;
+  if (!CGPointEqualToPoint(layer.anchorPoint, anchor))
+    layer.anchorPoint = anchor;
+
+  CGPoint position = src.position;
+  if (!CGPointEqualToPoint(layer.position, position))
+    layer.position = position;
+
+  CGAffineTransform m = CGAffineTransformMake(m11, m12, m21, m22, 0, 0);
+  if (!CGAffineTransformEqualToTransform(layer.affineTransform, m))
+    layer.affineTransform = m;
+
+  float opacity = src.alpha;
+  if (layer.opacity != opacity)
+    layer.opacity = opacity;
 
   if (![src _isPassThroughGroup])
     {
-      layer.contentsScale = _contentsScale;
+      if (layer.contentsScale != _contentsScale)
+	layer.contentsScale = _contentsScale;
 
       MgLayer *mask = src.mask;
       if (mask == nil)
-	layer.mask = nil;
+	{
+	  if (layer.mask != nil)
+	    layer.mask = nil;
+	}
       else
 	{
 	  CALayer<MgViewLayer> *view_layer = [self makeViewLayerForLayer:mask
 					      candidate:layer.mask];
-	  layer.mask = view_layer;
+	  if (layer.mask != view_layer)
+	    layer.mask = view_layer;
 	  [view_layer update];
 	}
 
-      layer.compositingFilter = blendModeFilter(src.blendMode);
+      id filter = blendModeFilter(src.blendMode);
+      if (filter != nil || layer.compositingFilter != nil)
+	layer.compositingFilter = filter;
     }
 
   CFTimeInterval now = CACurrentMediaTime();
@@ -327,11 +436,238 @@ blendModeFilter(CGBlendMode blend_mode)
     [layer removeAnimationForKey:@ANIMATION_KEY];
 }
 
+/** Automatic flattening. **/
+
+static void
+count_path_elements(void *info, const CGPathElement *elt)
+{
+  (*(size_t *)info)++;
+}
+
+static MgFlatteningRecord *
+flattening_record(NSMapTable *records, MgLayer *layer)
+{
+  MgFlatteningRecord *rec = [records objectForKey:layer];
+  if (rec == nil)
+    {
+      rec = [[MgFlatteningRecord alloc] init];
+      [records setObject:rec forKey:layer];
+    }
+
+  return rec;
+}
+
+static void add_sublayer_cost(NSMapTable *records, MgLayer *layer,
+			      subtree_cost *cost);
+
+/* Returns the cost of hosting `layer' and its sublayers and mask. The
+   root's own blend mode is applied by its view layer either way, so
+   isn't included. Costs of groups and paths are cached until the
+   layer's version changes, which it does when anything below it does,
+   so each layout only walks the parts of the tree that changed. */
+
+static subtree_cost
+get_subtree_cost(NSMapTable *records, MgLayer *layer)
+{
+  bool is_group = [layer isKindOfClass:[MgGroupLayer class]];
+  bool is_path = !is_group && [layer isKindOfClass:[MgPathLayer class]];
+
+  MgFlatteningRecord *rec = nil;
+  NSUInteger version = layer.version;
+
+  if (is_group || is_path)
+    {
+      rec = flattening_record(records, layer);
+      if (rec->_costVersion == version)
+	return rec->_cost;
+    }
+
+  subtree_cost cost = {0};
+
+  cost.layers = 1;
+
+  if (layer.activeTransition != nil)
+    cost.animating = true;
+
+  if (is_path)
+    {
+      CGPathRef path = ((MgPathLayer *)layer).path;
+      if (path != NULL)
+	{
+	  size_t count = 0;
+	  CGPathApply(path, &count, count_path_elements);
+	  cost.layers += (double)count / PATH_ELEMENTS_PER_LAYER;
+	}
+    }
+
+  MgLayer *mask = layer.mask;
+  if (mask != nil)
+    add_sublayer_cost(records, mask, &cost);
+
+  if (is_group)
+    {
+      for (MgLayer *sublayer in ((MgGroupLayer *)layer).sublayers)
+	add_sublayer_cost(records, sublayer, &cost);
+    }
+
+  if (rec != nil)
+    {
+      rec->_cost = cost;
+      rec->_costVersion = version;
+    }
+
+  return cost;
+}
+
+/* Adds the cost of `layer' inside some other layer's subtree to
+   `cost'. Blend modes inside a subtree can only be drawn correctly by
+   flattening it. */
+
+static void
+add_sublayer_cost(NSMapTable *records, MgLayer *layer, subtree_cost *cost)
+{
+  subtree_cost c = get_subtree_cost(records, layer);
+
+  cost->layers += c.layers;
+  cost->animating = cost->animating || c.animating;
+  cost->blending = cost->blending || c.blending;
+
+  if (![layer _isPassThroughGroup]
+      && layer.blendMode != kCGBlendModeNormal
+      && blendModeFilter(layer.blendMode) == nil)
+    cost->blending = true;
+}
+
+/* Returns the fraction of time spent redrawing the flattened layer,
+   decaying once it stops being redrawn. */
+
+static double
+flattening_load(const MgFlatteningRecord *rec, CFTimeInterval now)
+{
+  if (rec->_lastDraw == 0)
+    return 0;
+
+  CFTimeInterval interval = fmax(rec->_drawInterval, now - rec->_lastDraw);
+
+  return interval > 0 ? rec->_drawDuration / interval : 0;
+}
+
+/* `cls' is the class of view layer that would host `src'. */
+
+- (BOOL)_shouldFlattenLayer:(MgLayer *)src hostedClass:(Class)cls
+{
+  /* Nothing chooses the root's view layer again, so if it turned out
+     to be the wrong choice it couldn't be undone. */
+
+  if (src == _layer)
+    return NO;
+
+  if (cls != [MgGroupCALayer class] && cls != [MgPathCALayer class])
+    return NO;
+
+  CFTimeInterval now = CACurrentMediaTime();
+
+  /* Flattened content is clipped to the layer's bounds. */
+
+  __block CGRect content = CGRectNull;
+  __block bool animated = false;
+
+  [src withPresentationTime:now handler:^
+    {
+      content = [src _contentBoundsAtTime:now animated:&animated];
+    }];
+
+  if (CGRectIsInfinite(content)
+      || (!CGRectIsNull(content) && !CGRectContainsRect(src.bounds, content)))
+    return NO;
+
+  if (_flatteningRecords == nil)
+    _flatteningRecords = [NSMapTable weakToStrongObjectsMapTable];
+
+  MgFlatteningRecord *rec = flattening_record(_flatteningRecords, src);
+
+  subtree_cost cost = get_subtree_cost(_flatteningRecords, src);
+
+  BOOL flatten;
+
+  if (cost.blending)
+    flatten = YES;
+  else if (cost.animating || animated)
+    {
+      /* The render server animates hosted layers for free, flattened
+	 ones have to be redrawn every frame. */
+
+      flatten = NO;
+    }
+  else if (now < rec->_hostedUntil)
+    flatten = NO;
+  else
+    {
+      flatten = cost.layers >= (rec->_flattened ? FLATTEN_KEEP_COST
+				: FLATTEN_MIN_COST);
+
+      if (flatten && flattening_load(rec, now) > FLATTEN_MAX_LOAD)
+	{
+	  flatten = NO;
+	  rec->_hostedUntil = now + FLATTEN_BACKOFF;
+	  rec->_lastDraw = 0;
+	}
+    }
+
+  rec->_flattened = flatten;
+
+  return flatten;
+}
+
+- (Class)viewLayerClassForLayer:(MgLayer *)src
+{
+  if (FORCE_DRAWING)
+    return [MgFlatteningCALayer class];
+
+  Class cls = [src viewLayerClass];
+
+  if (_automaticallyFlattensLayers
+      && [self _shouldFlattenLayer:src hostedClass:cls])
+    {
+      cls = [MgFlatteningCALayer class];
+    }
+
+  return cls;
+}
+
+- (void)viewLayer:(CALayer<MgViewLayer> *)layer
+    didDrawWithDuration:(CFTimeInterval)duration
+{
+  MgFlatteningRecord *rec = [_flatteningRecords objectForKey:layer.layer];
+  if (rec == nil || !rec->_flattened)
+    return;
+
+  CFTimeInterval now = CACurrentMediaTime();
+
+  if (rec->_lastDraw == 0)
+    rec->_drawDuration = duration;
+  else
+    {
+      CFTimeInterval interval = now - rec->_lastDraw;
+      rec->_drawInterval = (rec->_drawInterval == 0 ? interval
+			    : rec->_drawInterval
+			    + (interval - rec->_drawInterval) * FLATTEN_DECAY);
+      rec->_drawDuration += (duration - rec->_drawDuration) * FLATTEN_DECAY;
+    }
+
+  rec->_lastDraw = now;
+
+  /* If redrawing has become too expensive, have the parent group
+     choose again. */
+
+  if (flattening_load(rec, now) > FLATTEN_MAX_LOAD)
+    [layer.superlayer setNeedsLayout];
+}
+
 - (CALayer<MgViewLayer> *)makeViewLayerForLayer:(MgLayer *)src
     candidate:(CALayer *)layer
 {
-  Class cls = (!FORCE_DRAWING ? [src viewLayerClass]
-	       : [MgFlatteningCALayer class]);
+  Class cls = [self viewLayerClassForLayer:src];
 
   if ([layer class] == cls && ((CALayer<MgViewLayer> *)layer).layer == src)
     return (CALayer<MgViewLayer> *)layer;
@@ -364,10 +700,7 @@ blendModeFilter(CGBlendMode blend_mode)
 	  if (!pred || !pred(src))
 	    {
 	      src_layers[actual_count] = src;
-	      if (!FORCE_DRAWING)
-		src_classes[actual_count] = [src viewLayerClass];
-	      else
-		src_classes[actual_count] = [MgFlatteningCALayer class];
+	      src_classes[actual_count] = [self viewLayerClassForLayer:src];
 	      actual_count++;
 	    }
 	}
@@ -439,6 +772,125 @@ blendModeFilter(CGBlendMode blend_mode)
   return layers;
 }
 
+/* Marks the elements of `seq' forming one of its longest increasing
+   subsequences. */
+
+static void
+mark_increasing(const NSInteger *seq, NSInteger count, bool *marks)
+{
+  NSInteger *tails = STACK_ALLOC(NSInteger, count);
+  NSInteger *prev = STACK_ALLOC(NSInteger, count);
+  NSInteger length = 0;
+
+  /* Without memory nothing is marked, which is merely slower. */
+
+  NSInteger n = tails != NULL && prev != NULL ? count : 0;
+
+  /* tails[k] is the index of the smallest element ending an increasing
+     subsequence of length k+1, prev[] links each element to its
+     predecessor in that subsequence. */
+
+  for (NSInteger i = 0; i < n; i++)
+    {
+      NSInteger lo = 0, hi = length;
+
+      while (lo < hi)
+	{
+	  NSInteger mid = (lo + hi) / 2;
+	  if (seq[tails[mid]] < seq[i])
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+
+      prev[i] = lo > 0 ? tails[lo - 1] : -1;
+      tails[lo] = i;
+
+      if (lo == length)
+	length++;
+    }
+
+  for (NSInteger i = 0; i < count; i++)
+    marks[i] = false;
+
+  for (NSInteger i = length > 0 ? tails[length - 1] : -1; i >= 0; i = prev[i])
+    marks[i] = true;
+
+  STACK_FREE(NSInteger, count, tails);
+  STACK_FREE(NSInteger, count, prev);
+}
+
+- (void)setSublayers:(NSArray *)array ofViewLayer:(CALayer *)layer
+{
+  NSArray *old_array = [layer.sublayers copy];
+  NSInteger old_count = [old_array count];
+  NSInteger count = [array count];
+
+  if (old_count == 0 || count == 0)
+    {
+      layer.sublayers = array;
+      return;
+    }
+
+  /* Setting the sublayers array removes and re-adds every layer, so
+     diff against the existing array instead: layers no longer present
+     are removed, then the longest run of surviving layers already in
+     the right relative order stays put, and everything else is
+     inserted next to its new predecessor. */
+
+  NSMapTable *map = [NSMapTable mapTableWithKeyOptions:
+		     NSPointerFunctionsObjectPointerPersonality
+		     valueOptions:NSPointerFunctionsStrongMemory];
+
+  for (NSInteger i = 0; i < count; i++)
+    [map setObject:@(i) forKey:array[i]];
+
+  NSInteger *kept = STACK_ALLOC(NSInteger, old_count);
+  bool *kept_marks = STACK_ALLOC(bool, old_count);
+  bool *stable = STACK_ALLOC(bool, count);
+
+  if (kept != NULL && kept_marks != NULL && stable != NULL)
+    {
+      NSInteger kept_count = 0;
+
+      for (CALayer *sublayer in old_array)
+	{
+	  NSNumber *idx = [map objectForKey:sublayer];
+	  if (idx == nil)
+	    [sublayer removeFromSuperlayer];
+	  else
+	    kept[kept_count++] = [idx integerValue];
+	}
+
+      mark_increasing(kept, kept_count, kept_marks);
+
+      for (NSInteger i = 0; i < count; i++)
+	stable[i] = false;
+      for (NSInteger i = 0; i < kept_count; i++)
+	{
+	  if (kept_marks[i])
+	    stable[kept[i]] = true;
+	}
+
+      for (NSInteger i = 0; i < count; i++)
+	{
+	  if (stable[i])
+	    continue;
+
+	  if (i == 0)
+	    [layer insertSublayer:array[i] atIndex:0];
+	  else
+	    [layer insertSublayer:array[i] above:array[i-1]];
+	}
+    }
+  else
+    layer.sublayers = array;
+
+  STACK_FREE(NSInteger, old_count, kept);
+  STACK_FREE(bool, old_count, kept_marks);
+  STACK_FREE(bool, count, stable);
+}
+
 + (NSDictionary *)animationMap
 {
   static NSDictionary *map;
@@ -541,8 +993,17 @@ blendModeFilter(CGBlendMode blend_mode)
   CAAnimation *anim = nil;
 
   MgFunction *fun = timing.function;
+  MgColorMixMode mode = timing.colorMixMode;
 
-  if (fun == nil || [fun isKindOfClass:[MgBezierTimingFunction class]])
+  /* Core Animation only mixes colors component-wise, other modes need
+     keyframes. */
+
+  bool mixes_color = (mode != MgColorMixSRGB && fromValue != nil
+		      && (CFGetTypeID((__bridge CFTypeRef)fromValue)
+			  == CGColorGetTypeID()));
+
+  if ((fun == nil || [fun isKindOfClass:[MgBezierTimingFunction class]])
+      && !mixes_color)
     {
       CABasicAnimation *basic = [CABasicAnimation animationWithKeyPath:key];
 
@@ -575,8 +1036,8 @@ blendModeFilter(CGBlendMode blend_mode)
 
       for (double t = 0; t < dur; t += interval)
 	{
-	  double ts = [fun evaluateScalar:t];
-	  [values addObject:[fromValue mg_mixWith:toValue at:ts]];
+	  double ts = fun != nil ? [fun evaluateScalar:t] : t / dur;
+	  [values addObject:[fromValue mg_mixWith:toValue at:ts mode:mode]];
 	}
 
       keyframe.values = values;
@@ -597,7 +1058,12 @@ blendModeFilter(CGBlendMode blend_mode)
 {
   if ([keyPath isEqualToString:@"version"])
     {
+      /* Batch whatever the update changes into one transaction. */
+
+      [CATransaction begin];
+      [CATransaction setDisableActions:YES];
       [_viewLayer update];
+      [CATransaction commit];
     }
 }
 
@@ -620,3 +1086,6 @@ blendModeFilter(CGBlendMode blend_mode)
 }
 
 @end
+
+@implementation MgFlatteningRecord
+@end
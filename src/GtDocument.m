@@ -42,6 +42,14 @@ NSString *const GtDocumentNodeDidChange = @"GtDocumentNodeDidChange";
   CGSize _documentSize;
   MgModuleLayer *_documentNode;
   int _undoDisable;
+
+  /* Where the objects in the binary file at _journalURL are, so that
+     autosaves can append to it. */
+
+  MgBinaryArchiveJournal *_journal;
+  MgBinaryArchiveJournal *_pendingJournal;
+  NSURL *_journalURL;
+  BOOL _appendsSegment;
 }
 
 @synthesize windowController = _windowController;
@@ -134,10 +142,68 @@ NSString *const GtDocumentNodeDidChange = @"GtDocumentNodeDidChange";
   return YES;
 }
 
+static void
+add_image_providers(MgNode *node, uint32_t mark, NSMutableSet *set)
+{
+  if ([node isKindOfClass:[MgImageLayer class]])
+    {
+      for (MgImageLayerState *state in node.states)
+	{
+	  if (state.imageProvider != nil)
+	    [set addObject:state.imageProvider];
+	}
+    }
+
+  [node foreachNode:^(MgNode *child)
+    {
+      add_image_providers(child, mark, set);
+    } mark:mark];
+}
+
+/* Encodes or hashes any images that haven't been archived before in
+   parallel, before the archiver needs them. */
+
+- (void)_prepareImagesForArchiving
+{
+  NSMutableSet *set = [NSMutableSet set];
+
+  add_image_providers(_documentNode, [MgNode nextMark], set);
+
+  [MgImageProvider prepareProvidersForArchiving:set];
+}
+
 - (NSData *)dataOfType:(NSString *)type error:(NSError **)err
 {
   if ([type isEqualToString:@"org.unfactored.mg-archive"])
     {
+      NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+
+      [self _prepareImagesForArchiving];
+
+      /* The binary format is opt-in (see defaults.json): builds that
+	 predate it can't open documents saved in it, and it may still
+	 change. Without it, autosaves can't append to the file. */
+
+      if ([defaults boolForKey:@"GtBinaryDocumentFormat"])
+	{
+	  MgBinaryArchiveJournal *journal
+	    = [[MgBinaryArchiveJournal alloc] init];
+	  MgBinaryArchiver *archiver
+	    = [[MgBinaryArchiver alloc] initWithJournal:journal];
+
+	  [archiver mg_encodeCGSize:_documentSize forKey:@"documentSize"];
+	  [archiver encodeObject:_documentNode
+	   forKey:NSKeyedArchiveRootObjectKey];
+
+	  NSData *data = [archiver finishEncoding];
+
+	  /* Adopted once the data has been written to the file. */
+
+	  _pendingJournal = journal;
+
+	  return data;
+	}
+
       NSMutableData *data = [NSMutableData data];
 
       NSKeyedArchiver *archiver
@@ -154,11 +220,192 @@ NSString *const GtDocumentNodeDidChange = @"GtDocumentNodeDidChange";
     return nil;
 }
 
+- (BOOL)writeSafelyToURL:(NSURL *)url ofType:(NSString *)type
+    forSaveOperation:(NSSaveOperationType)op error:(NSError **)err
+{
+  /* Autosaves append the nodes changed since the last save to the
+     file, until the appended segments are half the size of the
+     original archive, when the whole document is written again. */
+
+  NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+
+  _appendsSegment = (op == NSAutosaveInPlaceOperation && _journal != nil
+		     && [url isEqual:_journalURL]
+		     && [defaults boolForKey:@"GtBinaryDocumentFormat"]
+		     && (_journal.length - _journal.baseLength
+			 < _journal.baseLength / 2));
+
+  _pendingJournal = nil;
+
+  BOOL success = [super writeSafelyToURL:url ofType:type
+		  forSaveOperation:op error:err];
+
+  _appendsSegment = NO;
+
+  if (!success)
+    {
+      _pendingJournal = nil;
+      return NO;
+    }
+
+  if (op != NSSaveToOperation && op != NSAutosaveElsewhereOperation)
+    {
+      _journal = _pendingJournal;
+      _journalURL = _journal != nil ? url : nil;
+    }
+
+  _pendingJournal = nil;
+
+  return YES;
+}
+
+- (BOOL)writeToURL:(NSURL *)url ofType:(NSString *)type
+    forSaveOperation:(NSSaveOperationType)op
+    originalContentsURL:(NSURL *)orig error:(NSError **)err
+{
+  /* Called by -writeSafelyToURL: with a temporary URL that replaces
+     the file once written, so segments are appended to a copy of the
+     file, never to the only copy. */
+
+  if (_appendsSegment && orig != nil && ![orig isEqual:url])
+    return [self _appendToURL:url originalContentsURL:orig error:err];
+
+  return [super writeToURL:url ofType:type forSaveOperation:op
+	  originalContentsURL:orig error:err];
+}
+
+- (BOOL)_appendToURL:(NSURL *)url originalContentsURL:(NSURL *)orig
+    error:(NSError **)err
+{
+  MgBinaryArchiveJournal *journal = _journal;
+  uint64_t offset = journal.length;
+
+  MgBinaryArchiver *archiver
+    = [[MgBinaryArchiver alloc] initWithJournal:journal];
+
+  [archiver mg_encodeCGSize:_documentSize forKey:@"documentSize"];
+  [archiver encodeObject:_documentNode forKey:NSKeyedArchiveRootObjectKey];
+
+  NSData *segment = [archiver finishEncoding];
+
+  /* The journal now includes the new segment, so can't be used again
+     unless it's written. */
+
+  _journal = nil;
+
+  /* Copies are cloned where the file system supports it, so this
+     doesn't read the whole file. */
+
+  if (![[NSFileManager defaultManager] copyItemAtURL:orig toURL:url
+	error:err])
+    return NO;
+
+  NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:url
+			  error:err];
+  if (handle == nil)
+    return NO;
+
+  BOOL success = YES;
+
+  @try
+    {
+      /* Truncating discards anything after the last valid segment,
+	 e.g. a partial segment from an earlier crash. */
+
+      [handle truncateFileAtOffset:offset];
+      [handle writeData:segment];
+      [handle synchronizeFile];
+    }
+  @catch (NSException *exception)
+    {
+      success = NO;
+    }
+  @finally
+    {
+      [handle closeFile];
+    }
+
+  if (!success)
+    {
+      if (err != NULL)
+	{
+	  *err = [NSError errorWithDomain:NSCocoaErrorDomain
+		  code:NSFileWriteUnknownError userInfo:nil];
+	}
+      return NO;
+    }
+
+  _pendingJournal = journal;
+
+  return YES;
+}
+
+- (BOOL)readFromURL:(NSURL *)url ofType:(NSString *)type
+    error:(NSError **)err
+{
+  /* Map the file rather than reading it. Binary archives reference
+     their image data from the mapping, so only the pages holding the
+     records and the images actually drawn are read from disk. (The
+     node graph itself is still decoded in full, since the layer list
+     and the save journal need every node.) Saves always replace the
+     file, even when appending to it, never modifying what was read,
+     so the mapping stays valid while the document is open. */
+
+  NSData *data = [NSData dataWithContentsOfURL:url
+		  options:NSDataReadingMappedIfSafe error:err];
+  if (data == nil)
+    return NO;
+
+  if (![self readFromData:data ofType:type error:err])
+    return NO;
+
+  _journalURL = _journal != nil ? url : nil;
+
+  return YES;
+}
+
 - (BOOL)readFromData:(NSData *)data ofType:(NSString *)type
     error:(NSError **)err
 {
   if ([type isEqualToString:@"org.unfactored.mg-archive"])
     {
+      /* Both formats share the same file type, so look at the data to
+	 see which one it is. */
+
+      if ([MgBinaryUnarchiver canReadData:data])
+	{
+	  MgBinaryUnarchiver *unarchiver
+	    = [[MgBinaryUnarchiver alloc] initForReadingWithData:data];
+
+	  CGSize size = [unarchiver mg_decodeCGSizeForKey:@"documentSize"];
+	  MgModuleLayer *node = [unarchiver decodeObjectOfClass:
+				 [MgModuleLayer class]
+				 forKey:NSKeyedArchiveRootObjectKey];
+
+	  _journal = [unarchiver journal];
+	  _journalURL = nil;
+
+	  [unarchiver finishDecoding];
+
+	  if (node == nil)
+	    {
+	      if (err != NULL)
+		{
+		  *err = [NSError errorWithDomain:NSCocoaErrorDomain
+			  code:NSFileReadCorruptFileError userInfo:nil];
+		}
+	      return NO;
+	    }
+
+	  self.documentSize = size;
+	  self.documentNode = node;
+
+	  return YES;
+	}
+
+      _journal = nil;
+      _journalURL = nil;
+
       NSKeyedUnarchiver *unarchiver
         = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
 
@@ -1321,7 +1568,7 @@ documentNodeChanged(GtDocument *self, GtTreeNode *tn, BOOL graphChanged)
   return state;
 }
 
-- (void)nodeState:(MgNodeState *)state
+- (void)node:(GtTreeNode *)tn state:(MgNodeState *)state
     setDefinesValue:(BOOL)flag forKey:(NSString *)key
 {
   BOOL oldFlag = [state definesValueForKey:key];
@@ -1330,7 +1577,7 @@ documentNodeChanged(GtDocument *self, GtTreeNode *tn, BOOL graphChanged)
     {
       [self registerUndo:^
 	{
-	  [self nodeState:state setDefinesValue:oldFlag forKey:key];
+	  [self node:tn state:state setDefinesValue:oldFlag forKey:key];
 	}];
 
       /* Preserve superstate's value if necessary. */
@@ -1343,6 +1590,8 @@ documentNodeChanged(GtDocument *self, GtTreeNode *tn, BOOL graphChanged)
 
       if (flag)
 	[state setValue:oldValue forKey:key];
+
+      [tn.node didModifyState:state];
     }
 }
 
@@ -1365,7 +1614,7 @@ documentNodeChanged(GtDocument *self, GtTreeNode *tn, BOOL graphChanged)
 
 	  node.state = state;
 
-	  [self nodeState:state setDefinesValue:YES forKey:key];
+	  [self node:tn state:state setDefinesValue:YES forKey:key];
 	}
     }
 }
@@ -1649,6 +1898,8 @@ indexOfObjectInArray(NSArray *array, id value, NSInteger idx)
 	}];
 
       [state setValue:value forKey:key];
+
+      [node didModifyModuleState:state];
     }
 }
 
@@ -35,6 +35,7 @@
   NSBackgroundStyle _backgroundStyle;
 
   NSOperation *_thumbnailOp;
+  MgGraphSnapshot *_thumbnailSnapshot;
   id _thumbnailImage;			/* CGImageRef */
   BOOL _pendingThumbnail;
 }
@@ -117,8 +118,20 @@
 
   if (_thumbnailOp == nil)
     {
-      NSMapTable *table = [NSMapTable strongToStrongObjectsMapTable];
-      MgModuleLayer *layer = [_controller.moduleLayer mg_graphCopy:table];
+      /* The snapshot only copies nodes changed since the last
+	 thumbnail, its copy is ours until the next update, which
+	 can't happen until the operation has finished. */
+
+      MgModuleLayer *module_layer = _controller.moduleLayer;
+
+      if (_thumbnailSnapshot.root != module_layer)
+	{
+	  _thumbnailSnapshot = [[MgGraphSnapshot alloc]
+				initWithRoot:module_layer];
+	}
+
+      MgModuleLayer *layer = (MgModuleLayer *)[_thumbnailSnapshot update];
+      MgModuleState *state = [_thumbnailSnapshot copiedObject:_state];
 
       CGFloat sx = [_thumbnailView bounds].size.width / layer.size.width;
       CGFloat sy = [_thumbnailView bounds].size.height / layer.size.height;
@@ -128,7 +141,7 @@
 
       _thumbnailOp = [NSBlockOperation blockOperationWithBlock:^
 	{
-	  [layer setModuleState:[table objectForKey:_state] animated:NO];
+	  [layer setModuleState:state animated:NO];
 
 	  CGImageRef im = [layer copyImageWithScale:s];
 
@@ -190,6 +190,7 @@
   if (_nodeLayer == nil)
     {
       _viewContext = [MgViewContext contextWithLayer:_rootLayer];
+      _viewContext.automaticallyFlattensLayers = YES;
       _nodeLayer = _viewContext.viewLayer;
       [layer addSublayer:_nodeLayer];
     }